@@ -0,0 +1,226 @@
+#include <Core/image/bitimage.h>
+
+#include <Core/exceptions/runtimeerror.h>
+#include <Core/image/imageview.h>
+#include <Core/utility/twodarray.h>
+
+#include <algorithm>
+
+namespace core {
+
+namespace {
+
+int popCount( BitImage::Word word )
+{
+#if defined( _MSC_VER ) && defined( _M_X64 )
+    return static_cast< int >( __popcnt64( word ) );
+#elif defined( __GNUC__ )
+    return __builtin_popcountll( word );
+#else
+    int count = 0;
+    for( ; word; word &= word - 1 ) {
+        count++;
+    }
+    return count;
+#endif
+}
+
+int wordsFor( int width )
+{
+    return ( width + BitImage::bitsPerWord - 1 ) / BitImage::bitsPerWord;
+}
+
+} // unnamed
+
+BitImage::BitImage()
+    : _width( 0 )
+    , _height( 0 )
+    , _wordsPerRow( 0 )
+{
+}
+
+BitImage::BitImage( int width, int height, bool initialVal )
+    : BitImage()
+{
+    recreate( width, height, initialVal );
+}
+
+BitImage::BitImage( const ImageBinaryView& image )
+    : BitImage()
+{
+    assign( image );
+}
+
+void BitImage::recreate( int width, int height, bool initialVal )
+{
+    if( width < 1 || height < 1 ) {
+        THROW_RUNTIME( "Illegal dimensions" );
+    }
+    _width = width;
+    _height = height;
+    _wordsPerRow = wordsFor( width );
+    _words.assign( static_cast< size_t >( _wordsPerRow ) * height, Word( 0 ) );
+    if( initialVal ) {
+        setAll( true );
+    }
+}
+
+void BitImage::reserve( int width, int height )
+{
+    _words.reserve( static_cast< size_t >( wordsFor( width ) ) * height );
+}
+
+void BitImage::assign( const ImageBinaryView& image )
+{
+    recreate( image.width(), image.height() );
+    for( int y = 0; y < _height; y++ ) {
+        const bool* pixels = image.row( y );
+        Word* words = row( y );
+        for( int x = 0; x < _width; x++ ) {
+            words[ x / bitsPerWord ] |= Word( pixels[ x ] ) << ( x % bitsPerWord );
+        }
+    }
+}
+
+void BitImage::copyTo( ImageBinary& image ) const
+{
+    if( image.size() != size() ) {
+        image.recreateUninitialized( _width, _height, RowLayout::AlignedRows );
+    }
+    for( int y = 0; y < _height; y++ ) {
+        const Word* words = row( y );
+        bool* pixels = image.row( y );
+        for( int x = 0; x < _width; x++ ) {
+            pixels[ x ] = ( words[ x / bitsPerWord ] >> ( x % bitsPerWord ) ) & 1;
+        }
+    }
+}
+
+void BitImage::setAll( bool val )
+{
+    std::fill( _words.begin(), _words.end(), val ? ~Word( 0 ) : Word( 0 ) );
+    if( val ) {
+        clearPadding();
+    }
+}
+
+BitImage& BitImage::operator |= ( const BitImage& other )
+{
+    if( other.size() != size() ) {
+        THROW_RUNTIME( "Images must have the same size" );
+    }
+    for( size_t i = 0; i < _words.size(); i++ ) {
+        _words[ i ] |= other._words[ i ];
+    }
+    return *this;
+}
+
+BitImage& BitImage::operator &= ( const BitImage& other )
+{
+    if( other.size() != size() ) {
+        THROW_RUNTIME( "Images must have the same size" );
+    }
+    for( size_t i = 0; i < _words.size(); i++ ) {
+        _words[ i ] &= other._words[ i ];
+    }
+    return *this;
+}
+
+void BitImage::invert()
+{
+    for( auto& word : _words ) {
+        word = ~word;
+    }
+    clearPadding();
+}
+
+void BitImage::dilateRows( int radius )
+{
+    if( radius < 0 ) {
+        THROW_RUNTIME( "Negative radius" );
+    }
+    // Dilating by a and then by b is dilating by a + b, so wide radii go in steps short enough
+    // that a word only ever takes bits from its immediate neighbors.
+    while( radius > 0 ) {
+        const int step = std::min( radius, bitsPerWord - 1 );
+        radius -= step;
+        for( int y = 0; y < _height; y++ ) {
+            Word* words = row( y );
+            // The word to the left, as it was before this row was dilated.
+            Word left = 0;
+            for( int w = 0; w < _wordsPerRow; w++ ) {
+                const Word here = words[ w ];
+                const Word right = w + 1 < _wordsPerRow ? words[ w + 1 ] : Word( 0 );
+                Word dilated = here;
+                for( int shift = 1; shift <= step; shift++ ) {
+                    // Bits move to higher x with a left shift.
+                    dilated |= ( here << shift ) | ( left >> ( bitsPerWord - shift ) );
+                    dilated |= ( here >> shift ) | ( right << ( bitsPerWord - shift ) );
+                }
+                words[ w ] = dilated;
+                left = here;
+            }
+        }
+        clearPadding();
+    }
+}
+
+void BitImage::dilateColumns( int radius )
+{
+    if( radius < 0 ) {
+        THROW_RUNTIME( "Negative radius" );
+    }
+    // One pixel at a time, so that walking down a column of words needs to remember only the
+    // word above as it was, the word below not having been changed yet.
+    for( int step = 0; step < radius; step++ ) {
+        for( int w = 0; w < _wordsPerRow; w++ ) {
+            Word above = 0;
+            for( int y = 0; y < _height; y++ ) {
+                Word& here = row( y )[ w ];
+                const Word below = y + 1 < _height ? row( y + 1 )[ w ] : Word( 0 );
+                const Word original = here;
+                here |= above | below;
+                above = original;
+            }
+        }
+    }
+}
+
+void BitImage::dilate( int radius )
+{
+    dilateColumns( radius );
+    dilateRows( radius );
+}
+
+size_t BitImage::count() const
+{
+    size_t count = 0;
+    for( const auto word : _words ) {
+        count += popCount( word );
+    }
+    return count;
+}
+
+bool BitImage::any() const
+{
+    return std::any_of( _words.begin(), _words.end(), []( Word word ) { return word != 0; } );
+}
+
+BitImage::Word BitImage::lastWordMask() const
+{
+    const int usedBits = _width - ( _wordsPerRow - 1 ) * bitsPerWord;
+    return usedBits == bitsPerWord ? ~Word( 0 ) : ( Word( 1 ) << usedBits ) - 1;
+}
+
+void BitImage::clearPadding()
+{
+    const Word mask = lastWordMask();
+    if( mask == ~Word( 0 ) ) {
+        return;
+    }
+    for( int y = 0; y < _height; y++ ) {
+        row( y )[ _wordsPerRow - 1 ] &= mask;
+    }
+}
+
+} // core
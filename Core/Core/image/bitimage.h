@@ -0,0 +1,153 @@
+#ifndef CORE_BITIMAGE_H
+#define CORE_BITIMAGE_H
+
+#include <Core/image/imagetypes.h>
+#include <Core/utility/intcoord.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#if defined( _MSC_VER )
+#include <intrin.h>
+#endif
+
+namespace core {
+
+/// A binary image packed 64 pixels to a word, for an eighth of an ImageBinary's memory and
+/// mask algebra that handles a word at a time. Each row starts on a new word; pixel x of a
+/// row is bit x % 64 of the row's word x / 64, and the bits past the last pixel of a row are
+/// always false, so that whole-word operations can ignore them.
+///
+/// Storage is kept across recreate() calls that need no more of it, as with TwoDArray.
+class BitImage
+{
+public:
+    using Word = std::uint64_t;
+    static constexpr int bitsPerWord = 64;
+
+    /// An empty image, to be recreated before use.
+    BitImage();
+    BitImage( int width, int height, bool initialVal = false );
+    explicit BitImage( const ImageBinaryView& image );
+
+    void recreate( int width, int height, bool initialVal = false );
+    /// Allocate enough storage for a 'width' by 'height' image, so that recreating to that
+    /// size or smaller allocates nothing. Leaves the image as it was.
+    void reserve( int width, int height );
+    /// Become a packed copy of 'image'.
+    void assign( const ImageBinaryView& image );
+    /// Unpack into 'image', recreating it if its size differs.
+    void copyTo( ImageBinary& image ) const;
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    IntCoord size() const { return IntCoord( _width, _height ); }
+    int wordsPerRow() const { return _wordsPerRow; }
+
+    bool isValidCoord( int x, int y ) const
+    {
+        return x >= 0 && y >= 0 && x < _width && y < _height;
+    }
+    bool isValidCoord( const IntCoord& coord ) const
+    {
+        return isValidCoord( coord.x(), coord.y() );
+    }
+
+    bool get( int x, int y ) const
+    {
+        return ( row( y )[ x / bitsPerWord ] >> ( x % bitsPerWord ) ) & 1;
+    }
+    bool get( const IntCoord& coord ) const
+    {
+        return get( coord.x(), coord.y() );
+    }
+    void set( int x, int y, bool val )
+    {
+        const Word bit = Word( 1 ) << ( x % bitsPerWord );
+        Word& word = row( y )[ x / bitsPerWord ];
+        word = val ? word | bit : word & ~bit;
+    }
+    void set( const IntCoord& coord, bool val )
+    {
+        set( coord.x(), coord.y(), val );
+    }
+    void setAll( bool val );
+
+    const Word* row( int y ) const
+    {
+        return _words.data() + static_cast< size_t >( _wordsPerRow ) * y;
+    }
+    Word* row( int y )
+    {
+        return _words.data() + static_cast< size_t >( _wordsPerRow ) * y;
+    }
+
+    /// Pixel-wise OR and AND with 'other', which must have the same size.
+    BitImage& operator |= ( const BitImage& other );
+    BitImage& operator &= ( const BitImage& other );
+    /// Flip every pixel.
+    void invert();
+
+    /// Dilate every row by 'radius' pixels to either side, in place: a pixel becomes true if
+    /// any pixel of its row within 'radius' of it was.
+    void dilateRows( int radius );
+    /// Same as above, but up and down.
+    void dilateColumns( int radius );
+    /// Dilate in place by a square structuring element 2 * 'radius' + 1 pixels wide centered
+    /// on each pixel, as imageUtility::dilate() does with an all-true structure of that width.
+    void dilate( int radius );
+
+    /// The number of true pixels.
+    size_t count() const;
+    bool any() const;
+
+    /// Call 'visit'( x, y ) for every true pixel, in row-major order, skipping false pixels a
+    /// word at a time.
+    template< typename Visit >
+    void forEachSetBit( Visit&& visit ) const
+    {
+        for( int y = 0; y < _height; y++ ) {
+            const Word* words = row( y );
+            for( int w = 0; w < _wordsPerRow; w++ ) {
+                Word word = words[ w ];
+                while( word ) {
+                    visit( w * bitsPerWord + lowestSetBit( word ), y );
+                    word &= word - 1;
+                }
+            }
+        }
+    }
+private:
+    static int lowestSetBit( Word word )
+    {
+#if defined( _MSC_VER ) && defined( _M_X64 )
+        unsigned long index;
+        _BitScanForward64( &index, word );
+        return static_cast< int >( index );
+#elif defined( __GNUC__ )
+        return __builtin_ctzll( word );
+#else
+        int index = 0;
+        while( !( word & 1 ) ) {
+            word >>= 1;
+            index++;
+        }
+        return index;
+#endif
+    }
+
+    /// The bits of a row's last word that hold pixels.
+    Word lastWordMask() const;
+    /// Clear the bits past the last pixel of every row.
+    void clearPadding();
+
+    int _width;
+    int _height;
+    int _wordsPerRow;
+    std::vector< Word > _words;
+};
+
+} // core
+
+#endif // #include
@@ -0,0 +1,111 @@
+#ifndef CORE_HALOIMAGE_H
+#define CORE_HALOIMAGE_H
+
+#include <Core/exceptions/runtimeerror.h>
+#include <Core/utility/intcoord.h>
+#include <Core/utility/twodarray.h>
+
+#include <algorithm>
+#include <cstddef>
+
+namespace core {
+
+/// A 2D array with a border, or halo, of halo() extra cells on every side, all holding a
+/// sentinel value. Reads up to halo() cells outside the image need no bounds checks, and
+/// getClamped() reads at any coordinates without a branch. Coordinates are those of the
+/// image proper, so the border runs from -halo() to width() + halo() - 1.
+template< typename T >
+class HaloImage
+{
+public:
+    HaloImage()
+        : _width( 0 )
+        , _height( 0 )
+        , _halo( 0 )
+        , _origin( nullptr )
+        , _stride( 0 )
+    {
+    }
+
+    /// Make the image 'width' by 'height' with a border 'halo' cells wide, and set every cell,
+    /// border included, to 'sentinel'. Storage is reused when large enough (see reserve()).
+    void recreate( int width, int height, int halo, T sentinel )
+    {
+        if( width < 1 || height < 1 || halo < 0 ) {
+            THROW_RUNTIME( "Illegal dimensions" );
+        }
+        _cells.recreate( width + 2 * halo, height + 2 * halo, sentinel, RowLayout::AlignedRows );
+        _width = width;
+        _height = height;
+        _halo = halo;
+        _stride = _cells.stride();
+        _origin = _cells.row( halo ) + halo;
+    }
+
+    /// Allocate enough storage for recreate( 'width', 'height', 'halo', ... ).
+    void reserve( int width, int height, int halo )
+    {
+        _cells.reserve( width + 2 * halo, height + 2 * halo, RowLayout::AlignedRows );
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    IntCoord size() const { return IntCoord( _width, _height ); }
+    int halo() const { return _halo; }
+
+    /// 'x' and 'y' may be up to halo() outside the image.
+    T get( int x, int y ) const
+    {
+        return _origin[ static_cast< std::ptrdiff_t >( _stride ) * y + x ];
+    }
+    T get( const IntCoord& coord ) const
+    {
+        return get( coord.x(), coord.y() );
+    }
+
+    /// Same as get(), but for any coordinates: those beyond the border read the nearest border
+    /// cell, which holds the sentinel unless set() has changed it. halo() must be at least 1.
+    T getClamped( int x, int y ) const
+    {
+        x = std::min( std::max( x, -_halo ), _width - 1 + _halo );
+        y = std::min( std::max( y, -_halo ), _height - 1 + _halo );
+        return get( x, y );
+    }
+    T getClamped( const IntCoord& coord ) const
+    {
+        return getClamped( coord.x(), coord.y() );
+    }
+
+    void set( int x, int y, T val )
+    {
+        _origin[ static_cast< std::ptrdiff_t >( _stride ) * y + x ] = val;
+    }
+
+    /// Set every cell of the image proper, leaving the border alone, to 'generator'( x, y ).
+    /// See TwoDArray::fill() for 'parallel'.
+    template< typename Generator >
+    void fillInterior( Generator&& generator, bool parallel = false )
+    {
+        const int width = _width;
+        const int height = _height;
+#pragma omp parallel for schedule( static ) if( parallel )
+        for( int y = 0; y < height; y++ ) {
+            T* cells = _origin + static_cast< std::ptrdiff_t >( _stride ) * y;
+            for( int x = 0; x < width; x++ ) {
+                cells[ x ] = generator( x, y );
+            }
+        }
+    }
+private:
+    int _width;
+    int _height;
+    int _halo;
+    TwoDArray< T > _cells;
+    /// Cell ( 0, 0 ) of the image proper, inside '_cells'.
+    T* _origin;
+    int _stride;
+};
+
+} // core
+
+#endif // #include
@@ -0,0 +1,245 @@
+#ifndef CORE_IMAGEPYRAMID_H
+#define CORE_IMAGEPYRAMID_H
+
+#include <Core/exceptions/runtimeerror.h>
+#include <Core/image/imageview.h>
+#include <Core/utility/intcoord.h>
+#include <Core/utility/twodarray.h>
+#include <Core/utility/vector3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <type_traits>
+#include <vector>
+
+namespace core {
+
+/// Downsampled copies of one source image, one per level at sizes the caller chooses. Each level
+/// is built from the source the first time it is asked for and then kept until the next
+/// reset(), so that a level shared by several users is filtered once. A level the size of the
+/// source is the source itself wherever the source's pixels can be read as T in place.
+///
+/// reset() sizes the storage of every level, one buffer stacking them all, and the scratch the
+/// filter needs, so building levels never allocates, and neither does a later reset() to levels
+/// no larger. Levels are built from the coarsest up in practice, so sizing them one at a time
+/// would grow the buffers at every level.
+///
+/// Levels are box filtered like imageUtility::downsample(), except that a binary (bool) image
+/// is downsampled like imageUtility::downsampleBoolean() with trues prevailing. The filter is
+/// applied separably, first along rows and then along columns, over index spans worked out
+/// once per level, with the rows of each pass spread across the OpenMP threads. Summing in
+/// that order can round differently from downsample() in the last bits.
+///
+/// 'Source' is ImageView< T > or a view whose get() reads a T, such as ImageRGBView; the
+/// viewed memory must outlive the pyramid's use of it. Not thread-safe: level() may build.
+template< typename T, typename Source = ImageView< T > >
+class ImagePyramid
+{
+public:
+    /// Start over on 'source' with one level per entry of 'levelSizes', each of which must be
+    /// positive and no larger than the source. Levels built before are forgotten, even when
+    /// 'source' views the same memory, since its pixels may have changed; their storage is
+    /// kept.
+    void reset( const Source& source, const std::vector< IntCoord >& levelSizes )
+    {
+        for( const auto& size : levelSizes ) {
+            if( size.x() < 1 || size.y() < 1 || size.x() > source.width() || size.y() > source.height() ) {
+                THROW_RUNTIME( "Illegal pyramid level size" );
+            }
+        }
+        _source = source;
+        _levelSizes = levelSizes;
+        const int numLevels = static_cast< int >( levelSizes.size() );
+        _levels.resize( numLevels );
+        _storageRows.assign( numLevels, -1 );
+        _built.assign( numLevels, false );
+
+        // Lay the levels that need storage out one below the other, and size the scratch for
+        // the largest of those that are filtered.
+        ImageView< T > inPlace;
+        const bool canViewInPlace = viewInPlace( source, inPlace );
+        int storageWidth = 0;
+        int storageHeight = 0;
+        int maxFilteredWidth = 0;
+        int maxFilteredHeight = 0;
+        for( int level = 0; level < numLevels; level++ ) {
+            const IntCoord size = levelSizes[ level ];
+            const bool isSourceSize = size == source.size();
+            if( isSourceSize && canViewInPlace ) {
+                continue;
+            }
+            _storageRows[ level ] = storageHeight;
+            storageWidth = std::max( storageWidth, size.x() );
+            storageHeight += size.y();
+            if( !isSourceSize ) {
+                maxFilteredWidth = std::max( maxFilteredWidth, size.x() );
+                maxFilteredHeight = std::max( maxFilteredHeight, size.y() );
+            }
+        }
+        if( storageHeight > 0 ) {
+            // Every level is written before it is read.
+            _storage.recreateUninitialized( storageWidth, storageHeight, RowLayout::AlignedRows );
+        }
+        if( maxFilteredWidth > 0 ) {
+            _rowSums.reserve( maxFilteredWidth, source.height(), RowLayout::AlignedRows );
+            _xSpans.reserve( maxFilteredWidth );
+            _ySpans.reserve( maxFilteredHeight );
+        }
+
+        for( int level = 0; level < numLevels; level++ ) {
+            const IntCoord size = levelSizes[ level ];
+            if( _storageRows[ level ] < 0 ) {
+                _levels[ level ] = inPlace;
+                _built[ level ] = true;
+            } else {
+                _levels[ level ] = ImageView< T >(
+                    _storage.row( _storageRows[ level ] ), size.x(), size.y(), _storage.stride() );
+            }
+        }
+    }
+
+    const Source& source() const { return _source; }
+    int numLevels() const { return static_cast< int >( _levelSizes.size() ); }
+    IntCoord levelSize( int level ) const { return _levelSizes[ level ]; }
+    bool isBuilt( int level ) const { return _built[ level ]; }
+
+    /// Level 'level', built first if need be. The view stays valid until the next reset().
+    const ImageView< T >& level( int level )
+    {
+        if( level < 0 || level >= numLevels() ) {
+            THROW_RUNTIME( "Illegal pyramid level" );
+        }
+        if( !_built[ level ] ) {
+            build( level );
+        }
+        return _levels[ level ];
+    }
+
+    /// Build every level not built yet.
+    void buildAll()
+    {
+        for( int level = 0; level < numLevels(); level++ ) {
+            this->level( level );
+        }
+    }
+private:
+    static constexpr bool isBinary = std::is_same< T, bool >::value;
+
+    /// The source pixels [ begin, end ) along one axis that make up one level pixel.
+    struct Span
+    {
+        int begin;
+        int end;
+    };
+
+    /// Whether the pixels of 'source' can be read as T where they are, and if so, set 'view'
+    /// to them.
+    static bool viewInPlace( const Source& source, ImageView< T >& view )
+    {
+        if constexpr( std::is_same< Source, ImageView< T > >::value ) {
+            view = source;
+            return true;
+        } else if constexpr( std::is_same< Source, ImageRGBView >::value && std::is_same< T, Vector3 >::value ) {
+            if( source.hasVector3Pixels() ) {
+                view = source.vector3Pixels();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /// The spans of a level 'newLength' pixels long, as downsample() works them out.
+    static void makeSpans( int sourceLength, int newLength, std::vector< Span >& spans )
+    {
+        spans.resize( newLength );
+        for( int i = 0; i < newLength; i++ ) {
+            const double begin = ( ( (double)i ) / ( (double)newLength ) ) * ( (double)( sourceLength - 1 ) );
+            const double end = ( ( (double)( i + 1 ) ) / ( (double)newLength ) ) * ( (double)( sourceLength - 1 ) );
+            spans[ i ] = Span{ (int)std::ceil( begin ), (int)std::ceil( end ) };
+        }
+    }
+
+    static void accumulate( T& sum, const T& val )
+    {
+        if constexpr( isBinary ) {
+            sum = sum || val;
+        } else {
+            sum += val;
+        }
+    }
+
+    /// Set every pixel ( x, y ) of level 'level' to 'generator'( x, y ), rows spread across
+    /// the OpenMP threads.
+    template< typename Generator >
+    void fillLevel( int level, Generator&& generator )
+    {
+        const IntCoord size = _levelSizes[ level ];
+        const int firstRow = _storageRows[ level ];
+#pragma omp parallel for schedule( static )
+        for( int y = 0; y < size.y(); y++ ) {
+            T* cells = _storage.row( firstRow + y );
+            for( int x = 0; x < size.x(); x++ ) {
+                cells[ x ] = generator( x, y );
+            }
+        }
+    }
+
+    void build( int level )
+    {
+        const IntCoord size = _levelSizes[ level ];
+        if( _source.size() == size ) {
+            fillLevel( level, [ this ]( int x, int y ) { return _source.get( x, y ); } );
+            _built[ level ] = true;
+            return;
+        }
+
+        makeSpans( _source.width(), size.x(), _xSpans );
+        makeSpans( _source.height(), size.y(), _ySpans );
+
+        // Along rows: every source row, at the level's width. Within the room reset() made.
+        if( _rowSums.width() != size.x() || _rowSums.height() != _source.height() ) {
+            _rowSums.recreateUninitialized( size.x(), _source.height(), RowLayout::AlignedRows );
+        }
+        _rowSums.fill( [ this ]( int x, int y ) {
+            T sum = T(); //explicit constructor necessary for primitive types.
+            for( int xSource = _xSpans[ x ].begin; xSource < _xSpans[ x ].end; xSource++ ) {
+                accumulate( sum, _source.get( xSource, y ) );
+            }
+            return sum;
+        }, true );
+
+        // Along columns, from the row sums.
+        fillLevel( level, [ this ]( int x, int y ) {
+            T sum = T();
+            for( int ySource = _ySpans[ y ].begin; ySource < _ySpans[ y ].end; ySource++ ) {
+                accumulate( sum, _rowSums.get( x, ySource ) );
+            }
+            if constexpr( isBinary ) {
+                return sum;
+            } else {
+                const int count = ( _xSpans[ x ].end - _xSpans[ x ].begin ) * ( _ySpans[ y ].end - _ySpans[ y ].begin );
+                return T( sum / ( (double)count ) );
+            }
+        } );
+        _built[ level ] = true;
+    }
+
+    Source _source;
+    std::vector< IntCoord > _levelSizes;
+    /// Every level, viewing either '_storage' or the source.
+    std::vector< ImageView< T > > _levels;
+    /// Each level's first row in '_storage'; -1 for a level that views the source.
+    std::vector< int > _storageRows;
+    std::vector< bool > _built;
+    /// Every level that does not view the source, stacked. Kept across reset(), for its
+    /// storage.
+    TwoDArray< T > _storage;
+    std::vector< Span > _xSpans;
+    std::vector< Span > _ySpans;
+    /// The source filtered along rows, for the level being built.
+    TwoDArray< T > _rowSums;
+};
+
+} // core
+
+#endif // #include
@@ -15,6 +15,15 @@ using ImageRGB = TwoDArray< Vector3 >;
 using ImageRGBA = TwoDArray< Vector4 >;
 using ImageBinary = TwoDArray< bool >;
 using ImageScalar = TwoDArray< double >;
+
+template< typename T >
+class ImageView;
+class ImageRGBView;
+
+using ImageBinaryView = ImageView< bool >;
+
+/// A bit-packed counterpart of ImageBinary.
+class BitImage;
 	
 } // core
 #endif // #include
\ No newline at end of file
@@ -25,40 +25,30 @@ void dilate(
         target.recreate(source.width(), source.height());
     }
 
-    for (int x = 0; x < target.width(); x++)
+    target.fill([&](int x, int y)
     {
-        for (int y = 0; y < target.height(); y++)
+        IntCoord here(x, y);
+        for (int sx = 0; sx < structure.width(); sx++)
         {
-            IntCoord here(x, y);
-            bool mark = false;
-            for (int sx = 0; sx < structure.width(); sx++)
+            for (int sy = 0; sy < structure.height(); sy++)
             {
-                for (int sy = 0; sy < structure.height(); sy++)
+                if (structure.get(sx, sy) == false) continue;
+                IntCoord toCheck(sx, sy);
+                toCheck -= structureAnchor;
+                toCheck = here - toCheck;
+                if (source.isValidCoord(toCheck) == false) continue;
+                if (source.get(toCheck))
                 {
-                    if (structure.get(sx, sy) == false) continue;
-                    IntCoord toCheck(sx, sy);
-                    toCheck -= structureAnchor;
-                    toCheck = here - toCheck;
-                    if (source.isValidCoord(toCheck) == false) continue;
-                    if (source.get(toCheck))
-                    {
-                        mark = true;
-                        break;
-                    }
+                    return true;
                 }
-                if (mark) break;
-            }
-
-            if (mark)
-            {
-                target.set(x, y, true);
             }
         }
-    }
+        return false;
+    }, true);
 }
 
 void getDistanceMapBidirectional(
-    const ImageBinary& getDistTo, 
+    const ImageBinaryView& getDistTo, 
     ImageScalar& storeResult )
 {
     storeResult.recreate(getDistTo.width(),getDistTo.height());
@@ -115,53 +105,46 @@ void getDistanceMapBidirectional(
 }
 
 void downsampleBoolean( 
-    const ImageBinary& source, 
+    const ImageBinaryView& source, 
     ImageBinary& dest, 
     const IntCoord& newSize, 
     bool truesPrevail)
 {
-    //are we just cloning?
-    if(source.size()==newSize)
-    {
-        ImageBinary::clone(source,dest);
-        return;
-    }
-
     int newWidth = newSize.x();
     int newHeight = newSize.y();
 
     if(dest.width()!=newWidth || dest.height()!=newHeight)
     {
-        dest.recreate(newWidth,newHeight);
+        dest.recreateUninitialized(newWidth,newHeight,RowLayout::AlignedRows);
     }
-    for(int xNew=0; xNew<newWidth; xNew++)
+
+    //are we just copying?
+    if(source.size()==newSize)
     {
-        for(int yNew=0; yNew<newHeight; yNew++)
+        dest.fill([&source](int x, int y) { return source.get(x,y); }, true);
+        return;
+    }
+    dest.fill([&](int xNew, int yNew)
+    {
+        //find the topleft corner of the smaller image pixel in the
+        //space of the larger (original) image.
+        double left = (((double)xNew)/((double)(newWidth)))*((double)(source.width()-1));
+        double top = (((double)yNew)/((double)(newHeight)))*((double)(source.height()-1));
+        double right = (((double)(xNew+1))/((double)(newWidth)))*((double)(source.width()-1));
+        double bottom = (((double)(yNew+1))/((double)(newHeight)))*((double)(source.height()-1));
+
+        for(int xOld = (int)ceil(left); xOld<(int)ceil(right); xOld++)
         {
-            //find the topleft corner of the smaller image pixel in the
-            //space of the larger (original) image.
-            double left = (((double)xNew)/((double)(newWidth)))*((double)(source.width()-1));
-            double top = (((double)yNew)/((double)(newHeight)))*((double)(source.height()-1));
-            double right = (((double)(xNew+1))/((double)(newWidth)))*((double)(source.width()-1));
-            double bottom = (((double)(yNew+1))/((double)(newHeight)))*((double)(source.height()-1));
-
-            bool result=!truesPrevail;
-
-            for(int xOld = (int)ceil(left); xOld<(int)ceil(right); xOld++)
+            for(int yOld = (int)ceil(top); yOld<(int)ceil(bottom); yOld++)
             {
-                if(result==truesPrevail) break;
-                for(int yOld = (int)ceil(top); yOld<(int)ceil(bottom); yOld++)
+                if(source.get(xOld,yOld)==truesPrevail)
                 {
-                    if(source.get(xOld,yOld)==truesPrevail)
-                    {
-                        result=truesPrevail;
-                        break;
-                    }
+                    return truesPrevail;
                 }
             }
-            dest.set(xNew,yNew,result);
         }
-    }
+        return !truesPrevail;
+    }, true);
 }
 
 } // imageUtility
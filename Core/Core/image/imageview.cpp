@@ -0,0 +1,135 @@
+#include <Core/image/imageview.h>
+
+#include <Core/exceptions/runtimeerror.h>
+
+namespace core {
+
+ImageRGBView::ImageRGBView()
+    : _bytes( nullptr )
+    , _width( 0 )
+    , _height( 0 )
+    , _rowBytes( 0 )
+    , _order( ChannelOrder8::RGB )
+{
+}
+
+ImageRGBView::ImageRGBView( const ImageView< Vector3 >& pixels )
+    : _vector3Pixels( pixels )
+    , _bytes( nullptr )
+    , _width( pixels.width() )
+    , _height( pixels.height() )
+    , _rowBytes( sizeof( Vector3 ) * pixels.stride() )
+    , _order( ChannelOrder8::RGB )
+{
+}
+
+ImageRGBView::ImageRGBView( const ImageRGB& image )
+    : ImageRGBView( ImageView< Vector3 >( image ) )
+{
+}
+
+ImageRGBView::ImageRGBView(
+    const std::uint8_t* data,
+    int width,
+    int height,
+    size_t rowBytes,
+    ChannelOrder8 order )
+    : _bytes( data )
+    , _width( width )
+    , _height( height )
+    , _rowBytes( rowBytes )
+    , _order( order )
+{
+    if( !data || width < 1 || height < 1 || rowBytes < static_cast< size_t >( width ) * bytesPerPixel() ) {
+        THROW_RUNTIME( "Illegal image view" );
+    }
+}
+
+int ImageRGBView::width() const
+{
+    return _width;
+}
+
+int ImageRGBView::height() const
+{
+    return _height;
+}
+
+IntCoord ImageRGBView::size() const
+{
+    return IntCoord( _width, _height );
+}
+
+Vector3 ImageRGBView::get( int x, int y ) const
+{
+    if( hasVector3Pixels() ) {
+        return _vector3Pixels.get( x, y );
+    }
+    const std::uint8_t* pixel = byteRow( y ) + x * bytesPerPixel();
+    return Vector3(
+        pixel[ redOffset() ] / 255.0,
+        pixel[ greenOffset() ] / 255.0,
+        pixel[ blueOffset() ] / 255.0 );
+}
+
+Vector3 ImageRGBView::get( const IntCoord& coord ) const
+{
+    return get( coord.x(), coord.y() );
+}
+
+bool ImageRGBView::hasVector3Pixels() const
+{
+    return !_bytes;
+}
+
+const Vector3* ImageRGBView::vector3Row( int y ) const
+{
+    return _vector3Pixels.row( y );
+}
+
+const ImageView< Vector3 >& ImageRGBView::vector3Pixels() const
+{
+    return _vector3Pixels;
+}
+
+const std::uint8_t* ImageRGBView::byteRow( int y ) const
+{
+    return _bytes + _rowBytes * y;
+}
+
+int ImageRGBView::bytesPerPixel() const
+{
+    return _order == ChannelOrder8::RGB || _order == ChannelOrder8::BGR ? 3 : 4;
+}
+
+int ImageRGBView::redOffset() const
+{
+    return _order == ChannelOrder8::RGB || _order == ChannelOrder8::RGBA ? 0 : 2;
+}
+
+int ImageRGBView::greenOffset() const
+{
+    return 1;
+}
+
+int ImageRGBView::blueOffset() const
+{
+    return 2 - redOffset();
+}
+
+bool ImageRGBView::sameAs( const ImageRGBView& other ) const
+{
+    if( hasVector3Pixels() != other.hasVector3Pixels() ) {
+        return false;
+    }
+    if( hasVector3Pixels() ) {
+        return _vector3Pixels.sameAs( other._vector3Pixels );
+    }
+    return _bytes == other._bytes
+        && _width == other._width
+        && _height == other._height
+        && _rowBytes == other._rowBytes
+        && _order == other._order;
+}
+
+} // core
@@ -0,0 +1,148 @@
+#ifndef CORE_IMAGEVIEW_H
+#define CORE_IMAGEVIEW_H
+
+#include <Core/image/imagetypes.h>
+#include <Core/utility/intcoord.h>
+#include <Core/utility/twodarray.h>
+#include <Core/utility/vector3.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace core {
+
+/// A read-only window onto a row-major 2D array of T in memory that the caller owns and must
+/// keep alive, and unchanged, for as long as the view is in use. Rows are stride() elements
+/// apart, so a view can cover a TwoDArray with either RowLayout or foreign memory. Copying a
+/// view copies no pixels.
+template< typename T >
+class ImageView
+{
+public:
+    /// An empty view, to be assigned before use.
+    ImageView()
+        : _data( nullptr )
+        , _width( 0 )
+        , _height( 0 )
+        , _stride( 0 )
+    {
+    }
+
+    /// 'stride' is in elements and must be at least 'width'.
+    ImageView( const T* data, int width, int height, int stride )
+        : _data( data )
+        , _width( width )
+        , _height( height )
+        , _stride( stride )
+    {
+        if( !data || width < 1 || height < 1 || stride < width ) {
+            THROW_RUNTIME( "Illegal image view" );
+        }
+    }
+
+    /// Views all of 'image'. Implicit, so a TwoDArray can be passed wherever a view is taken.
+    ImageView( const TwoDArray< T >& image )
+        : ImageView( image.row( 0 ), image.width(), image.height(), image.stride() )
+    {
+    }
+
+    int width() const { return _width; }
+    int height() const { return _height; }
+    int stride() const { return _stride; }
+    IntCoord size() const { return IntCoord( _width, _height ); }
+
+    const T* row( int y ) const
+    {
+        return _data + static_cast< size_t >( _stride ) * y;
+    }
+
+    T get( int x, int y ) const
+    {
+        return row( y )[ x ];
+    }
+
+    T get( const IntCoord& coord ) const
+    {
+        return get( coord.x(), coord.y() );
+    }
+
+    /// Whether 'other' looks at the very same pixels, e.g., because both view one TwoDArray.
+    bool sameAs( const ImageView& other ) const
+    {
+        return _data == other._data
+            && _width == other._width
+            && _height == other._height
+            && _stride == other._stride;
+    }
+private:
+    const T* _data;
+    int _width;
+    int _height;
+    int _stride;
+};
+
+/// The channel order of an 8-bit interleaved RGB image. The four-byte orders skip their
+/// alpha (or padding) byte.
+enum class ChannelOrder8
+{
+    RGB,
+    BGR,
+    RGBA,
+    BGRA
+};
+
+/// A read-only RGB image in caller-owned memory (see ImageView), holding either Vector3 pixels,
+/// as an ImageRGB does, or 8-bit interleaved channels such as a decoded file or a toolkit's
+/// image buffer. Either way get() reads a pixel as a Vector3 with channels in [0,1], an 8-bit
+/// channel c reading as c / 255.
+class ImageRGBView
+{
+public:
+    /// An empty view, to be assigned before use.
+    ImageRGBView();
+    /// Implicit, like ImageView's constructor from a TwoDArray.
+    ImageRGBView( const ImageView< Vector3 >& pixels );
+    ImageRGBView( const ImageRGB& image );
+    /// 'width' * 'height' pixels of 8-bit channels in 'order', with rows 'rowBytes' apart.
+    ImageRGBView(
+        const std::uint8_t* data,
+        int width,
+        int height,
+        size_t rowBytes,
+        ChannelOrder8 order );
+
+    int width() const;
+    int height() const;
+    IntCoord size() const;
+
+    Vector3 get( int x, int y ) const;
+    Vector3 get( const IntCoord& coord ) const;
+
+    /// True when the pixels are Vector3s, readable a row at a time through vector3Row();
+    /// false when they are 8-bit, readable through byteRow().
+    bool hasVector3Pixels() const;
+    const Vector3* vector3Row( int y ) const;
+    /// For Vector3 pixels: all of them, as a view.
+    const ImageView< Vector3 >& vector3Pixels() const;
+    const std::uint8_t* byteRow( int y ) const;
+    /// For 8-bit pixels: bytes per pixel, and the byte offsets of the channels within one.
+    int bytesPerPixel() const;
+    int redOffset() const;
+    int greenOffset() const;
+    int blueOffset() const;
+
+    /// Whether 'other' looks at the very same pixels in the same layout, as when a job's source
+    /// and target are one image.
+    bool sameAs( const ImageRGBView& other ) const;
+private:
+    ImageView< Vector3 > _vector3Pixels;
+    const std::uint8_t* _bytes;
+    int _width;
+    int _height;
+    size_t _rowBytes;
+    ChannelOrder8 _order;
+};
+
+} // core
+
+#endif // #include
@@ -7,12 +7,29 @@
 
 #include <boost/numeric/conversion/cast.hpp>
 
+#include <cstddef>
+#include <cstring>
 #include <memory>
 #include <functional>
+#include <new>
+#include <numeric>
+#include <type_traits>
 #include <vector>
 
 namespace core {
 
+/// How a TwoDArray lays its rows out in memory. Either way the first row starts on a
+/// TwoDArray::alignment boundary.
+enum class RowLayout
+{
+    /// Rows directly follow each other, so the whole array is one run of width * height
+    /// elements and can be indexed by x + width * y.
+    Packed,
+    /// Every row starts on a TwoDArray::alignment boundary, with padding elements after each
+    /// row as needed (see stride()), so that row loops can use aligned vector loads.
+    AlignedRows
+};
+
 template< typename T >
 class TwoDArray
 {
@@ -20,6 +37,10 @@ public:
 
     using Type = TwoDArray< T >;
 
+    /// Bytes to which storage, and under RowLayout::AlignedRows every row, is aligned: a cache
+    /// line, and the widest vector register.
+    static constexpr size_t alignment = 64;
+
     explicit TwoDArray(
         int width = 1, 
         int height = 1, 
@@ -37,6 +58,8 @@ public:
     {
         _width = other.width();
         _height = other.height();
+        _stride = other.stride();
+        _layout = other.layout();
         _array = std::move( other._array );
         other._array = nullptr;
         other.recreate( 1, 1 );
@@ -45,6 +68,9 @@ public:
 
     int width() const { return _width; }
     int height() const { return _height; }
+    /// Elements from the start of one row to the start of the next; width() when packed.
+    int stride() const { return _stride; }
+    RowLayout layout() const { return _layout; }
     IntCoord size() const { return IntCoord(_width,_height); }
     bool singleValue() const { return _width == 1 && _height == 1; }
 
@@ -87,7 +113,7 @@ public:
             THROW_RUNTIME( "Illegal get attempted!" );
         }
 #endif
-        return _array[y*_width+x];
+        return _array[y*_stride+x];
     }
 
     T get(const IntCoord& coord) const
@@ -95,6 +121,8 @@ public:
         return get(coord.x(),coord.y());
     }
 
+    /// The linear accessors take 'xy' = x + width() * y, whatever the layout; padded rows
+    /// cost a division to find the row.
     T get(int xy) const
     {
 #ifdef _DEBUG
@@ -105,7 +133,7 @@ public:
             THROW_RUNTIME( "Illegal get attempted" );
         }
 #endif
-        return _array[xy];
+        return getRef(xy);
     }
 
     T& getRef( const IntCoord& coord )
@@ -130,12 +158,15 @@ public:
 
     const T& getRef( int x, int y ) const
     {
-        return getRef( x + _width * y );
+        return _array[ x + _stride * y ];
     }
 
     const T& getRef( int xy ) const
     {
-        return _array[ xy ];
+        if( _stride == _width ) {
+            return _array[ xy ];
+        }
+        return getRef( xy % _width, xy / _width );
     }
 
     bool isValidCoord(int x, int y) const
@@ -157,7 +188,7 @@ public:
             THROW_RUNTIME( "Illegal set attempted!" );
         }
 #endif
-        _array[y*_width+x] = val;
+        _array[y*_stride+x] = val;
     }
 
 
@@ -168,68 +199,186 @@ public:
 
     void set( T val )
     {
-        const int w = width(), h = height();
-        for( int x = 0; x < w; x++ ) {
-            for( int y = 0; y < h; y++ ) {
-                set( x, y, val );
-            }
-        }
+        fill( [ &val ]( int, int ) { return val; } );
     }
 
     /// Set every cell to a value generated by a functor that takes in a coordinate as input.
+    /// Prefer fill(), which takes any callable and so can inline it.
     void set( std::function< T( int x, int y ) > functor )
     {
-        const int w = width(), h = height();
-        for( int x = 0; x < w; x++ ) {
-            for( int y = 0; y < h; y++ ) {
-                set( x, y, functor( x, y ) );
-            }
-        }
+        fill( functor );
     }
 
+    /// Prefer forEach(), which takes any callable and so can inline it.
     void forEveryPos( std::function< void( const T& ) > functor ) const
     {
-        const int w = width();
-        const int h = height();
-        for( int x = 0; x < w; x++ ) {
-            for( int y = 0; y < h; y++ ) {
-                functor( getRef( x, y ) );
-            }
-        }
+        forEach( [ &functor ]( int, int, const T& cell ) { functor( cell ); } );
     }
 
     void forEveryPos( std::function< void( T& ) > functor )
     {
-        const int w = width();
-        const int h = height();
-        for( int x = 0; x < w; x++ ) {
-            for( int y = 0; y < h; y++ ) {
-                functor( getRef( x, y ) );
+        forEach( [ &functor ]( int, int, T& cell ) { functor( cell ); } );
+    }
+
+    /// Set every cell to 'generator'( x, y ).
+    ///
+    /// This and the bulk operations below go through the cells in row-major order. With
+    /// 'parallel', blocks of rows go to the OpenMP threads instead, so the callable must then
+    /// be safe to call concurrently, must not throw and must not depend on the order of cells.
+    template< typename Generator >
+    void fill( Generator&& generator, bool parallel = false )
+    {
+        forRows( [ & ]( int y ) {
+            T* cells = row( y );
+            for( int x = 0; x < _width; x++ ) {
+                cells[ x ] = generator( x, y );
             }
-        }
+        }, parallel );
     }
 
-    void recreate(const IntCoord& size, T initialVal=T())
+    /// Replace every cell with 'op'( cell ).
+    template< typename Op >
+    void transform( Op&& op, bool parallel = false )
     {
-        recreate(size.x(),size.y(),initialVal);
+        forRows( [ & ]( int y ) {
+            T* cells = row( y );
+            for( int x = 0; x < _width; x++ ) {
+                cells[ x ] = op( cells[ x ] );
+            }
+        }, parallel );
     }
 
-    void recreate(int width, int height, T initialVal=T())
+    /// Call 'visit'( x, y, cell ) for every cell.
+    template< typename Visit >
+    void forEach( Visit&& visit, bool parallel = false )
     {
-        if (width < 1 || height < 1) {
-            THROW_RUNTIME("Illegal dimensions");
+        forRows( [ & ]( int y ) {
+            T* cells = row( y );
+            for( int x = 0; x < _width; x++ ) {
+                visit( x, y, cells[ x ] );
+            }
+        }, parallel );
+    }
+
+    template< typename Visit >
+    void forEach( Visit&& visit, bool parallel = false ) const
+    {
+        forRows( [ & ]( int y ) {
+            const T* cells = row( y );
+            for( int x = 0; x < _width; x++ ) {
+                visit( x, y, cells[ x ] );
+            }
+        }, parallel );
+    }
+
+    /// Replace every cell with 'op'( cell, otherCell ), 'otherCell' being the cell of 'other'
+    /// at the same position. 'other' must have the same dimensions as 'this'.
+    template< typename U, typename Op >
+    void zip( const TwoDArray< U >& other, Op&& op, bool parallel = false )
+    {
+        if( other.width() != _width || other.height() != _height ) {
+            THROW_RUNTIME( "Arrays must have the same dimensions" );
         }
-        _width=width;
-        _height=height;
+        forRows( [ & ]( int y ) {
+            T* cells = row( y );
+            const U* otherCells = other.row( y );
+            for( int x = 0; x < _width; x++ ) {
+                cells[ x ] = op( cells[ x ], otherCells[ x ] );
+            }
+        }, parallel );
+    }
 
-        const size_t numEntries = width * height;
-        _array = std::make_unique< T[] >( numEntries );
-        for( size_t i = 0; i < numEntries; i++ )
+    /// Fold 'map'( x, y, cell ) over every cell with 'combine', starting from 'identity', which
+    /// 'combine' must leave unchanged. Each row is folded on its own and the rows' results are
+    /// then combined top to bottom, so the result is the same with or without 'parallel'.
+    template< typename Result, typename Map, typename Combine >
+    Result reduce( Result identity, Map&& map, Combine&& combine, bool parallel = false ) const
+    {
+        // Wrapped so that a vector of bool results does not pack them into shared words.
+        struct RowResult
         {
-            _array[ i ] = initialVal;
+            Result value;
+        };
+        std::vector< RowResult > rowResults( _height, RowResult{ identity } );
+        forRows( [ & ]( int y ) {
+            const T* cells = row( y );
+            Result result = identity;
+            for( int x = 0; x < _width; x++ ) {
+                result = combine( result, map( x, y, cells[ x ] ) );
+            }
+            rowResults[ y ].value = result;
+        }, parallel );
+
+        Result result = identity;
+        for( const auto& rowResult : rowResults ) {
+            result = combine( result, rowResult.value );
         }
+        return result;
+    }
+
+    void recreate(const IntCoord& size, T initialVal=T(), RowLayout layout=RowLayout::Packed)
+    {
+        recreate(size.x(),size.y(),initialVal,layout);
+    }
+
+    /// Reuses the current storage when it is large enough (see reserve()).
+    void recreate(int width, int height, T initialVal=T(), RowLayout layout=RowLayout::Packed)
+    {
+        auto storage = allocate(width,height,layout);
+        const size_t numEntries = static_cast< size_t >( _stride ) * _height;
+        std::uninitialized_fill_n(storage.get(),numEntries,initialVal);
+        storage.get_deleter().numConstructed = numEntries;
+        _array = std::move(storage);
+    }
+
+    void recreateUninitialized(const IntCoord& size, RowLayout layout=RowLayout::Packed)
+    {
+        recreateUninitialized(size.x(),size.y(),layout);
+    }
+
+    /// Same as recreate(), but leave every element's value indeterminate, for callers that
+    /// write all of them before reading any.
+    void recreateUninitialized(int width, int height, RowLayout layout=RowLayout::Packed)
+    {
+        static_assert( std::is_trivially_copyable< T >::value,
+            "Only trivially copyable elements can be left uninitialized" );
+        _array = allocate(width,height,layout);
     }
 
+    /// Make room for recreating 'this' at up to 'width' by 'height' in 'layout' without
+    /// allocating, as for a buffer rebuilt at every pyramid level. Keeps the current
+    /// dimensions and values. Room for RowLayout::AlignedRows is also room for Packed.
+    void reserve(int width, int height, RowLayout layout=RowLayout::Packed)
+    {
+        const size_t numEntries = static_cast< size_t >( strideFor( width, layout ) ) * height;
+        if( _array && _array.get_deleter().capacity >= numEntries ) {
+            return;
+        }
+        Storage storage = allocateStorage( numEntries );
+        const size_t numCurrent = _array ? static_cast< size_t >( _stride ) * _height : 0;
+        if( numCurrent > 0 ) {
+            if constexpr( std::is_trivially_copyable< T >::value ) {
+                std::memcpy( storage.get(), _array.get(), sizeof( T ) * numCurrent );
+            } else {
+                std::uninitialized_copy_n( _array.get(), numCurrent, storage.get() );
+            }
+        }
+        storage.get_deleter().numConstructed = numCurrent;
+        _array = std::move( storage );
+    }
+
+    /// Row 'y', of width() elements, aligned to 'alignment' under RowLayout::AlignedRows.
+    T* row( int y )
+    {
+        return _array.get() + static_cast< size_t >( _stride ) * y;
+    }
+
+    const T* row( int y ) const
+    {
+        return _array.get() + static_cast< size_t >( _stride ) * y;
+    }
+
+    /// The first row; all width() * height() elements in order only when packed.
     const T* array() const
     {
         return _array.get();
@@ -239,11 +388,91 @@ private:
     TwoDArray(const TwoDArray& other); 
     TwoDArray& operator=(const TwoDArray& other); 
 
+    /// Frees aligned storage, destroying the elements constructed in it.
+    struct AlignedDeleter
+    {
+        size_t capacity = 0;
+        size_t numConstructed = 0;
+
+        void destroyElements( T* storage )
+        {
+            if( !std::is_trivially_destructible< T >::value ) {
+                for( size_t i = 0; i < numConstructed; i++ ) {
+                    storage[ i ].~T();
+                }
+            }
+            numConstructed = 0;
+        }
+
+        void operator()( T* storage )
+        {
+            destroyElements( storage );
+            ::operator delete( storage, std::align_val_t( alignment ) );
+        }
+    };
+    using Storage = std::unique_ptr< T[], AlignedDeleter >;
+
+    static size_t strideFor(int width, RowLayout layout)
+    {
+        // The fewest elements that span a whole number of alignment boundaries.
+        const size_t rowMultiple = alignment / std::gcd( alignment, sizeof( T ) );
+        return layout == RowLayout::AlignedRows
+            ? ( ( width + rowMultiple - 1 ) / rowMultiple ) * rowMultiple
+            : static_cast< size_t >( width );
+    }
+
+    /// Call 'body'( y ) for every row, in order or, with 'parallel', in blocks of rows across
+    /// the OpenMP threads.
+    template< typename Body >
+    void forRows( Body&& body, bool parallel ) const
+    {
+        const int h = _height;
+#pragma omp parallel for schedule( static ) if( parallel )
+        for( int y = 0; y < h; y++ ) {
+            body( y );
+        }
+    }
+
+    static Storage allocateStorage(size_t capacity)
+    {
+        AlignedDeleter deleter;
+        deleter.capacity = capacity;
+        return Storage(
+            static_cast< T* >( ::operator new( sizeof( T ) * capacity, std::align_val_t( alignment ) ) ),
+            deleter );
+    }
+
+    /// Set the dimensions and layout, and return storage for them with no elements
+    /// constructed: the current storage if it is large enough, else new storage.
+    Storage allocate(int width, int height, RowLayout layout)
+    {
+        if (width < 1 || height < 1) {
+            THROW_RUNTIME("Illegal dimensions");
+        }
+        const size_t stride = strideFor( width, layout );
+        const size_t numEntries = stride * height;
+
+        Storage storage;
+        if( _array && _array.get_deleter().capacity >= numEntries ) {
+            storage = std::move( _array );
+            storage.get_deleter().destroyElements( storage.get() );
+        } else {
+            storage = allocateStorage( numEntries );
+        }
+        _width=width;
+        _height=height;
+        _stride=static_cast< int >( stride );
+        _layout=layout;
+        return storage;
+    }
+
     int _width;
     int _height;
+    int _stride;
+    RowLayout _layout;
 
-    /// row-major 
-    std::unique_ptr< T[] > _array;
+    /// row-major, rows _stride elements apart
+    Storage _array;
 };
 
 template<typename T>
@@ -253,13 +482,7 @@ void TwoDArray<T>::checkerboard(TwoDArray<T>& store, int width, int height, cons
     {
         store.recreate(width,height);
     }
-    for(int x=0; x<width; x++)
-    {
-        for(int y=0; y<height; y++)
-        {
-            store.set(x,y, (x/cellWidth)%2==(y/cellWidth)%2  ? colorA : colorB);
-        }
-    }
+    store.fill([&](int x, int y) { return (x/cellWidth)%2==(y/cellWidth)%2  ? colorA : colorB; });
 }
 
 template<typename T>
@@ -270,17 +493,13 @@ void TwoDArray<T>::stripes(TwoDArray<T>& store, int width, int height, int strip
         store.recreate(width,height);
     }
 
-    for(int x=0; x<width; x++)
+    store.fill([&](int x, int)
     {
         //an element is a stripe + its next gap
         int elementIdx =x/(stripeWidth+gapWidth);
         bool isStripe = x-elementIdx*(stripeWidth+gapWidth)<stripeWidth;
-
-        for(int y=0;y<height; y++)
-        {
-            store.set(x,y,isStripe ? colorStripe : colorGap);
-        }
-    }
+        return isStripe ? colorStripe : colorGap;
+    });
 }
 
 template<typename T>
@@ -288,15 +507,9 @@ void TwoDArray<T>::clone(const TwoDArray<T> &source, TwoDArray<T> &dest)
 {
     if(dest.width()!=source.width() || dest.height()!=source.height())
     {
-        dest.recreate(source.width(), source.height());
-    }
-    for(int x=0; x<source.width(); x++)
-    {
-        for(int y=0; y<source.height(); y++)
-        {
-            dest.set(x,y,source.get(x,y));
-        }
+        dest.recreate(source.width(), source.height(), T(), source.layout());
     }
+    dest.zip(source, [](const T&, const T& sourceCell) { return sourceCell; });
 }
 
 template<typename T>
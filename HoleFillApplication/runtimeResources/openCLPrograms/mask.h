@@ -0,0 +1,66 @@
+/*
+Access to binary masks, stored as one int per pixel (the default), one uchar per pixel (when the
+program is built with -D MASK_UCHAR) or bit-packed, 32 pixels per uint (-D MASK_BITS).  Masks
+are addressed by row-major pixel index, and readMask returns nonzero for set pixels.  The host
+side of this is openCL::Mask.
+*/
+#ifndef MASK_H
+#define MASK_H
+
+#if defined(MASK_BITS)
+
+#define MASK_RO global const uint*
+#define MASK_WO global uint*
+
+int readMask(global const uint* mask, int index)
+{
+    return (mask[index>>5] >> (index&31)) & 1;
+}
+
+//Neighboring work-items share a word, so bits are set and cleared atomically.
+void writeMask(global uint* mask, int index, int value)
+{
+    uint bit = 1u << (index&31);
+    if(value)
+    {
+        atomic_or(&mask[index>>5],bit);
+    }
+    else
+    {
+        atomic_and(&mask[index>>5],~bit);
+    }
+}
+
+#elif defined(MASK_UCHAR)
+
+#define MASK_RO global const uchar*
+#define MASK_WO global uchar*
+
+int readMask(global const uchar* mask, int index)
+{
+    return mask[index];
+}
+
+void writeMask(global uchar* mask, int index, int value)
+{
+    mask[index] = value!=0;
+}
+
+#else
+
+#define MASK_RO global const int*
+#define MASK_WO global int*
+
+int readMask(global const int* mask, int index)
+{
+    return mask[index];
+}
+
+void writeMask(global int* mask, int index, int value)
+{
+    mask[index] = value;
+}
+
+#endif
+
+#endif
@@ -2,19 +2,56 @@
 Functionality specific to hole filling patch match
 */
 
-__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+//Kernels here are launched with global sizes padded up to a multiple of the work-group size,
+//so each one is told its domain size and returns early for work-items outside it.  Those that
+//the host may launch over a band of rows (starting at the band's first row) are also told
+//rowEnd, the row after the band's last (targetHeight when the level is not split into bands),
+//and leave the rows from there on alone: those belong to the next band, which works on them.
+
+//search, propagate, nnfCosts and blend also come as ...List kernels, which take the same
+//arguments plus a list of the target pixels to work on (the masked ones, as built by
+//compactMask in utility.cl) and are launched 1D over that list.  Their cost then follows the
+//area of the hole rather than that of the image.  Each pair shares its per-pixel body, ...At().
+
+#include "mask.h"
+#include "rgbImage.h"
+
+//Random numbers come from a stateless counter-based generator: each number is a hash of a key
+//and a counter, so nothing is read from or written to global memory.  The host passes a fresh
+//key to every launch that draws random numbers (derived from one 64-bit seed), and each
+//work-item's counter starts at its pixel index shifted into the high 32 bits, leaving the low
+//32 bits for the draws it makes within the launch.
+typedef struct
+{
+    ulong key;
+    ulong counter;
+} RandomStream;
+
+RandomStream randomStream(ulong key, int index)
+{
+    RandomStream stream = { key, ((ulong)index) << 32 };
+    return stream;
+}
 
-//This method of an LCG random sequence originally comes
-//from Java.util.random.next()'s documentation.  Adaptation to OpenCL
-//was demonstrated at stackoverflow.com/questions/9912143/how-to-get-a-random-number-in-opencl
-int nextRand(global ulong* seeds, int index)
+//Widynski's "Squares" generator (arXiv:2004.06278).  key should be odd with well-mixed bits,
+//which the host guarantees.
+uint squares32(ulong counter, ulong key)
 {
-    ulong seed = seeds[index];
-    seed = (seed * 0x5DEECE66DL + 0xBL) & ((1L << 48) - 1);
-    seeds[index] = seed;
-    uint unsignedResult = (seed >> 16);
-    int result = unsignedResult;
-    return abs(result);
+    ulong x = counter*key;
+    ulong y = x;
+    ulong z = y + key;
+    x = x*x + y; x = (x >> 32) | (x << 32);
+    x = x*x + z; x = (x >> 32) | (x << 32);
+    x = x*x + y; x = (x >> 32) | (x << 32);
+    return (uint)((x*x + z) >> 32);
+}
+
+//Return a nonnegative int.
+int nextRand(RandomStream* stream)
+{
+    uint result = squares32(stream->counter, stream->key);
+    stream->counter++;
+    return (int)(result >> 1);
 }
 
 bool isValidAnchorPosition(int2 coord, int2 dims, int patchWidth)
@@ -31,13 +68,15 @@ float patchCost(
     int2 sourceCoord,
     int2 targetCoord,
     int patchWidth,
-    __read_only image2d_t target,
-    __read_only image2d_t source,
+    RGB_IMAGE_RO target,
+    int2 targetDims,
+    RGB_IMAGE_RO source,
+    int2 sourceDims,
     global float* anchorWeights,
     float costNotToExceed)
 {
     float sumCost=0;
-    int targetWidth = get_image_width(target);
+    int targetWidth = targetDims.x;
     int targetX = targetCoord.x;
     int targetY = targetCoord.y;
     int sourceX = sourceCoord.x;
@@ -53,8 +92,8 @@ float patchCost(
             int2 targetCoord = {targetX + patchX, targetY + patchY};
             int2 sourceCoord = {sourceX + patchX, sourceY + patchY};
 
-            float4 sourceColor = read_imagef(source,sampler,sourceCoord);
-            float4 targetColor = read_imagef(target,sampler,targetCoord);
+            float4 sourceColor = readRGB(source,sourceCoord,sourceDims);
+            float4 targetColor = readRGB(target,targetCoord,targetDims);
 
             //add rgb sum squared difference
             float rDiff=sourceColor.x-targetColor.x;
@@ -87,14 +126,16 @@ float patchCost(
 __kernel void anchorWeightsFromInternalDistMap(
                 global float* distMap, //read
                 global float* anchorWeights, //write
-                int patchWidth
+                int patchWidth,
+                int width,
+                int height
             )
 {
     float overlapDist = ((float)patchWidth)*0.5;
 
     int x=get_global_id(0);
     int y=get_global_id(1);
-    int width = get_global_size(0);
+    if(x>=width || y>=height) return;
     int idx = x+width*y;
 
     float dist = distMap[idx];
@@ -126,15 +167,16 @@ __kernel void anchorWeightsFromInternalDistMap(
 //-targetMask and sourceMask are same size
 //-patchWidth is valid (odd number>1 and less than dims of targetMask/sourceMask)
 __kernel void sourceMaskFromTargetMask(
-        global int* targetMask,
-        global int* sourceMask,
-        int patchWidth
+        MASK_RO targetMask,
+        MASK_WO sourceMask,
+        int patchWidth,
+        int width,
+        int height
 )
 {
     int posX = get_global_id(0);
     int posY = get_global_id(1);
-    int width = get_global_size(0);
-    int height = get_global_size(1);
+    if(posX>=width || posY>=height) return;
 
     int result=1;
     for(int x = posX-patchWidth/2; x<=posX+patchWidth/2; x++)
@@ -142,7 +184,7 @@ __kernel void sourceMaskFromTargetMask(
         for(int y = posY-patchWidth/2; y<=posY+patchWidth/2; y++)
         {
             if(x<0 || y<0 || x>width-1 || y>height-1) continue;
-            if(targetMask[x+y*width]!=0)
+            if(readMask(targetMask,x+y*width)!=0)
             {
                 result=0;
                 break;
@@ -150,15 +192,15 @@ __kernel void sourceMaskFromTargetMask(
         }
         if(result==0) break;
     }
-    sourceMask[posX+width*posY]=result;
+    writeMask(sourceMask,posX+width*posY,result);
 }
 
 /*
 // for diagnosing problems with components - DEBUG code
 __kernel void blend(
         global int* nnfCoords, //read only
-        global int* targetMask, //read only
-        global int* sourceMask, //read only
+        MASK_RO targetMask, //read only
+        MASK_RO sourceMask, //read only
         global float* anchorWeights, //read only
         __read_only image2d_t sourceImagePyramidSize,
         __write_only image2d_t targetImagePyramidSize,
@@ -174,8 +216,8 @@ __kernel void blend(
 
         float4 writeVal = {0,1,0,1};
 
-        int targetMaskVal = targetMask[idx];
-        int sourceMaskVal = sourceMask[idx];
+        int targetMaskVal = readMask(targetMask,idx);
+        int sourceMaskVal = readMask(sourceMask,idx);
 
         float anchorWeight = anchorWeights[idx];
 
@@ -200,36 +242,24 @@ __kernel void blend(
         write_imagef(targetImagePyramidSize,writePos,writeVal);
 }*/
 
-
-__kernel void blend(
-                global int* nnfCoords, //read only
-                global int* targetMask, //read only
-                global int* sourceMask, //read only
-                global float* anchorWeights, //read only
-                __read_only image2d_t sourceImagePyramidSize,
-                __write_only image2d_t targetImagePyramidSize,
+//The blended color of masked target pixel targetPos: a weighted average of the source colors
+//that the nnf matches of the patches covering it put there.
+float4 blendedColor(
+                int2 targetPos,
+                global int* nnfCoords,
+                MASK_RO targetMask,
+                MASK_RO sourceMask,
+                global float* anchorWeights,
+                RGB_IMAGE_RO sourceImagePyramidSize,
+                int2 targetDims,
+                int2 sourceDims,
                 int patchWidth
     )
 {
-
-    int x=get_global_id(0);
-    int y=get_global_id(1);
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
-    int2 targetDims = {targetWidth,targetHeight};
-    int sourceWidth = get_image_width(sourceImagePyramidSize);
-    int sourceHeight = get_image_height(sourceImagePyramidSize);
-    int2 targetPos = {x,y};
-    int targetIdx = x+y*targetWidth;
-
-    //if this is masked out, make no change (leave target as is).  This is assuming
-    //that when we reached the current pyramid level, targetImagePyramidSize was
-    //downsampled from targetOriginalSize and the masked pixels in it have _not_ been touched
-    //since.
-    if(!targetMask[targetIdx])
-    {
-        return;
-    }
+    int x = targetPos.x;
+    int y = targetPos.y;
+    int targetWidth = targetDims.x;
+    int sourceWidth = sourceDims.x;
 
     bool noValidContributors=true;
     float4 sum = {0,0,0,0};
@@ -248,7 +278,7 @@ __kernel void blend(
 
             //neighbor might not be active anchor, even if it is a valid target
             //anchor position
-            if(!targetMask[targetAnchorX+targetWidth*targetAnchorY]) continue;
+            if(!readMask(targetMask,targetAnchorX+targetWidth*targetAnchorY)) continue;
 
             //neighbor might point to a masked-out source anchor.  This is inevitable when
             //we get into multiscale pyramids
@@ -257,9 +287,9 @@ __kernel void blend(
 
             int sourceCoordX = sourceAnchorX - patchX;
             int sourceCoordY = sourceAnchorY - patchY;
-            if(!sourceMask[sourceCoordX + sourceCoordY*sourceWidth]) continue;
+            if(!readMask(sourceMask,sourceCoordX + sourceCoordY*sourceWidth)) continue;
 
-            float4 color = read_imagef(sourceImagePyramidSize,sampler,(int2)(sourceCoordX,sourceCoordY));
+            float4 color = readRGB(sourceImagePyramidSize,(int2)(sourceCoordX,sourceCoordY),sourceDims);
 
             //MODFLAG: coherence
             float coherenceAmount=0;
@@ -300,40 +330,119 @@ __kernel void blend(
         //that this only occurred when patchCost was temporarily hacked to always return 0.0).
         //WARNIN':  This is a flaw in my PatchMatch algorithm - I do not currently know what
         //to do other than output an obvious warning color.
-        write_imagef(targetImagePyramidSize,targetPos,(float4)(0,1,0,1));
+        return (float4)(0,1,0,1);
     }
-    else
+    return sum/weightSum;
+}
+
+void blendAt(
+                int x,
+                int y,
+                global int* nnfCoords, //read only
+                MASK_RO targetMask, //read only
+                MASK_RO sourceMask, //read only
+                global float* anchorWeights, //read only
+                RGB_IMAGE_RO sourceImagePyramidSize,
+                RGB_IMAGE_WO targetImagePyramidSize,
+                int patchWidth,
+                int targetWidth,
+                int targetHeight,
+                int sourceWidth,
+                int sourceHeight)
+{
+    int2 targetDims = {targetWidth,targetHeight};
+    int2 sourceDims = {sourceWidth,sourceHeight};
+    int2 targetPos = {x,y};
+    int targetIdx = x+y*targetWidth;
+
+    //if this is masked out, make no change (leave target as is).  This is assuming
+    //that when we reached the current pyramid level, targetImagePyramidSize was
+    //downsampled from targetOriginalSize and the masked pixels in it have _not_ been touched
+    //since.
+    if(!readMask(targetMask,targetIdx))
     {
-        write_imagef(targetImagePyramidSize,targetPos,sum/weightSum);
+        return;
     }
 
+    writeRGB(targetImagePyramidSize,targetPos,targetDims,
+             blendedColor(targetPos,nnfCoords,targetMask,sourceMask,anchorWeights,
+                          sourceImagePyramidSize,targetDims,sourceDims,patchWidth));
+}
+
+__kernel void blend(
+                global int* nnfCoords, //read only
+                MASK_RO targetMask, //read only
+                MASK_RO sourceMask, //read only
+                global float* anchorWeights, //read only
+                RGB_IMAGE_RO sourceImagePyramidSize,
+                RGB_IMAGE_WO targetImagePyramidSize,
+                int patchWidth,
+                int targetWidth,
+                int targetHeight,
+                int sourceWidth,
+                int sourceHeight,
+                int rowEnd
+    )
+{
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd) return;
+    blendAt(x,y,nnfCoords,targetMask,sourceMask,anchorWeights,sourceImagePyramidSize,
+            targetImagePyramidSize,patchWidth,targetWidth,targetHeight,sourceWidth,sourceHeight);
+}
+
+__kernel void blendList(
+                global int* nnfCoords, //read only
+                MASK_RO targetMask, //read only
+                MASK_RO sourceMask, //read only
+                global float* anchorWeights, //read only
+                RGB_IMAGE_RO sourceImagePyramidSize,
+                RGB_IMAGE_WO targetImagePyramidSize,
+                int patchWidth,
+                int targetWidth,
+                int targetHeight,
+                int sourceWidth,
+                int sourceHeight,
+                global const int* activePixels,
+                int numActivePixels
+    )
+{
+    int i=get_global_id(0);
+    if(i>=numActivePixels) return;
+    int x=activePixels[i]%targetWidth;
+    int y=activePixels[i]/targetWidth;
+    blendAt(x,y,nnfCoords,targetMask,sourceMask,anchorWeights,sourceImagePyramidSize,
+            targetImagePyramidSize,patchWidth,targetWidth,targetHeight,sourceWidth,sourceHeight);
 }
 
 //done immediately prior to initialHoleFill
 __kernel void blackOutMaskedArea(
-        global int* targetMask, //read only
-        __write_only image2d_t targetImage)
+        MASK_RO targetMask, //read only
+        RGB_IMAGE_WO targetImage,
+        int targetWidth,
+        int targetHeight)
 {
     int x=get_global_id(0);
     int y=get_global_id(1);
-    int targetWidth = get_global_size(0);
-    if(targetMask[x+targetWidth*y])
+    if(x>=targetWidth || y>=targetHeight) return;
+    if(readMask(targetMask,x+targetWidth*y))
     {
-        write_imagef(targetImage,(int2)(x,y),(float4)(0,0,0,1));
+        writeRGB(targetImage,(int2)(x,y),(int2)(targetWidth,targetHeight),(float4)(0,0,0,1));
     }
 }
 
 __kernel void initialHoleFill(
-        global int* targetMask, //read only
-        __read_only image2d_t readImage,
-        __write_only image2d_t writeImage)
+        MASK_RO targetMask, //read only
+        RGB_IMAGE_RO readImage,
+        RGB_IMAGE_WO writeImage,
+        int targetWidth,
+        int targetHeight)
 {
     int x=get_global_id(0);
     int y=get_global_id(1);
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
+    if(x>=targetWidth || y>=targetHeight) return;
 
-    if(!targetMask[x+targetWidth*y]) return;
+    if(!readMask(targetMask,x+targetWidth*y)) return;
 
     float4 sum = {0,0,0,0};
     float weightSum=0;
@@ -344,39 +453,38 @@ __kernel void initialHoleFill(
             int srcX = x+i;
             int srcY = y+j;
             if(srcX<0 || srcY<0 || srcX>targetWidth-1 || srcY>targetHeight-1) continue;
-            sum += read_imagef(readImage,sampler,(int2)(srcX,srcY));
+            sum += readRGB(readImage,(int2)(srcX,srcY),(int2)(targetWidth,targetHeight));
             weightSum+=1.0;
         }
     }
     sum/=weightSum;
-    write_imagef(writeImage,(int2)(x,y),sum);
+    writeRGB(writeImage,(int2)(x,y),(int2)(targetWidth,targetHeight),sum);
 }
 
 
 //This is jumpflood - that's what k is about.
-__kernel void propagate(
+void propagateAt(
+            int x,
+            int y,
             global float* anchorWeights,
-            __read_only image2d_t targetImage,
-            __read_only image2d_t sourceImage,
-            global int* targetMask,
-            global int* sourceMask,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
             int patchWidth,
             int k,
             global int* nnfCoordsRead, //readonly.
             global int* nnfCoordsWrite, //writeonly
             global float* nnfCostsRead, //readonly
-            global float* nnfCostsWrite //writeonly
-        )
+            global float* nnfCostsWrite, //writeonly
+            int targetWidth,
+            int targetHeight,
+            int sourceWidth,
+            int sourceHeight)
 {
-    int x=get_global_id(0);
-    int y=get_global_id(1);
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
     int targetIdx = x + targetWidth*y;
     int2 targetCoord = {x,y};
     int2 targetDims = {targetWidth, targetHeight };
-    int sourceWidth = get_image_width(sourceImage);
-    int sourceHeight = get_image_height(sourceImage);
     int2 sourceDims = {sourceWidth,sourceHeight};
 
     float bestMatchCost = nnfCostsRead[targetIdx];
@@ -398,21 +506,21 @@ __kernel void propagate(
             {
                 continue;
             }
-            if(!targetMask[votingNeighborX + votingNeighborY*targetWidth]) continue;
+            if(!readMask(targetMask,votingNeighborX + votingNeighborY*targetWidth)) continue;
             int candidateMatchX = nnfCoordsRead[2*(votingNeighborX + votingNeighborY*targetWidth)] - i;
             int candidateMatchY = nnfCoordsRead[2*(votingNeighborX + votingNeighborY*targetWidth)+1] - j;
             if(!isValidAnchorPosition((int2)(candidateMatchX,candidateMatchY),sourceDims,patchWidth))
             {
                 continue;
             }
-            if(!sourceMask[candidateMatchX+sourceWidth*candidateMatchY])
+            if(!readMask(sourceMask,candidateMatchX+sourceWidth*candidateMatchY))
             {
                 continue;
             }
 
 
             float matchCost = patchCost((int2)(candidateMatchX,candidateMatchY),
-                    targetCoord,patchWidth,targetImage,sourceImage,
+                    targetCoord,patchWidth,targetImage,targetDims,sourceImage,sourceDims,
                     anchorWeights,bestMatchCost);
             if(matchCost<bestMatchCost)
             {
@@ -429,27 +537,82 @@ __kernel void propagate(
 
 }
 
+__kernel void propagate(
+            global float* anchorWeights,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
+            int patchWidth,
+            int k,
+            global int* nnfCoordsRead, //readonly.
+            global int* nnfCoordsWrite, //writeonly
+            global float* nnfCostsRead, //readonly
+            global float* nnfCostsWrite, //writeonly
+            int targetWidth,
+            int targetHeight,
+            int sourceWidth,
+            int sourceHeight,
+            int rowEnd
+        )
+{
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd) return;
+    propagateAt(x,y,anchorWeights,targetImage,sourceImage,targetMask,sourceMask,patchWidth,k,
+                nnfCoordsRead,nnfCoordsWrite,nnfCostsRead,nnfCostsWrite,targetWidth,targetHeight,
+                sourceWidth,sourceHeight);
+}
+
+__kernel void propagateList(
+            global float* anchorWeights,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
+            int patchWidth,
+            int k,
+            global int* nnfCoordsRead, //readonly.
+            global int* nnfCoordsWrite, //writeonly
+            global float* nnfCostsRead, //readonly
+            global float* nnfCostsWrite, //writeonly
+            int targetWidth,
+            int targetHeight,
+            int sourceWidth,
+            int sourceHeight,
+            global const int* activePixels,
+            int numActivePixels
+        )
+{
+    int i=get_global_id(0);
+    if(i>=numActivePixels) return;
+    int x=activePixels[i]%targetWidth;
+    int y=activePixels[i]/targetWidth;
+    propagateAt(x,y,anchorWeights,targetImage,sourceImage,targetMask,sourceMask,patchWidth,k,
+                nnfCoordsRead,nnfCoordsWrite,nnfCostsRead,nnfCostsWrite,targetWidth,targetHeight,
+                sourceWidth,sourceHeight);
+}
+
 #define HF_SEARCH_ALPHA 0.5
-__kernel void search(
-        global ulong* randomSeeds,
+void searchAt(
+        int x,
+        int y,
+        ulong randomKey,
         global float* anchorWeights,
-        __read_only image2d_t targetImage,
-        __read_only image2d_t sourceImage,
-        global int* targetMask,
-        global int* sourceMask,
+        RGB_IMAGE_RO targetImage,
+        RGB_IMAGE_RO sourceImage,
+        MASK_RO targetMask,
+        MASK_RO sourceMask,
         int patchWidth,
         global int* nnfCoords, //readandwrite
-        global float* nnfCosts //readandwrite
-        )
+        global float* nnfCosts, //readandwrite
+        int targetWidth,
+        int targetHeight,
+        int sourceWidth,
+        int sourceHeight)
 {
-    int x=get_global_id(0);
-    int y=get_global_id(1);
     int2 targetCoord = {x,y};
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
     int2 targetDims = { targetWidth,targetHeight };
-    int sourceWidth = get_image_width(sourceImage);
-    int sourceHeight = get_image_height(sourceImage);
     int2 sourceDims = {sourceWidth,sourceHeight};
     int targetIndex = x+targetWidth*y;
 
@@ -457,7 +620,7 @@ __kernel void search(
     //obviously do not search for target anchors that are invalid positions
     //or that are masked out
     if(!isValidAnchorPosition(targetCoord,targetDims,patchWidth) ||
-       !targetMask[targetIndex])
+       !readMask(targetMask,targetIndex))
     {
         return;
     }
@@ -466,6 +629,7 @@ __kernel void search(
     int sourceAnchorY = nnfCoords[2*targetIndex+1];
     float currentCost = nnfCosts[targetIndex];
     float searchRadius = max(sourceWidth,sourceHeight);
+    RandomStream random = randomStream(randomKey,targetIndex);
     while(searchRadius>1)
     {
         int minX = (int)((float)sourceAnchorX-searchRadius);
@@ -478,15 +642,15 @@ __kernel void search(
         int maxY = (int)((float)sourceAnchorY+searchRadius);
         if(maxY>sourceHeight-patchWidth/2-1) maxY=sourceHeight-patchWidth/2-1;
 
-        int candidateSourceX = ((nextRand(randomSeeds,targetIndex))%(maxX-minX+1)) + minX;
-        int candidateSourceY = ((nextRand(randomSeeds,targetIndex))%(maxY-minY+1)) + minY;
+        int candidateSourceX = ((nextRand(&random))%(maxX-minX+1)) + minX;
+        int candidateSourceY = ((nextRand(&random))%(maxY-minY+1)) + minY;
 
         //ignore candidates which are part of forbidden source
-        if(sourceMask[candidateSourceX+sourceWidth*candidateSourceY])
+        if(readMask(sourceMask,candidateSourceX+sourceWidth*candidateSourceY))
         {
             float potentialMatchCost = patchCost((int2)(candidateSourceX,candidateSourceY),
-                                                targetCoord,patchWidth,targetImage,sourceImage,
-                                                anchorWeights,currentCost);
+                                                targetCoord,patchWidth,targetImage,targetDims,
+                                                sourceImage,sourceDims,anchorWeights,currentCost);
             if(potentialMatchCost<currentCost)
             {
                 sourceAnchorX = candidateSourceX;
@@ -505,6 +669,484 @@ __kernel void search(
 
 }
 
+__kernel void search(
+        ulong randomKey,
+        global float* anchorWeights,
+        RGB_IMAGE_RO targetImage,
+        RGB_IMAGE_RO sourceImage,
+        MASK_RO targetMask,
+        MASK_RO sourceMask,
+        int patchWidth,
+        global int* nnfCoords, //readandwrite
+        global float* nnfCosts, //readandwrite
+        int targetWidth,
+        int targetHeight,
+        int sourceWidth,
+        int sourceHeight,
+        int rowEnd
+        )
+{
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd) return;
+    searchAt(x,y,randomKey,anchorWeights,targetImage,sourceImage,targetMask,sourceMask,patchWidth,
+             nnfCoords,nnfCosts,targetWidth,targetHeight,sourceWidth,sourceHeight);
+}
+
+__kernel void searchList(
+        ulong randomKey,
+        global float* anchorWeights,
+        RGB_IMAGE_RO targetImage,
+        RGB_IMAGE_RO sourceImage,
+        MASK_RO targetMask,
+        MASK_RO sourceMask,
+        int patchWidth,
+        global int* nnfCoords, //readandwrite
+        global float* nnfCosts, //readandwrite
+        int targetWidth,
+        int targetHeight,
+        int sourceWidth,
+        int sourceHeight,
+        global const int* activePixels,
+        int numActivePixels
+        )
+{
+    int i=get_global_id(0);
+    if(i>=numActivePixels) return;
+    int x=activePixels[i]%targetWidth;
+    int y=activePixels[i]/targetWidth;
+    searchAt(x,y,randomKey,anchorWeights,targetImage,sourceImage,targetMask,sourceMask,patchWidth,
+             nnfCoords,nnfCosts,targetWidth,targetHeight,sourceWidth,sourceHeight);
+}
+
+//Tiled variants of search and propagate.  A work-group covers a tile of target anchors;
+//the target pixels that the tile's patches can touch (the tile plus a patchWidth/2 halo on every
+//side, which we call the "apron") are loaded into local memory once, and every candidate cost is
+//then evaluated against that local copy instead of going back to targetImage.
+//PRECONDITIONS (for all tiled kernels):
+//-the global size is the target size (or band) rounded up to a multiple of the local size;
+// work-items outside the target (or at or past rowEnd) still take part in the apron load, but
+// write nothing.
+//-targetApron holds (localWidth+patchWidth-1)*(localHeight+patchWidth-1) float4s.
+
+int apronWidth(int patchWidth)
+{
+    return get_local_size(0) + patchWidth - 1;
+}
+
+int apronHeight(int patchWidth)
+{
+    return get_local_size(1) + patchWidth - 1;
+}
+
+//Return the coordinate of this work-item's target anchor within the apron.
+int2 apronCoord(int patchWidth)
+{
+    return (int2)(get_local_id(0) + patchWidth/2, get_local_id(1) + patchWidth/2);
+}
+
+void loadTargetApron(
+        RGB_IMAGE_RO targetImage,
+        int2 targetDims,
+        local float4* targetApron,
+        int patchWidth)
+{
+    int width = apronWidth(patchWidth);
+    int numApronPixels = width*apronHeight(patchWidth);
+    int originX = get_global_id(0) - get_local_id(0) - patchWidth/2;
+    int originY = get_global_id(1) - get_local_id(1) - patchWidth/2;
+    int numWorkItems = get_local_size(0)*get_local_size(1);
+
+    //readRGB clamps to edge, so apron pixels outside the image get the same values
+    //the untiled kernels would have read
+    for(int i = get_local_id(0) + get_local_id(1)*get_local_size(0); i<numApronPixels; i+=numWorkItems)
+    {
+        int apronX = i % width;
+        int apronY = i / width;
+        targetApron[i] = readRGB(targetImage,(int2)(originX+apronX,originY+apronY),targetDims);
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+}
+
+//Same as patchCost, but the target patch comes from the local apron and the anchor
+//weight has already been fetched by the caller (it is constant over the patch).
+float patchCostTiled(
+    int2 sourceCoord,
+    int2 targetApronCoord,
+    int patchWidth,
+    local const float4* targetApron,
+    RGB_IMAGE_RO source,
+    int2 sourceDims,
+    float anchorWeight,
+    float costNotToExceed)
+{
+    float sumCost=0;
+    int width = apronWidth(patchWidth);
+
+    for(int patchX = -patchWidth/2; patchX<=patchWidth/2; patchX++)
+    {
+        for(int patchY=-patchWidth/2; patchY<=patchWidth/2; patchY++)
+        {
+            float4 sourceColor = readRGB(source,(int2)(sourceCoord.x+patchX,sourceCoord.y+patchY),sourceDims);
+            float4 targetColor = targetApron[targetApronCoord.x+patchX + (targetApronCoord.y+patchY)*width];
+
+            float rDiff=sourceColor.x-targetColor.x;
+            float gDiff=sourceColor.y-targetColor.y;
+            float bDiff=sourceColor.z-targetColor.z;
+
+            sumCost+=(rDiff*rDiff + gDiff*gDiff + bDiff*bDiff)*anchorWeight;
+            if(sumCost>costNotToExceed)
+            {
+                return sumCost;
+            }
+        }
+    }
+    return sumCost;
+}
+
+//Random search around (*sourceAnchorX,*sourceAnchorY) with a shrinking window, keeping the
+//cheapest match found.
+void searchAroundTiled(
+        RandomStream* random,
+        int2 targetApronCoord,
+        local const float4* targetApron,
+        RGB_IMAGE_RO sourceImage,
+        int2 sourceDims,
+        MASK_RO sourceMask,
+        int patchWidth,
+        float anchorWeight,
+        int* sourceAnchorX,
+        int* sourceAnchorY,
+        float* currentCost)
+{
+    int sourceWidth = sourceDims.x;
+    int sourceHeight = sourceDims.y;
+    float searchRadius = max(sourceWidth,sourceHeight);
+    while(searchRadius>1)
+    {
+        int minX = (int)((float)*sourceAnchorX-searchRadius);
+        if(minX<patchWidth/2) minX=patchWidth/2;
+        int maxX = (int)((float)*sourceAnchorX+searchRadius);
+        if(maxX>sourceWidth-patchWidth/2-1) maxX=sourceWidth-patchWidth/2-1;
+
+        int minY = (int)((float)*sourceAnchorY-searchRadius);
+        if(minY<patchWidth/2) minY=patchWidth/2;
+        int maxY = (int)((float)*sourceAnchorY+searchRadius);
+        if(maxY>sourceHeight-patchWidth/2-1) maxY=sourceHeight-patchWidth/2-1;
+
+        int candidateSourceX = ((nextRand(random))%(maxX-minX+1)) + minX;
+        int candidateSourceY = ((nextRand(random))%(maxY-minY+1)) + minY;
+
+        if(readMask(sourceMask,candidateSourceX+sourceWidth*candidateSourceY))
+        {
+            float potentialMatchCost = patchCostTiled((int2)(candidateSourceX,candidateSourceY),
+                                                      targetApronCoord,patchWidth,targetApron,sourceImage,
+                                                      sourceDims,anchorWeight,*currentCost);
+            if(potentialMatchCost<*currentCost)
+            {
+                *sourceAnchorX = candidateSourceX;
+                *sourceAnchorY = candidateSourceY;
+                *currentCost = potentialMatchCost;
+            }
+        }
+
+        searchRadius*=HF_SEARCH_ALPHA;
+    }
+}
+
+//One jumpflood round for one anchor: try the matches of the neighbors in {x+i,y+j}, where i and j
+//are {-k,0,k} (shifted back by the offset), and keep the cheapest.
+void propagateFromNeighborsTiled(
+        int2 targetCoord,
+        int2 targetDims,
+        int2 targetApronCoord,
+        local const float4* targetApron,
+        RGB_IMAGE_RO sourceImage,
+        int2 sourceDims,
+        MASK_RO targetMask,
+        MASK_RO sourceMask,
+        global int* nnfCoordsRead,
+        int patchWidth,
+        int k,
+        float anchorWeight,
+        int* bestMatchCoordX,
+        int* bestMatchCoordY,
+        float* bestMatchCost)
+{
+    int targetWidth = targetDims.x;
+    int sourceWidth = sourceDims.x;
+    for(int i=-k; i<=k; i+=k)
+    {
+        for(int j=-k; j<=k; j++)
+        {
+            if(i==0 && j==0) continue;
+            int votingNeighborX = targetCoord.x+i;
+            int votingNeighborY = targetCoord.y+j;
+
+            if(!isValidAnchorPosition((int2)(votingNeighborX,votingNeighborY),
+                                       targetDims,patchWidth))
+            {
+                continue;
+            }
+            if(!readMask(targetMask,votingNeighborX + votingNeighborY*targetWidth)) continue;
+            int candidateMatchX = nnfCoordsRead[2*(votingNeighborX + votingNeighborY*targetWidth)] - i;
+            int candidateMatchY = nnfCoordsRead[2*(votingNeighborX + votingNeighborY*targetWidth)+1] - j;
+            if(!isValidAnchorPosition((int2)(candidateMatchX,candidateMatchY),sourceDims,patchWidth))
+            {
+                continue;
+            }
+            if(!readMask(sourceMask,candidateMatchX+sourceWidth*candidateMatchY))
+            {
+                continue;
+            }
+
+            float matchCost = patchCostTiled((int2)(candidateMatchX,candidateMatchY),
+                    targetApronCoord,patchWidth,targetApron,sourceImage,
+                    sourceDims,anchorWeight,*bestMatchCost);
+            if(matchCost<*bestMatchCost)
+            {
+                *bestMatchCost=matchCost;
+                *bestMatchCoordX = candidateMatchX;
+                *bestMatchCoordY = candidateMatchY;
+            }
+        }
+    }
+}
+
+__kernel void searchTiled(
+        ulong randomKey,
+        global float* anchorWeights,
+        RGB_IMAGE_RO targetImage,
+        RGB_IMAGE_RO sourceImage,
+        MASK_RO targetMask,
+        MASK_RO sourceMask,
+        int patchWidth,
+        global int* nnfCoords, //readandwrite
+        global float* nnfCosts, //readandwrite
+        int targetWidth,
+        int targetHeight,
+        int sourceWidth,
+        int sourceHeight,
+        int rowEnd,
+        local float4* targetApron)
+{
+    int2 targetDims = {targetWidth,targetHeight};
+    int2 sourceDims = {sourceWidth,sourceHeight};
+    loadTargetApron(targetImage,targetDims,targetApron,patchWidth);
+
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    int2 targetCoord = {x,y};
+    int targetIndex = x+targetWidth*y;
+
+    if(x>=targetWidth || y>=rowEnd ||
+       !isValidAnchorPosition(targetCoord,targetDims,patchWidth) ||
+       !readMask(targetMask,targetIndex))
+    {
+        return;
+    }
+
+    int sourceAnchorX = nnfCoords[2*targetIndex];
+    int sourceAnchorY = nnfCoords[2*targetIndex+1];
+    float currentCost = nnfCosts[targetIndex];
+    RandomStream random = randomStream(randomKey,targetIndex);
+    searchAroundTiled(&random,apronCoord(patchWidth),targetApron,sourceImage,sourceDims,sourceMask,
+                      patchWidth,anchorWeights[targetIndex],&sourceAnchorX,&sourceAnchorY,&currentCost);
+
+    nnfCoords[2*targetIndex] = sourceAnchorX;
+    nnfCoords[2*targetIndex+1] = sourceAnchorY;
+    nnfCosts[targetIndex] = currentCost;
+}
+
+__kernel void propagateTiled(
+            global float* anchorWeights,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
+            int patchWidth,
+            int k,
+            global int* nnfCoordsRead, //readonly.
+            global int* nnfCoordsWrite, //writeonly
+            global float* nnfCostsRead, //readonly
+            global float* nnfCostsWrite, //writeonly
+            int targetWidth,
+            int targetHeight,
+            int sourceWidth,
+            int sourceHeight,
+            int rowEnd,
+            local float4* targetApron)
+{
+    int2 targetDims = {targetWidth, targetHeight };
+    int2 sourceDims = {sourceWidth,sourceHeight};
+    loadTargetApron(targetImage,targetDims,targetApron,patchWidth);
+
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd)
+    {
+        return;
+    }
+
+    int targetIdx = x + targetWidth*y;
+    float bestMatchCost = nnfCostsRead[targetIdx];
+    int bestMatchCoordX = nnfCoordsRead[2*targetIdx];
+    int bestMatchCoordY = nnfCoordsRead[2*targetIdx+1];
+    propagateFromNeighborsTiled((int2)(x,y),targetDims,apronCoord(patchWidth),targetApron,sourceImage,
+                                sourceDims,targetMask,sourceMask,nnfCoordsRead,patchWidth,k,
+                                anchorWeights[targetIdx],&bestMatchCoordX,&bestMatchCoordY,&bestMatchCost);
+
+    nnfCoordsWrite[2*targetIdx] = bestMatchCoordX;
+    nnfCoordsWrite[2*targetIdx+1] = bestMatchCoordY;
+    nnfCostsWrite[targetIdx] = bestMatchCost;
+}
+
+//Fused kernels.  Each does the work of two launches in one, sharing the apron load and the
+//per-anchor reads between them.
+
+//A search followed by one jumpflood round (jump distance k) of a propagate, in one pass.  The
+//host runs the earlier rounds of the propagate with propagateTiled and this kernel for the
+//final one, k=1, so the search starts from the propagated matches.  The anchor's own match is
+//the one it just searched its way to, but its neighbors' matches are read from nnfCoordsRead,
+//i.e. as they were before this pass searched them; their improvements spread in the next
+//propagate.
+__kernel void searchPropagateTiled(
+            ulong randomKey,
+            global float* anchorWeights,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
+            int patchWidth,
+            int k,
+            global int* nnfCoordsRead, //readonly.
+            global int* nnfCoordsWrite, //writeonly
+            global float* nnfCostsRead, //readonly
+            global float* nnfCostsWrite, //writeonly
+            int targetWidth,
+            int targetHeight,
+            int sourceWidth,
+            int sourceHeight,
+            int rowEnd,
+            local float4* targetApron)
+{
+    int2 targetDims = {targetWidth, targetHeight };
+    int2 sourceDims = {sourceWidth,sourceHeight};
+    loadTargetApron(targetImage,targetDims,targetApron,patchWidth);
+
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd)
+    {
+        return;
+    }
+
+    int2 targetCoord = {x,y};
+    int targetIdx = x + targetWidth*y;
+    int2 targetApronCoord = apronCoord(patchWidth);
+    float anchorWeight = anchorWeights[targetIdx];
+    float bestMatchCost = nnfCostsRead[targetIdx];
+    int bestMatchCoordX = nnfCoordsRead[2*targetIdx];
+    int bestMatchCoordY = nnfCoordsRead[2*targetIdx+1];
+
+    //as in search, only valid, masked anchors search
+    if(isValidAnchorPosition(targetCoord,targetDims,patchWidth) && readMask(targetMask,targetIdx))
+    {
+        RandomStream random = randomStream(randomKey,targetIdx);
+        searchAroundTiled(&random,targetApronCoord,targetApron,sourceImage,sourceDims,sourceMask,
+                          patchWidth,anchorWeight,&bestMatchCoordX,&bestMatchCoordY,&bestMatchCost);
+    }
+
+    //as in propagate, every anchor takes part
+    propagateFromNeighborsTiled(targetCoord,targetDims,targetApronCoord,targetApron,sourceImage,
+                                sourceDims,targetMask,sourceMask,nnfCoordsRead,patchWidth,k,
+                                anchorWeight,&bestMatchCoordX,&bestMatchCoordY,&bestMatchCost);
+
+    nnfCoordsWrite[2*targetIdx] = bestMatchCoordX;
+    nnfCoordsWrite[2*targetIdx+1] = bestMatchCoordY;
+    nnfCostsWrite[targetIdx] = bestMatchCost;
+}
+
+//blend followed by nnfCosts, in one pass.  A cost needs the blended colors of the whole patch,
+//which other work-items produce, so each work-group blends its apron (not just its tile) into
+//local memory and computes its tile's costs from that; the halo pixels are blended by every
+//work-group that overlaps them.  Only the tile is written to targetImagePyramidSize.
+//PRECONDITIONS:
+//-knownTargetImage holds the target's unmasked pixels as they were when the pyramid level was
+// set up (blend never changes those), so this kernel need not read the image it writes.
+__kernel void blendAndCostsTiled(
+            global int* nnfCoords, //read only
+            MASK_RO targetMask, //read only
+            MASK_RO sourceMask, //read only
+            global float* anchorWeights, //read only
+            RGB_IMAGE_RO sourceImagePyramidSize,
+            RGB_IMAGE_RO knownTargetImage,
+            RGB_IMAGE_WO targetImagePyramidSize,
+            int patchWidth,
+            int targetWidth,
+            int targetHeight,
+            int sourceWidth,
+            int sourceHeight,
+            global float* nnfCosts, //write only
+            int rowEnd,
+            local float4* targetApron)
+{
+    int2 targetDims = {targetWidth,targetHeight};
+    int2 sourceDims = {sourceWidth,sourceHeight};
+
+    //like loadTargetApron, except masked pixels are blended rather than read
+    int width = apronWidth(patchWidth);
+    int numApronPixels = width*apronHeight(patchWidth);
+    int originX = get_global_id(0) - get_local_id(0) - patchWidth/2;
+    int originY = get_global_id(1) - get_local_id(1) - patchWidth/2;
+    int numWorkItems = get_local_size(0)*get_local_size(1);
+    for(int i = get_local_id(0) + get_local_id(1)*get_local_size(0); i<numApronPixels; i+=numWorkItems)
+    {
+        int2 coord = clamp((int2)(originX + i%width, originY + i/width), (int2)(0,0), targetDims-1);
+        if(readMask(targetMask,coord.x+targetWidth*coord.y))
+        {
+            targetApron[i] = blendedColor(coord,nnfCoords,targetMask,sourceMask,anchorWeights,
+                                          sourceImagePyramidSize,targetDims,sourceDims,patchWidth);
+        }
+        else
+        {
+            targetApron[i] = readRGB(knownTargetImage,coord,targetDims);
+        }
+    }
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd) return;
+    int2 targetCoord = {x,y};
+    int targetIndex = x+targetWidth*y;
+    int2 targetApronCoord = apronCoord(patchWidth);
+
+    if(!readMask(targetMask,targetIndex))
+    {
+        nnfCosts[targetIndex] = MAXFLOAT;
+        return;
+    }
+    writeRGB(targetImagePyramidSize,targetCoord,targetDims,
+             targetApron[targetApronCoord.x + targetApronCoord.y*width]);
+
+    if(!isValidAnchorPosition(targetCoord,targetDims,patchWidth))
+    {
+        nnfCosts[targetIndex] = MAXFLOAT;
+        return;
+    }
+    int sourceX = nnfCoords[2*targetIndex];
+    int sourceY = nnfCoords[2*targetIndex+1];
+    if(!readMask(sourceMask,sourceX + sourceWidth*sourceY))
+    {
+        nnfCosts[targetIndex] = MAXFLOAT;
+        return;
+    }
+    nnfCosts[targetIndex] = patchCostTiled((int2)(sourceX,sourceY),targetApronCoord,patchWidth,
+                                           targetApron,sourceImagePyramidSize,sourceDims,
+                                           anchorWeights[targetIndex],MAXFLOAT);
+}
+
 //This differs markedly from the CPU implementation.  There is no more per-pixel loop
 //to search for unmasked valid source coord when necessary.  Instead, if an upsampled
 //source coord is an invalid anchor pos, we assign a random valid pos, and do not even
@@ -512,22 +1154,23 @@ __kernel void search(
 __kernel void nnfUpsampleCoords(
         int prevTargetWidth,
         int prevTargetHeight,
-        global int* nextTargetMask,
-        global int* nextSourceMask,
+        MASK_RO nextTargetMask,
+        MASK_RO nextSourceMask,
         int nextSourceWidth,
         int nextSourceHeight,
         int prevSourceWidth,
         int prevSourceHeight,
         int patchWidth,
-        global ulong* randomBuffer,
+        ulong randomKey,
         global int* prevNNFCoords,
-        global int* nextNNFCoords)
+        global int* nextNNFCoords,
+        int targetWidth,
+        int targetHeight)
 {
     int x=get_global_id(0);
     int y=get_global_id(1);
+    if(x>=targetWidth || y>=targetHeight) return;
     int2 targetCoord = {x,y};
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
     int2 targetDims = {targetWidth,targetHeight};
     int2 sourceDims = {nextSourceWidth,nextSourceHeight};
     int2 prevTargetDims = {prevTargetWidth,prevTargetHeight};
@@ -536,7 +1179,7 @@ __kernel void nnfUpsampleCoords(
     //is (newX,newY) an invalid anchor position or masked?  If so,
     //just fill with a bogus coordinate and jettison.
     if(!isValidAnchorPosition(targetCoord,targetDims,patchWidth) ||
-       !nextTargetMask[targetIndex])
+       !readMask(nextTargetMask,targetIndex))
     {
         nextNNFCoords[2*targetIndex] = 0;
         nextNNFCoords[2*targetIndex+1] = 0;
@@ -577,8 +1220,9 @@ __kernel void nnfUpsampleCoords(
     if(!isValidAnchorPosition((int2)(upsampledX,upsampledY),sourceDims,patchWidth))
     {
         //assign some random, valid source coordinate
-        upsampledX = patchWidth/2 + nextRand(randomBuffer,targetIndex)%(nextSourceWidth-patchWidth);
-        upsampledY = patchWidth/2 + nextRand(randomBuffer,targetIndex)%(nextSourceHeight-patchWidth);
+        RandomStream random = randomStream(randomKey,targetIndex);
+        upsampledX = patchWidth/2 + nextRand(&random)%(nextSourceWidth-patchWidth);
+        upsampledY = patchWidth/2 + nextRand(&random)%(nextSourceHeight-patchWidth);
     }
 
     nextNNFCoords[2*targetIndex] = upsampledX;
@@ -588,27 +1232,27 @@ __kernel void nnfUpsampleCoords(
 }
 
 //meant to be called right after nnfUpsample, which fills nnfCoords.
-__kernel void nnfCosts(
-            __read_only image2d_t targetImage,
-            __read_only image2d_t sourceImage,
+void nnfCostsAt(
+            int x,
+            int y,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
             global float* anchorWeights,
-            global int* targetMask,
-            global int* sourceMask,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
             int sourceWidth,
             int patchWidth,
             global int* nnfCoords, //read only
-            global float* nnfCosts //write only
-             )
+            global float* nnfCosts, //write only
+            int targetWidth,
+            int targetHeight,
+            int sourceHeight)
 {
-    int x=get_global_id(0);
-    int y=get_global_id(1);
     int2 targetCoord = {x,y};
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
     int targetIndex = x+targetWidth*y;
 
     if(!isValidAnchorPosition(targetCoord,(int2)(targetWidth,targetHeight),patchWidth)
-       || !targetMask[targetIndex])
+       || !readMask(targetMask,targetIndex))
     {
         nnfCosts[targetIndex] = MAXFLOAT;
         return;
@@ -622,18 +1266,68 @@ __kernel void nnfCosts(
     int2 sourceCoord = { sourceX, sourceY };
 
     //if it's a masked coord, then indicate maximum cost
-    if(!sourceMask[sourceX + sourceWidth*sourceY])
+    if(!readMask(sourceMask,sourceX + sourceWidth*sourceY))
     {
         nnfCosts[targetIndex] = MAXFLOAT;
         return;
     }
 
     float costThere = patchCost(sourceCoord,targetCoord,patchWidth,
-                                targetImage,sourceImage,anchorWeights,MAXFLOAT);
+                                targetImage,(int2)(targetWidth,targetHeight),
+                                sourceImage,(int2)(sourceWidth,sourceHeight),
+                                anchorWeights,MAXFLOAT);
     nnfCosts[targetIndex] = costThere;
 
 }
 
+__kernel void nnfCosts(
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            global float* anchorWeights,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
+            int sourceWidth,
+            int patchWidth,
+            global int* nnfCoords, //read only
+            global float* nnfCosts, //write only
+            int targetWidth,
+            int targetHeight,
+            int sourceHeight,
+            int rowEnd
+             )
+{
+    int x=get_global_id(0);
+    int y=get_global_id(1);
+    if(x>=targetWidth || y>=rowEnd) return;
+    nnfCostsAt(x,y,targetImage,sourceImage,anchorWeights,targetMask,sourceMask,sourceWidth,
+               patchWidth,nnfCoords,nnfCosts,targetWidth,targetHeight,sourceHeight);
+}
+
+__kernel void nnfCostsList(
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
+            global float* anchorWeights,
+            MASK_RO targetMask,
+            MASK_RO sourceMask,
+            int sourceWidth,
+            int patchWidth,
+            global int* nnfCoords, //read only
+            global float* nnfCosts, //write only
+            int targetWidth,
+            int targetHeight,
+            int sourceHeight,
+            global const int* activePixels,
+            int numActivePixels
+             )
+{
+    int i=get_global_id(0);
+    if(i>=numActivePixels) return;
+    int x=activePixels[i]%targetWidth;
+    int y=activePixels[i]/targetWidth;
+    nnfCostsAt(x,y,targetImage,sourceImage,anchorWeights,targetMask,sourceMask,sourceWidth,
+               patchWidth,nnfCoords,nnfCosts,targetWidth,targetHeight,sourceHeight);
+}
+
 //This is called only for first pyramid level.  We guarantee that
 //every coord in nnfCoords for which targetMask!=0 gets mapped to a
 //VALID source coord, not necessarily a source coord
@@ -641,29 +1335,30 @@ __kernel void nnfCosts(
 //this is impossible to absolutely guarantee.
 //Note that costs get filled too
 __kernel void nnfInitialFill(
-            global int* targetMask, //read only
-            global int* sourceMask, //read only
+            MASK_RO targetMask, //read only
+            MASK_RO sourceMask, //read only
             int sourceWidth,
             int sourceHeight,
             int patchWidth,
-            global ulong* randomBuffer,
-            __read_only image2d_t targetImage,
-            __read_only image2d_t sourceImage,
+            ulong randomKey,
+            RGB_IMAGE_RO targetImage,
+            RGB_IMAGE_RO sourceImage,
             global float* anchorWeights,
             global int* nnfCoords,  //write only
-            global float* nnfCosts) //write only
+            global float* nnfCosts, //write only
+            int targetWidth,
+            int targetHeight)
 {
 
     int x=get_global_id(0);
     int y=get_global_id(1);
+    if(x>=targetWidth || y>=targetHeight) return;
     int2 targetCoord = {x,y};
-    int targetWidth = get_global_size(0);
-    int targetHeight = get_global_size(1);
     int targetIndex = x+targetWidth*y;
 
     //skip invalid target anchors and masked pixels
     if(!isValidAnchorPosition((int2)(x,y),(int2)(targetWidth,targetHeight),patchWidth) ||
-        !targetMask[targetIndex])
+        !readMask(targetMask,targetIndex))
     {
         //still assign at least a bogus value in anticipation
         //of future upsampling from this nnf buffer
@@ -674,21 +1369,23 @@ __kernel void nnfInitialFill(
     }
 
     int maxTriesPerPixel = 10*max(targetWidth,targetHeight);
+    RandomStream random = randomStream(randomKey,targetIndex);
 
     for(int attempt=0; attempt<maxTriesPerPixel; attempt++)
     {
-        int sourceX = patchWidth/2 + nextRand(randomBuffer,targetIndex)%(sourceWidth-patchWidth);
-        int sourceY = patchWidth/2 + nextRand(randomBuffer,targetIndex)%(sourceHeight-patchWidth);
+        int sourceX = patchWidth/2 + nextRand(&random)%(sourceWidth-patchWidth);
+        int sourceY = patchWidth/2 + nextRand(&random)%(sourceHeight-patchWidth);
 
         nnfCoords[2*targetIndex] = sourceX;
         nnfCoords[2*targetIndex+1] = sourceY;
-        if(sourceMask[sourceX + sourceY*sourceWidth])
+        if(readMask(sourceMask,sourceX + sourceY*sourceWidth))
         {
             //we have found a source coord that is valid _and_ unmasked.  We are done - just
             //determine the cost of this match
             float costThere = patchCost((int2)(sourceX,sourceY),
                                         targetCoord,patchWidth,
-                                 targetImage,sourceImage,
+                                 targetImage,(int2)(targetWidth,targetHeight),
+                                 sourceImage,(int2)(sourceWidth,sourceHeight),
                                  anchorWeights,MAXFLOAT);
 
             nnfCosts[targetIndex] = costThere;
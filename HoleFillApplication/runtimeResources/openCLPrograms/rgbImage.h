@@ -0,0 +1,91 @@
+/*
+Access to RGB images that works whether they are stored as image2d_t (the default) or, when
+the program is built with -D RGB_IMAGE_BUFFERS, as row-major float4 buffers.  Buffers suit CPU
+OpenCL runtimes, which emulate image sampling slowly, and devices without image support.
+Image dimensions are always passed explicitly so kernel signatures are the same either way.
+
+Buffers hold float4 pixels by default; with -D RGB_IMAGE_HALF they hold 4 halfs per pixel and
+with -D RGB_IMAGE_UNORM8 4 uchars per pixel, each mapping [0,255] to [0,1].  Images convert
+between their channel format and float4 in read_imagef/write_imagef, so the formats need no
+defines there.  Either way readRGB/writeRGB deal in float4, and kernels do all their
+arithmetic on those; only storage is reduced.
+*/
+#ifndef RGB_IMAGE_H
+#define RGB_IMAGE_H
+
+#ifdef RGB_IMAGE_BUFFERS
+
+#if defined(RGB_IMAGE_HALF)
+
+//Reading and writing halfs through vload_half4/vstore_half4 needs no half arithmetic support.
+#define RGB_IMAGE_RO global const half*
+#define RGB_IMAGE_WO global half*
+
+//Out-of-range coords are clamped, as the image sampler below would do.
+float4 readRGB(global const half* image, int2 coord, int2 dims)
+{
+    coord = clamp(coord, (int2)(0,0), dims-1);
+    return vload_half4(coord.x + coord.y*dims.x, image);
+}
+
+void writeRGB(global half* image, int2 coord, int2 dims, float4 value)
+{
+    vstore_half4(value, coord.x + coord.y*dims.x, image);
+}
+
+#elif defined(RGB_IMAGE_UNORM8)
+
+#define RGB_IMAGE_RO global const uchar4*
+#define RGB_IMAGE_WO global uchar4*
+
+float4 readRGB(global const uchar4* image, int2 coord, int2 dims)
+{
+    coord = clamp(coord, (int2)(0,0), dims-1);
+    return convert_float4(image[coord.x + coord.y*dims.x]) * (1.0f/255.0f);
+}
+
+//Rounds to nearest and saturates, as write_imagef does for CL_UNORM_INT8.
+void writeRGB(global uchar4* image, int2 coord, int2 dims, float4 value)
+{
+    image[coord.x + coord.y*dims.x] = convert_uchar4_sat_rte(value * 255.0f);
+}
+
+#else
+
+#define RGB_IMAGE_RO global const float4*
+#define RGB_IMAGE_WO global float4*
+
+//Out-of-range coords are clamped, as the image sampler below would do.
+float4 readRGB(global const float4* image, int2 coord, int2 dims)
+{
+    coord = clamp(coord, (int2)(0,0), dims-1);
+    return image[coord.x + coord.y*dims.x];
+}
+
+void writeRGB(global float4* image, int2 coord, int2 dims, float4 value)
+{
+    image[coord.x + coord.y*dims.x] = value;
+}
+
+#endif
+
+#else
+
+#define RGB_IMAGE_RO __read_only image2d_t
+#define RGB_IMAGE_WO __write_only image2d_t
+
+__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+
+float4 readRGB(__read_only image2d_t image, int2 coord, int2 dims)
+{
+    return read_imagef(image,sampler,coord);
+}
+
+void writeRGB(__write_only image2d_t image, int2 coord, int2 dims, float4 value)
+{
+    write_imagef(image,coord,value);
+}
+
+#endif
+
+#endif
@@ -2,8 +2,11 @@
 General utility kernels that might be used by anything
 */
 
+//Kernels here are launched with global sizes padded up to a multiple of the work-group size,
+//so each one is told its domain size and returns early for work-items outside it.
 
-__constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_TO_EDGE | CLK_FILTER_NEAREST;
+#include "mask.h"
+#include "rgbImage.h"
 
 
 //An external distance map only records distances from points outside the shape
@@ -11,30 +14,33 @@ __constant sampler_t sampler = CLK_NORMALIZED_COORDS_FALSE | CLK_ADDRESS_CLAMP_T
 //running jumpflood.  inShapeDist should normally be zero, of course, but we allow
 //it to be other stuff in order to allow "staggered distances".
 __kernel void externalDistanceMapInit(
-        global int* shape,
+        MASK_RO shape,
         global float* initialMap,
-        float inShapeDist
+        float inShapeDist,
+        int width,
+        int height
 )
 {
     int x=get_global_id(0);
     int y=get_global_id(1);
-    int width = get_global_size(0);
+    if(x>=width || y>=height) return;
     int idx = x+width*y;
-    initialMap[idx] = shape[x+width*y] ? inShapeDist : MAXFLOAT;
+    initialMap[idx] = readMask(shape,x+width*y) ? inShapeDist : MAXFLOAT;
 }
 
 __kernel void externalDistanceMapStep(
-            global int* shape, //const
+            MASK_RO shape,
             global float* prevDistMap,
             global float* nextDistMap,
-            int k)
+            int k,
+            int width,
+            int height)
 {
-    int width = get_global_size(0);
-    int height = get_global_size(1);
     int x=get_global_id(0);
     int y=get_global_id(1);
+    if(x>=width || y>=height) return;
 
-    if(shape[x+width*y])
+    if(readMask(shape,x+width*y))
     {
         nextDistMap[x+width*y]=prevDistMap[x+width*y];
         return;
@@ -70,15 +76,17 @@ __kernel void externalDistanceMapStep(
 //outside the shape obviously get initial value -1 so that points on outside border
 //of shape get value 0
 __kernel void internalDistanceMapInit(
-        global int* shape,
-        global float* initialMap
+        MASK_RO shape,
+        global float* initialMap,
+        int width,
+        int height
 )
 {
     int x=get_global_id(0);
     int y=get_global_id(1);
-    int width = get_global_size(0);
+    if(x>=width || y>=height) return;
     int idx = x+width*y;
-    initialMap[idx] = shape[x+width*y] ? MAXFLOAT : -1;
+    initialMap[idx] = readMask(shape,x+width*y) ? MAXFLOAT : -1;
 }
 
 //This could be an internal or external distance map (ie. distance from outside points to border of shape
@@ -92,12 +100,13 @@ __kernel void internalDistanceMapInit(
 __kernel void internalDistanceMapStep(
             global float* prevDistMap,
             global float* nextDistMap,
-            int k)
+            int k,
+            int width,
+            int height)
 {
-    int width = get_global_size(0);
-    int height = get_global_size(1);
     int x=get_global_id(0);
     int y=get_global_id(1);
+    if(x>=width || y>=height) return;
 
     float smallestDist = prevDistMap[x+width*y];
 
@@ -125,20 +134,20 @@ __kernel void internalDistanceMapStep(
 //readImage is the big one.  writeImage, a smaller one, needs to be filled
 //from readImage.
 //PRECONDITIONS:
-//-It is assumed that the two images have valid sizes and that the work domain is exactly the size of the writeImage.
+//-It is assumed that the two images have valid sizes and that the work domain covers writeImage.
 //-readImage is larger enough than writeImage that no divide by zero error will occur.
 __kernel void downsampleRGBImage(
-                __read_only image2d_t readImage,
-                __write_only image2d_t writeImage
+                RGB_IMAGE_RO readImage,
+                RGB_IMAGE_WO writeImage,
+                int largeWidth,
+                int largeHeight,
+                int smallWidth,
+                int smallHeight
     ) {
 
-        int largeWidth = get_image_width(readImage);
-        int largeHeight = get_image_height(readImage);
-        int smallWidth=get_global_size(0);
-        int smallHeight=get_global_size(1);
-
         int x=get_global_id(0);
         int y=get_global_id(1);
+        if(x>=smallWidth || y>=smallHeight) return;
         const int2 writePos = {x,y};
 
         //find the topleft corner of the smaller image pixel in the
@@ -156,31 +165,32 @@ __kernel void downsampleRGBImage(
             for(int yOld = (int)ceil(top); yOld<(int)ceil(bottom); yOld++)
             {
                 int2 readPos = {xOld,yOld};
-                sum += read_imagef(readImage,sampler,readPos);
+                sum += readRGB(readImage,readPos,(int2)(largeWidth,largeHeight));
                 numEncountered+=1.0;
             }
         }
 
-        write_imagef(writeImage,writePos,sum/numEncountered);
+        writeRGB(writeImage,writePos,(int2)(smallWidth,smallHeight),sum/numEncountered);
 }
 
 //PRECONDITIONS:
-//-It is assumed that the two images have valid sizes and that the work domain is exactly the size of the writeImage.
+//-It is assumed that the two images have valid sizes and that the work domain covers writeImage,
+// which is smallWidth by smallHeight.
 //-readImage is larger enough than writeImage that each of writeImage's pixels map to at least one of its
 //-readImageWidth and readImageHeight correspond to actual width and height of readImage
 __kernel void downsampleBooleanImage(
-                __global int* readImage,
-                __global int* writeImage,
+                MASK_RO readImage,
+                MASK_WO writeImage,
                 int readImageWidth,
                 int readImageHeight,
-                int truesPrevail //this is treated as a boolean
+                int truesPrevail, //this is treated as a boolean
+                int smallWidth,
+                int smallHeight
     ) {
 
-        int smallWidth=get_global_size(0);
-        int smallHeight=get_global_size(1);
-
         int x=get_global_id(0);
         int y=get_global_id(1);
+        if(x>=smallWidth || y>=smallHeight) return;
 
         //find the topleft corner of the smaller image pixel in the
         //space of the larger (original) image.
@@ -196,7 +206,7 @@ __kernel void downsampleBooleanImage(
             if(result==(bool)truesPrevail) break;
             for(int yOld = (int)ceil(top); yOld<(int)ceil(bottom); yOld++)
             {
-                int oldValue = readImage[xOld + yOld*readImageWidth];
+                int oldValue = readMask(readImage,xOld + yOld*readImageWidth)!=0;
                 if(oldValue==truesPrevail)
                 {
                     result=truesPrevail;
@@ -205,5 +215,96 @@ __kernel void downsampleBooleanImage(
             }
         }
 
-        writeImage[x+smallWidth*y] = result;
+        writeMask(writeImage,x+smallWidth*y,result);
+}
+
+//Stream compaction: the indices of a mask's set pixels, in order, built from exclusive prefix
+//sums of the mask.  The prefix sums are done a block (one work-group) at a time by
+//prefixSumMaskBlocks; when there is more than one block, the host prefix-sums the block totals
+//with prefixSumBlocks and adds them back with prefixSumAddBlockOffsets.
+//PRECONDITIONS (for the prefixSum... kernels):
+//-1D launch; the local size is a power of two, and the same for all of them.
+//-scratch holds one int per work-item.
+
+//output[i] = sum of the values before i within i's block; blockSums gets each block's total.
+void prefixSumBlock(
+        int value,
+        global int* output,
+        global int* blockSums,
+        int count,
+        local int* scratch)
+{
+    int i = get_global_id(0);
+    int localId = get_local_id(0);
+    int blockSize = get_local_size(0);
+
+    scratch[localId] = value;
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    //inclusive scan of the block (Hillis-Steele)
+    for(int offset=1; offset<blockSize; offset*=2)
+    {
+        int addend = localId>=offset ? scratch[localId-offset] : 0;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        scratch[localId] += addend;
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+
+    if(i<count)
+    {
+        output[i] = scratch[localId] - value;
+    }
+    if(localId==blockSize-1)
+    {
+        blockSums[get_group_id(0)] = scratch[localId];
+    }
+}
+
+//Every set pixel counts as 1.
+__kernel void prefixSumMaskBlocks(
+        MASK_RO mask,
+        global int* output,
+        global int* blockSums,
+        int count,
+        local int* scratch)
+{
+    int i = get_global_id(0);
+    prefixSumBlock(i<count ? readMask(mask,i)!=0 : 0,output,blockSums,count,scratch);
+}
+
+__kernel void prefixSumBlocks(
+        global const int* input,
+        global int* output,
+        global int* blockSums,
+        int count,
+        local int* scratch)
+{
+    int i = get_global_id(0);
+    prefixSumBlock(i<count ? input[i] : 0,output,blockSums,count,scratch);
+}
+
+//blockOffsets holds the exclusive prefix sums of the blocks' totals.
+__kernel void prefixSumAddBlockOffsets(
+        global int* data,
+        global const int* blockOffsets,
+        int count)
+{
+    int i = get_global_id(0);
+    if(i>=count) return;
+    data[i] += blockOffsets[get_group_id(0)];
+}
+
+//prefixSums are the prefix sums of mask from prefixSumMaskBlocks.
+__kernel void compactMask(
+        MASK_RO mask,
+        global const int* prefixSums,
+        global int* indices,
+        int count)
+{
+    int i = get_global_id(0);
+    if(i>=count) return;
+    if(readMask(mask,i))
+    {
+        indices[prefixSums[i]] = i;
+    }
 }
@@ -0,0 +1,26 @@
+#include <OpenCL/commandrecording.h>
+
+namespace openCL {
+
+void CommandRecording::append( Command command )
+{
+    _commands.push_back( std::move( command ) );
+}
+
+cl_int CommandRecording::enqueue( const cl::CommandQueue& queue ) const
+{
+    for( const auto& command : _commands ) {
+        const cl_int error = command( queue, nullptr );
+        if( error != CL_SUCCESS ) {
+            return error;
+        }
+    }
+    return CL_SUCCESS;
+}
+
+size_t CommandRecording::size() const
+{
+    return _commands.size();
+}
+
+} // openCL
@@ -0,0 +1,30 @@
+#ifndef OPENCL_COMMANDRECORDING_H
+#define OPENCL_COMMANDRECORDING_H
+
+#include <CL/cl.hpp>
+
+#include <functional>
+#include <vector>
+
+namespace openCL {
+
+/// A sequence of device commands captured for replay (see OpenCLGPUHost::setRecording()). Each
+/// command holds copies of the cl:: wrappers it uses, so the memory objects and kernels it
+/// refers to live as long as the recording does.
+class CommandRecording
+{
+public:
+    /// 'event', if non-null, receives the event of the command's device work.
+    using Command = std::function< cl_int( const cl::CommandQueue& queue, cl::Event* event ) >;
+
+    void append( Command command );
+    /// Enqueue every command in order, stopping at the first that fails.
+    cl_int enqueue( const cl::CommandQueue& queue ) const;
+    size_t size() const;
+private:
+    std::vector< Command > _commands;
+};
+
+} // openCL
+
+#endif // #include
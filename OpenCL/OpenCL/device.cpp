@@ -5,7 +5,12 @@
 
 namespace openCL {
 
-Device::Device( cl::Device device ) : _device( device ), _supportsImages( false )
+Device::Device( cl::Device device ) 
+	: _device( device )
+	, _supportsImages( false )
+	, _hostUnifiedMemory( false )
+	, _localMemSize( 0 )
+	, _maxWorkGroupSize( 1 )
 {
 	_device.getInfo( CL_DEVICE_NAME, &_name );
 	_device.getInfo( CL_DEVICE_VENDOR, &_vendor );
@@ -17,6 +22,13 @@ Device::Device( cl::Device device ) : _device( device ), _supportsImages( false
 	cl_bool images = CL_FALSE;
     _device.getInfo( CL_DEVICE_IMAGE_SUPPORT, &images );	
 	_supportsImages = images == CL_TRUE;
+
+	cl_bool unified = CL_FALSE;
+	_device.getInfo( CL_DEVICE_HOST_UNIFIED_MEMORY, &unified );
+	_hostUnifiedMemory = unified == CL_TRUE;
+
+	_device.getInfo( CL_DEVICE_LOCAL_MEM_SIZE, &_localMemSize );
+	_device.getInfo( CL_DEVICE_MAX_WORK_GROUP_SIZE, &_maxWorkGroupSize );
 }
 
 Device& Device::operator=(const Device& d)
@@ -29,9 +41,38 @@ Device& Device::operator=(const Device& d)
 	_openCL_CVersion = d._openCL_CVersion;
 	_type = d._type;
 	_supportsImages = d._supportsImages;
+	_hostUnifiedMemory = d._hostUnifiedMemory;
+	_localMemSize = d._localMemSize;
+	_maxWorkGroupSize = d._maxWorkGroupSize;
 	return *this;
 }
 
+std::vector< Device > Device::split( int numDevices ) const
+{
+	std::vector< Device > result;
+	cl_uint computeUnits = 0;
+	if( numDevices < 1 
+		|| _device.getInfo( CL_DEVICE_MAX_COMPUTE_UNITS, &computeUnits ) != CL_SUCCESS 
+		|| computeUnits < static_cast< cl_uint >( numDevices ) ) {
+		return result;
+	}
+
+	const cl_device_partition_property properties[] = {
+		CL_DEVICE_PARTITION_EQUALLY,
+		static_cast< cl_device_partition_property >( computeUnits / numDevices ),
+		0 };
+	std::vector< cl::Device > subDevices;
+	cl::Device parent = _device;
+	if( parent.createSubDevices( properties, &subDevices ) != CL_SUCCESS ) {
+		return result;
+	}
+	// Equal shares may leave enough compute units over for extra sub-devices.
+	for( int i = 0; i < numDevices && i < static_cast< int >( subDevices.size() ); i++ ) {
+		result.push_back( Device{ subDevices[ i ] } );
+	}
+	return result;
+}
+
 std::string Device::typeString( cl_device_type type )
 {
     const std::map< cl_device_type, const char* > typeToString = {
@@ -97,5 +138,20 @@ bool Device::supportsImages() const
 {
 	return _supportsImages;
 }	
+
+bool Device::hostUnifiedMemory() const
+{
+	return _hostUnifiedMemory;
+}
+
+cl_ulong Device::localMemSize() const
+{
+	return _localMemSize;
+}
+
+size_t Device::maxWorkGroupSize() const
+{
+	return _maxWorkGroupSize;
+}
 	
 } // openCL
\ No newline at end of file
@@ -4,6 +4,7 @@
 #include <CL/cl.hpp>
 
 #include <string>
+#include <vector>
 
 namespace openCL {
 
@@ -22,8 +23,19 @@ public:
 	const std::string& version() const;
 	const std::string& openCL_CVersion() const;
 	bool supportsImages() const;
+	/// Whether the device shares memory with the host (CPUs and integrated GPUs), so that
+	/// host-allocated memory objects can be mapped without a copy.
+	bool hostUnifiedMemory() const;
 	cl_device_type type() const;
+	/// Bytes of __local memory available to a single work-group.
+	cl_ulong localMemSize() const;
+	size_t maxWorkGroupSize() const;
 	
+	/// Split this device into 'numDevices' sub-devices with equal shares of its compute
+	/// units, as supported by CPU runtimes; empty if it cannot be split that way. Sub-devices
+	/// share a platform with their parent, so they can all be used in one context.
+	std::vector< Device > split( int numDevices ) const;
+
 	static std::string typeString( cl_device_type );
 private:
 	cl::Device _device;
@@ -34,6 +46,9 @@ private:
 	std::string _openCL_CVersion;	
 	cl_device_type _type;
 	bool _supportsImages;
+	bool _hostUnifiedMemory;
+	cl_ulong _localMemSize;
+	size_t _maxWorkGroupSize;
 };
 	
 } // openCL
@@ -0,0 +1,274 @@
+#include <OpenCL/hostconversion.h>
+
+#include <Core/image/imageview.h>
+#include <Core/utility/twodarray.h>
+#include <Core/utility/vector3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace openCL {
+namespace hostConversion {
+
+namespace {
+
+// Smaller images are converted on the calling thread alone, since starting the others would
+// cost more than it saves.
+const int minParallelPixels = 256 * 256;
+
+// IEEE binary16, rounding to nearest even as vstore_half does.
+cl_half floatToHalf( float value )
+{
+    std::uint32_t bits = 0;
+    std::memcpy( &bits, &value, sizeof( bits ) );
+    const std::uint32_t sign = ( bits >> 16 ) & 0x8000u;
+    const std::uint32_t absBits = bits & 0x7FFFFFFFu;
+
+    if( absBits >= 0x7F800000u ) {
+        // Infinity, or NaN kept quiet.
+        return static_cast< cl_half >( sign | 0x7C00u | ( absBits > 0x7F800000u ? 0x200u : 0u ) );
+    }
+    if( absBits >= 0x477FF000u ) {
+        // Rounds to beyond the largest half.
+        return static_cast< cl_half >( sign | 0x7C00u );
+    }
+    if( absBits < 0x38800000u ) {
+        // Subnormal half, or zero: shift the mantissa, with its implicit bit, into place.
+        const int shift = 126 - static_cast< int >( absBits >> 23 );
+        if( shift > 24 ) {
+            return static_cast< cl_half >( sign );
+        }
+        const std::uint32_t mantissa = ( absBits & 0x7FFFFFu ) | 0x800000u;
+        const std::uint32_t shifted = mantissa >> shift;
+        const std::uint32_t remainder = mantissa & ( ( 1u << shift ) - 1 );
+        const std::uint32_t halfway = 1u << ( shift - 1 );
+        const std::uint32_t rounded = shifted
+            + ( remainder > halfway || ( remainder == halfway && ( shifted & 1u ) ) ? 1u : 0u );
+        return static_cast< cl_half >( sign | rounded );
+    }
+    // Normal half: rebias the exponent and round away the low 13 mantissa bits. A carry out
+    // of the mantissa correctly bumps the exponent.
+    const std::uint32_t rebiased = absBits - 0x38000000u;
+    const std::uint32_t remainder = rebiased & 0x1FFFu;
+    std::uint32_t result = rebiased >> 13;
+    if( remainder > 0x1000u || ( remainder == 0x1000u && ( result & 1u ) ) ) {
+        result++;
+    }
+    return static_cast< cl_half >( sign | result );
+}
+
+float halfToFloat( cl_half half )
+{
+    const std::uint32_t sign = static_cast< std::uint32_t >( half & 0x8000u ) << 16;
+    const std::uint32_t exponent = ( half >> 10 ) & 0x1Fu;
+    const std::uint32_t mantissa = half & 0x3FFu;
+    float value = 0.f;
+    if( exponent == 0 ) {
+        value = std::ldexp( static_cast< float >( mantissa ), -24 );
+    } else if( exponent == 0x1F ) {
+        value = mantissa ? std::numeric_limits< float >::quiet_NaN() : std::numeric_limits< float >::infinity();
+    } else {
+        value = std::ldexp( static_cast< float >( mantissa | 0x400u ), static_cast< int >( exponent ) - 25 );
+    }
+    return sign ? -value : value;
+}
+
+cl_uchar floatToUNorm8( float value )
+{
+    // Matches the kernels' convert_uchar4_sat_rte( value * 255 ).
+    return static_cast< cl_uchar >( std::nearbyint( std::min( std::max( value, 0.f ), 1.f ) * 255.f ) );
+}
+
+// Reads one row of a core::ImageRGBView's Vector3 pixels.
+struct Vector3Row
+{
+    const core::Vector3* pixels;
+
+    float r( int x ) const { return static_cast< float >( pixels[ x ].r() ); }
+    float g( int x ) const { return static_cast< float >( pixels[ x ].g() ); }
+    float b( int x ) const { return static_cast< float >( pixels[ x ].b() ); }
+};
+
+// Reads one row of a core::ImageRGBView's 8-bit pixels, to the same values as reading them
+// through get() would give.
+struct Byte8Row
+{
+    const std::uint8_t* bytes;
+    int step;
+    int red;
+    int green;
+    int blue;
+
+    float r( int x ) const { return static_cast< float >( bytes[ x * step + red ] / 255.0 ); }
+    float g( int x ) const { return static_cast< float >( bytes[ x * step + green ] / 255.0 ); }
+    float b( int x ) const { return static_cast< float >( bytes[ x * step + blue ] / 255.0 ); }
+};
+
+template< typename Row >
+void packRGBRow( RGBFormat format, const Row& pixels, int width, std::uint8_t* row )
+{
+    switch( format ) {
+    case RGBFormat::Float:
+    {
+        cl_float* out = reinterpret_cast< cl_float* >( row );
+#pragma omp simd
+        for( int x = 0; x < width; x++ ) {
+            out[ x * 4 ] = pixels.r( x );
+            out[ x * 4 + 1 ] = pixels.g( x );
+            out[ x * 4 + 2 ] = pixels.b( x );
+            out[ x * 4 + 3 ] = 0.f;
+        }
+        break;
+    }
+    case RGBFormat::Half:
+    {
+        cl_half* out = reinterpret_cast< cl_half* >( row );
+        for( int x = 0; x < width; x++ ) {
+            out[ x * 4 ] = floatToHalf( pixels.r( x ) );
+            out[ x * 4 + 1 ] = floatToHalf( pixels.g( x ) );
+            out[ x * 4 + 2 ] = floatToHalf( pixels.b( x ) );
+            out[ x * 4 + 3 ] = 0;
+        }
+        break;
+    }
+    case RGBFormat::UNorm8:
+    {
+#pragma omp simd
+        for( int x = 0; x < width; x++ ) {
+            row[ x * 4 ] = floatToUNorm8( pixels.r( x ) );
+            row[ x * 4 + 1 ] = floatToUNorm8( pixels.g( x ) );
+            row[ x * 4 + 2 ] = floatToUNorm8( pixels.b( x ) );
+            row[ x * 4 + 3 ] = 0;
+        }
+        break;
+    }
+    }
+}
+
+} // unnamed
+
+void packRGB( RGBFormat format, const core::ImageRGBView& image, std::uint8_t* dst, size_t rowPitch )
+{
+    const int width = image.width();
+    const int height = image.height();
+#pragma omp parallel for if( width * height >= minParallelPixels )
+    for( int y = 0; y < height; y++ ) {
+        std::uint8_t* row = dst + rowPitch * y;
+        if( image.hasVector3Pixels() ) {
+            packRGBRow( format, Vector3Row{ image.vector3Row( y ) }, width, row );
+        } else {
+            const Byte8Row pixels{
+                image.byteRow( y ), image.bytesPerPixel(), image.redOffset(), image.greenOffset(), image.blueOffset() };
+            packRGBRow( format, pixels, width, row );
+        }
+    }
+}
+
+void unpackRGB( RGBFormat format, const std::uint8_t* src, size_t rowPitch, core::ImageRGB& image )
+{
+    const int width = image.width();
+    const int height = image.height();
+#pragma omp parallel for if( width * height >= minParallelPixels )
+    for( int y = 0; y < height; y++ ) {
+        core::Vector3* pixels = image.row( y );
+        const std::uint8_t* row = src + rowPitch * y;
+        switch( format ) {
+        case RGBFormat::Float:
+        {
+            const cl_float* in = reinterpret_cast< const cl_float* >( row );
+#pragma omp simd
+            for( int x = 0; x < width; x++ ) {
+                pixels[ x ] = core::Vector3( in[ x * 4 ], in[ x * 4 + 1 ], in[ x * 4 + 2 ] );
+            }
+            break;
+        }
+        case RGBFormat::Half:
+        {
+            const cl_half* in = reinterpret_cast< const cl_half* >( row );
+            for( int x = 0; x < width; x++ ) {
+                pixels[ x ] = core::Vector3(
+                    halfToFloat( in[ x * 4 ] ),
+                    halfToFloat( in[ x * 4 + 1 ] ),
+                    halfToFloat( in[ x * 4 + 2 ] ) );
+            }
+            break;
+        }
+        case RGBFormat::UNorm8:
+        {
+#pragma omp simd
+            for( int x = 0; x < width; x++ ) {
+                pixels[ x ] = core::Vector3(
+                    row[ x * 4 ] / 255.0,
+                    row[ x * 4 + 1 ] / 255.0,
+                    row[ x * 4 + 2 ] / 255.0 );
+            }
+            break;
+        }
+        }
+    }
+}
+
+void packMask( MaskFormat format, const core::ImageBinaryView& image, std::uint8_t* dst )
+{
+    const int width = image.width();
+    const int height = image.height();
+    const int numPixels = width * height;
+    switch( format ) {
+    case MaskFormat::Int:
+    {
+#pragma omp parallel for if( numPixels >= minParallelPixels )
+        for( int y = 0; y < height; y++ ) {
+            const bool* pixels = image.row( y );
+            cl_int* out = reinterpret_cast< cl_int* >( dst ) + static_cast< size_t >( width ) * y;
+#pragma omp simd
+            for( int x = 0; x < width; x++ ) {
+                out[ x ] = pixels[ x ] ? 1 : 0;
+            }
+        }
+        break;
+    }
+    case MaskFormat::UChar:
+    {
+#pragma omp parallel for if( numPixels >= minParallelPixels )
+        for( int y = 0; y < height; y++ ) {
+            const bool* pixels = image.row( y );
+            std::uint8_t* out = dst + static_cast< size_t >( width ) * y;
+#pragma omp simd
+            for( int x = 0; x < width; x++ ) {
+                out[ x ] = pixels[ x ] ? 1 : 0;
+            }
+        }
+        break;
+    }
+    case MaskFormat::Bits:
+    {
+        // Whole words at a time, so the packing does not depend on host byte order.
+        cl_uint* out = reinterpret_cast< cl_uint* >( dst );
+        const int numWords = ( numPixels + 31 ) / 32;
+#pragma omp parallel for if( numPixels >= minParallelPixels )
+        for( int word = 0; word < numWords; word++ ) {
+            const int begin = word * 32;
+            const int end = std::min( numPixels, begin + 32 );
+            // Bits run over the pixels in row-major order, across rows the image may pad.
+            int y = begin / width;
+            int x = begin - y * width;
+            const bool* pixels = image.row( y );
+            cl_uint bits = 0;
+            for( int i = begin; i < end; i++ ) {
+                bits |= static_cast< cl_uint >( pixels[ x ] ) << ( i - begin );
+                if( ++x == width && i + 1 < end ) {
+                    x = 0;
+                    pixels = image.row( ++y );
+                }
+            }
+            out[ word ] = bits;
+        }
+        break;
+    }
+    }
+}
+
+} // hostConversion
+} // openCL
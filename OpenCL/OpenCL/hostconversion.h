@@ -0,0 +1,32 @@
+#ifndef OPENCL_HOSTCONVERSION_H
+#define OPENCL_HOSTCONVERSION_H
+
+#include <OpenCL/mask.h>
+#include <OpenCL/rgbimage.h>
+
+#include <Core/image/imagetypes.h>
+
+#include <cstddef>
+#include <cstdint>
+
+namespace openCL {
+
+/// Conversions between host images and the layouts RGBImage and Mask keep on the device,
+/// reading or writing any host-visible memory, typically a mapped buffer or image, so that a
+/// transfer needs no intermediate copy. Large images are converted by several threads, a band
+/// of rows each, with the inner loops over plain arrays for the compiler to vectorize.
+namespace hostConversion {
+
+/// Write 'image' into 'dst' as RGBA pixels in 'format', with alpha 0, and rows 'rowPitch'
+/// bytes apart. 8-bit views convert as they read, so they need no Vector3 copy first.
+void packRGB( RGBFormat format, const core::ImageRGBView& image, std::uint8_t* dst, size_t rowPitch );
+/// Read RGBA pixels in 'format', with rows 'rowPitch' bytes apart, from 'src' into 'image',
+/// which must already have the pixels' dimensions.
+void unpackRGB( RGBFormat format, const std::uint8_t* src, size_t rowPitch, core::ImageRGB& image );
+/// Write 'image' into 'dst', which must hold Mask::numBytes( format, image.size() ) bytes.
+void packMask( MaskFormat format, const core::ImageBinaryView& image, std::uint8_t* dst );
+
+} // hostConversion
+} // openCL
+
+#endif // #include
@@ -0,0 +1,94 @@
+#include <OpenCL/mask.h>
+
+#include <OpenCL/hostconversion.h>
+
+#include <Core/utility/twodarray.h>
+
+namespace openCL {
+
+Mask::Mask(
+    const cl::Context& context,
+    MaskFormat format,
+    cl_mem_flags flags,
+    const core::IntCoord& dims,
+    cl_int* error )
+    : _format( format )
+    , _dims( dims )
+    , _buffer( context, flags, numBytes( format, dims ), nullptr, error )
+{
+}
+
+const cl::Buffer& Mask::buffer() const
+{
+    return _buffer;
+}
+
+const core::IntCoord& Mask::dims() const
+{
+    return _dims;
+}
+
+MaskFormat Mask::format() const
+{
+    return _format;
+}
+
+cl_int Mask::enqueueWrite( const cl::CommandQueue& queue, const core::ImageBinaryView& image, cl::Event* event )
+{
+    if( image.size() != _dims ) {
+        return CL_INVALID_VALUE;
+    }
+
+    cl_int error = CL_SUCCESS;
+    void* mapped = queue.enqueueMapBuffer(
+        _buffer,
+        CL_TRUE,
+        CL_MAP_WRITE_INVALIDATE_REGION,
+        0,
+        numBytes( _format, _dims ),
+        nullptr,
+        nullptr,
+        &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    hostConversion::packMask( _format, image, static_cast< std::uint8_t* >( mapped ) );
+    return queue.enqueueUnmapMemObject( _buffer, mapped, nullptr, event );
+}
+
+cl_int Mask::enqueueCopyTo( const cl::CommandQueue& queue, const Mask& dest, cl::Event* event ) const
+{
+    if( dest._format != _format || dest._dims != _dims ) {
+        return CL_INVALID_VALUE;
+    }
+    return queue.enqueueCopyBuffer( _buffer, dest._buffer, 0, 0, numBytes( _format, _dims ), nullptr, event );
+}
+
+size_t Mask::numBytes( MaskFormat format, const core::IntCoord& dims )
+{
+    const size_t numPixels = static_cast< size_t >( dims.x() ) * dims.y();
+    switch( format ) {
+    case MaskFormat::Int:
+        return sizeof( cl_int ) * numPixels;
+    case MaskFormat::UChar:
+        return sizeof( cl_uchar ) * numPixels;
+    case MaskFormat::Bits:
+        return sizeof( cl_uint ) * ( ( numPixels + 31 ) / 32 );
+    }
+    return 0;
+}
+
+const char* Mask::buildOption( MaskFormat format )
+{
+    switch( format ) {
+    case MaskFormat::UChar:
+        return "-D MASK_UCHAR";
+    case MaskFormat::Bits:
+        return "-D MASK_BITS";
+    case MaskFormat::Int:
+        break;
+    }
+    return "";
+}
+
+} // openCL
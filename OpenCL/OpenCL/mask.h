@@ -0,0 +1,58 @@
+#ifndef OPENCL_MASK_H
+#define OPENCL_MASK_H
+
+#include <OpenCL/opencltypes.h>
+
+#include <Core/image/imagetypes.h>
+#include <Core/image/imageview.h>
+#include <Core/utility/intcoord.h>
+
+namespace openCL {
+
+/// How a Mask stores its pixels.
+enum class MaskFormat
+{
+    /// One cl_int per pixel.
+    Int,
+    /// One cl_uchar per pixel.
+    UChar,
+    /// 32 pixels per cl_uint, pixel i in bit i % 32 of word i / 32.
+    Bits
+};
+
+/// A binary image in an OpenCL buffer, row major, in one of the MaskFormats. The kernel side of
+/// this is mask.h, whose MASK_RO/MASK_WO parameters and readMask()/writeMask() match whichever
+/// format the program was built for (see buildOption()).
+class Mask
+{
+public:
+    Mask(
+        const cl::Context& context,
+        MaskFormat format,
+        cl_mem_flags flags,
+        const core::IntCoord& dims,
+        cl_int* error = nullptr );
+
+    const cl::Buffer& buffer() const;
+    const core::IntCoord& dims() const;
+    MaskFormat format() const;
+
+    /// 'image' must be dims() in size. Returns once 'image' has been packed straight into the
+    /// mapped buffer; any copy to the device is left enqueued. 'event', here and below,
+    /// receives the event of the transfer.
+    cl_int enqueueWrite( const cl::CommandQueue& queue, const core::ImageBinaryView& image, cl::Event* event = nullptr );
+    /// 'dest' must have the same dimensions and format as 'this'.
+    cl_int enqueueCopyTo( const cl::CommandQueue& queue, const Mask& dest, cl::Event* event = nullptr ) const;
+
+    static size_t numBytes( MaskFormat format, const core::IntCoord& dims );
+    /// The program build option that selects 'format' in mask.h; empty for the default, Int.
+    static const char* buildOption( MaskFormat format );
+private:
+    MaskFormat _format;
+    core::IntCoord _dims;
+    cl::Buffer _buffer;
+};
+
+} // openCL
+
+#endif // #include
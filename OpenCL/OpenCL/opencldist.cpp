@@ -46,24 +46,10 @@ void OpenCLDist::distMap(const core::ImageBinary& distTo, core::ImageScalar& sto
     const CLSizeCoords3 region{ width, height, 1 };
 
     //Create the shape map in OpenCL memory
-    const cl::Buffer shapeMap(
-        _context,
-        CL_MEM_READ_WRITE,
-        sizeof(cl_int) * width * height,
-        0,
-        &error);
-    auto shapeInputArray = OpenCLGPUHost::arrayFromBoolImage(distTo);
-    error = _commandQueue.enqueueWriteBuffer(
-        shapeMap,
-        CL_FALSE,
-        0,
-        ( sizeof(cl_int) ) * width * height,
-        shapeInputArray.get(),
-        0,
-        0);
+    Mask shapeMap(_context, _maskFormat, CL_MEM_READ_ONLY, distTo.size(), &error);
+    error = shapeMap.enqueueWrite(_commandQueue, distTo);
 
-    // Create the dist maps: two float arrays (for double buffering) and one int array to represent
-    // our binary "dist to" image.
+    // Create the dist maps: two float arrays (for double buffering).
     std::array< cl::Buffer, 2 > distMaps;
     std::fill(
         distMaps.begin(),
@@ -71,27 +57,25 @@ void OpenCLDist::distMap(const core::ImageBinary& distTo, core::ImageScalar& sto
         cl::Buffer(_context, CL_MEM_READ_WRITE, sizeof(cl_float) * width * height, 0, &error));
 
     //initial fill the distance map
-    error = _initKernel.setArg(0,shapeMap);
+    error = _initKernel.setArg(0,shapeMap.buffer());
     error = _initKernel.setArg(1,distMaps[readIndex]);
     error = _initKernel.setArg(2,(cl_float)inShapeDist);
-    error = _commandQueue.enqueueNDRangeKernel(_initKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(width,height),
-                                               cl::NullRange);
+    error = _initKernel.setArg(3,(cl_int)width);
+    error = _initKernel.setArg(4,(cl_int)height);
+    error = enqueueKernel(_initKernel, distTo.size());
 
     //now compute the distance map with jumpflood
     int k = core::mathUtility::jumpfloodInitialK(width,height);
 
     while(k>0)
     {
-        error = _stepKernel.setArg(0,shapeMap);
+        error = _stepKernel.setArg(0,shapeMap.buffer());
         error = _stepKernel.setArg(1,distMaps[readIndex]);
         error = _stepKernel.setArg(2,distMaps[!readIndex]);
         error = _stepKernel.setArg(3,(cl_int)k);
-        error = _commandQueue.enqueueNDRangeKernel(_stepKernel,
-                                                   cl::NullRange,
-                                                   cl::NDRange(width,height),
-                                                   cl::NullRange);
+        error = _stepKernel.setArg(4,(cl_int)width);
+        error = _stepKernel.setArg(5,(cl_int)height);
+        error = enqueueKernel(_stepKernel, distTo.size());
         //swap buffers
         readIndex=!readIndex;
         k/=2;
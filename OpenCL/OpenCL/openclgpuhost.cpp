@@ -1,34 +1,85 @@
 #include <OpenCL/openclgpuhost.h>
 
 #include <OpenCL/device.h>
+#include <OpenCL/runtime.h>
 
 #include <Core/exceptions/runtimeerror.h>
-#include <Core/utility/twodarray.h>
-#include <Core/utility/vector3.h>
 
 #include <sstream>
-#include <fstream>
 
 namespace openCL {
 
-OpenCLGPUHost::OpenCLGPUHost( const Device& d )
-    : _devices{ d.device() }
+namespace {
+const char* const programDirectory = "runtimeResources/openCLPrograms";
+} // unnamed
+
+OpenCLGPUHost::OpenCLGPUHost( const Device& d, MaskFormat maskFormat, RGBFormat rgbFormat )
+    : OpenCLGPUHost( std::vector< Device >{ d }, maskFormat, rgbFormat )
 {
-    cl_int error = 0;
-    _context = cl::Context( _devices, 0, 0, 0, &error );
-    if (error != CL_SUCCESS)
+}
+
+OpenCLGPUHost::OpenCLGPUHost( const std::vector< Device >& devices, MaskFormat maskFormat, RGBFormat rgbFormat )
+    : _useImageBuffers( false )
+    , _useHostMappedImages( true )
+    , _maskFormat( maskFormat )
+    , _rgbFormat( rgbFormat )
+    , _queueProperties( 0 )
+    , _profile( nullptr )
+    , _recording( nullptr )
+{
+    if( devices.empty() )
     {
-        THROW_RUNTIME( "Failed to create OpenCL context" );
+        THROW_RUNTIME( "No OpenCL devices given" );
+    }
+    for( const auto& d : devices )
+    {
+        _devices.push_back( d.device() );
+        _workGroupTuners.emplace_back( d );
+        _useImageBuffers = _useImageBuffers || ( d.type() & CL_DEVICE_TYPE_CPU ) || !d.supportsImages();
+        _useHostMappedImages = _useHostMappedImages && d.hostUnifiedMemory();
     }
-    _commandQueue = cl::CommandQueue( _context, _devices.front(), 0, &error);
+
+    cl_int error = 0;
+    _context = Runtime::instance().context( _devices, &error );
     if (error != CL_SUCCESS)
     {
-        THROW_RUNTIME( "Failed to make OpenCL command queue" );
+        THROW_RUNTIME( "Failed to create OpenCL context" );
     }
+    acquireQueues();
 }
 
 OpenCLGPUHost::~OpenCLGPUHost()
 {    
+    releaseQueues();
+}
+
+void OpenCLGPUHost::acquireQueues()
+{
+    for( size_t i = 0; i < _devices.size(); i++ )
+    {
+        cl_int error = CL_SUCCESS;
+        const auto queue = Runtime::instance().acquireQueue( _devices, i, _queueProperties, &error );
+        if (error != CL_SUCCESS)
+        {
+            releaseQueues();
+            THROW_RUNTIME( "Failed to make OpenCL command queue" );
+        }
+        _deviceQueues.push_back( queue );
+    }
+    _commandQueue = _deviceQueues.front();
+}
+
+void OpenCLGPUHost::releaseQueues()
+{
+    // The next host to get a queue must not inherit our work.
+    for( size_t i = 0; i < _deviceQueues.size(); i++ )
+    {
+        if( _deviceQueues[ i ].finish() == CL_SUCCESS )
+        {
+            Runtime::instance().releaseQueue( _devices, i, _queueProperties, _deviceQueues[ i ] );
+        }
+    }
+    _deviceQueues.clear();
 }
 
 CLSizeCoords3 OpenCLGPUHost::getImageReadWriteCoord(int x, int y, int z)
@@ -46,95 +97,152 @@ void OpenCLGPUHost::buildProgramFromFile( const std::string& fileName, cl::Progr
     buildLog="";
 
     std::ostringstream stringStream;
-    stringStream << "runtimeResources/openCLPrograms/"; 
+    stringStream << programDirectory << "/";
     stringStream << fileName;
     std::string fullPath = stringStream.str();
 
-    std::ifstream file(fullPath);
-    std::string sourceCode(std::istreambuf_iterator<char>(file),(std::istreambuf_iterator<char>()));
-    if(sourceCode.empty())
+    std::string options = std::string( "-I " ) + programDirectory;
+    if(_useImageBuffers)
     {
-        THROW_RUNTIME( "OpenCL source file was empty" );
+        options += " -D RGB_IMAGE_BUFFERS";
+        const std::string rgbOption = RGBImage::buildOption(_rgbFormat);
+        if(!rgbOption.empty())
+        {
+            options += " " + rgbOption;
+        }
     }
-    const cl::Program::Sources source{ sourceCode };
-    file.close();
-
-    cl_int error=0;
-    program = cl::Program(_context,source,&error);
-    if(error!=CL_SUCCESS)
+    const std::string maskOption = Mask::buildOption(_maskFormat);
+    if(!maskOption.empty())
     {
-        buildLog = "Failed to construct the program object";
-        return;
+        options += " " + maskOption;
     }
-    error = program.build(_devices); //returns CL_BUILD_PROGRAM_FAILURE
-    if(error!=CL_SUCCESS)
-    {
-        buildLog = program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(_devices[0],&error);
+    program = Runtime::instance().program(_devices, fullPath, options, success, buildLog);
+}
+
+cl_int OpenCLGPUHost::enqueueKernel(
+    cl::Kernel& kernel,
+    const core::IntCoord& dims,
+    const WorkGroupTuner::PrepareLocal& prepare,
+    const WorkGroupTuner::Buffers& inPlaceBuffers )
+{
+    return enqueueKernel( 0, kernel, core::IntCoord( 0, 0 ), dims, prepare, inPlaceBuffers );
+}
+
+cl_int OpenCLGPUHost::enqueueKernel(
+    size_t deviceIndex,
+    cl::Kernel& kernel,
+    const core::IntCoord& offset,
+    const core::IntCoord& dims,
+    const WorkGroupTuner::PrepareLocal& prepare,
+    const WorkGroupTuner::Buffers& inPlaceBuffers )
+{
+    if( _recording && deviceIndex != 0 ) {
+        return CL_INVALID_OPERATION;
     }
-    else
-    {
-        success=true;
+    core::IntCoord localDims;
+    const auto name = _profile ? kernel.getInfo< CL_KERNEL_FUNCTION_NAME >() : std::string();
+    const cl_int error = _workGroupTuners[ deviceIndex ].enqueue( 
+        _deviceQueues[ deviceIndex ], 
+        kernel, 
+        dims, 
+        prepare, 
+        &localDims, 
+        offset,
+        profileEvent( name ),
+        inPlaceBuffers );
+    if( error != CL_SUCCESS || !_recording ) {
+        return checkError( name, error );
     }
-
+    return recordLaunch( kernel, offset, dims, localDims );
 }
 
-std::unique_ptr< cl_int[] > OpenCLGPUHost::arrayFromBoolImage( const core::ImageBinary& boolImage ) 
+cl_int OpenCLGPUHost::enqueueCommand( const CommandRecording::Command& command, const std::string& name )
 {
-    int width=boolImage.width(), height=boolImage.height();
-    auto array = std::make_unique< cl_int[] >( width * height );
-    for(int y=0; y<height; y++)
-    {
-        for(int x=0; x<width; x++)
-        {
-            int idx = y*width+x;
-            array[idx] = boolImage.get(x,y);
-        }
+    const cl_int error = command( _commandQueue, profileEvent( name ) );
+    if( error == CL_SUCCESS && _recording ) {
+        _recording->append( command );
     }
-    return array;
+    return checkError( name, error );
 }
 
-std::unique_ptr< cl_float4[] > OpenCLGPUHost::arrayFromRGBImage( const core::ImageRGB& rgbImage )
+void OpenCLGPUHost::setProfile( Profile* profile )
 {
-    //row major
-    const auto width = rgbImage.width();
-    const auto height = rgbImage.height();
-    auto array = std::make_unique< cl_float4[] >( width * height );
-    for(int y=0; y<height; y++)
-    {
-        for(int x=0; x<width; x++)
-        {
-            core::Vector3 rgb = rgbImage.get(x,y);
-            const auto idx=y*width+x;
-            array[ idx ].s[0] = (float)rgb.r();
-            array[ idx ].s[1] = (float)rgb.g();
-            array[ idx ].s[2] = (float)rgb.b();
-            array[ idx ].s[3] = 0.0;
-        }
+    const cl_command_queue_properties properties = profile ? CL_QUEUE_PROFILING_ENABLE : 0;
+    if( properties != _queueProperties ) {
+        releaseQueues();
+        _queueProperties = properties;
+        acquireQueues();
     }
-    return array;
+    _profile = profile;
 }
 
-void OpenCLGPUHost::rgbImageFromArray( core::ImageRGB& rgbImage, const core::IntCoord& dims, cl_float4* array)
+Profile* OpenCLGPUHost::profile() const
 {
-    if(rgbImage.size()!=dims)
-    {
-        rgbImage.recreate(dims.x(),dims.y());
+    return _profile;
+}
+
+cl::Event* OpenCLGPUHost::profileEvent( const std::string& name )
+{
+    return _profile ? _profile->addEvent( name ) : nullptr;
+}
+
+cl_int OpenCLGPUHost::checkError( const std::string& name, cl_int error )
+{
+    if( error != CL_SUCCESS && _profile ) {
+        _profile->addError( name, error );
     }
+    return error;
+}
 
-    int width=dims.x(), height=dims.y();
+void OpenCLGPUHost::setRecording( CommandRecording* recording )
+{
+    _recording = recording;
+    _recordedKernelArgs.clear();
+}
 
-    //row major
-    for(int y=0; y<height; y++)
-    {
-        for(int x=0; x<width; x++)
-        {
-            int idx = y*width+x;
-            float r = array[ idx ].s[0];
-            float g = array[ idx ].s[1];
-            float b = array[ idx ].s[2];
-            rgbImage.set(x,y,core::Vector3((double)r,(double)g,(double)b));
+bool OpenCLGPUHost::isRecording() const
+{
+    return _recording != nullptr;
+}
+
+cl_int OpenCLGPUHost::recordLaunch(
+    const cl::Kernel& kernel,
+    const core::IntCoord& offset,
+    const core::IntCoord& dims,
+    const core::IntCoord& localDims )
+{
+    cl_int error = CL_SUCCESS;
+    const auto program = kernel.getInfo< CL_KERNEL_PROGRAM >( &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    const auto name = kernel.getInfo< CL_KERNEL_FUNCTION_NAME >( &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    const auto numArgs = kernel.getInfo< CL_KERNEL_NUM_ARGS >( &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    const auto& args = _recordedKernelArgs[ kernel() ];
+    if( args.size() != numArgs ) {
+        return CL_INVALID_KERNEL_ARGS;
+    }
+
+    cl::Kernel launchKernel( program, name.c_str(), &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    for( const auto& arg : args ) {
+        error = arg.second( launchKernel );
+        if( error != CL_SUCCESS ) {
+            return error;
         }
     }
+    _recording->append( [ launchKernel, offset, dims, localDims ]( const cl::CommandQueue& queue, cl::Event* event ) {
+        return WorkGroupTuner::launch( queue, launchKernel, dims, localDims, offset, event );
+    } );
+    return CL_SUCCESS;
 }
 
 } // openCL
@@ -3,8 +3,14 @@
 
 #include <Core/image/imagetypes.h>
 
+#include <OpenCL/commandrecording.h>
+#include <OpenCL/mask.h>
 #include <OpenCL/opencltypes.h>
+#include <OpenCL/profile.h>
+#include <OpenCL/rgbimage.h>
+#include <OpenCL/workgrouptuner.h>
 
+#include <map>
 #include <memory>
 #include <vector>
 
@@ -20,12 +26,26 @@ namespace openCL {
 
 class Device;
 
-/// A single-device OpenCL host program.
+/// An OpenCL host program on one device, or on several sharing one context. The context, queues
+/// and programs are borrowed from Runtime, so hosts are cheap to create once their devices and
+/// programs have been used.
 class OpenCLGPUHost
 {
 public:
-    ///  'device' must refer to a valid OpenCL device on this machine.
-    explicit OpenCLGPUHost( const Device& device );
+    ///  'device' must refer to a valid OpenCL device on this machine. Programs are built for
+    ///  masks in 'maskFormat' and RGB images in 'rgbFormat', which Masks and RGBImages made by
+    ///  this host should use.
+    explicit OpenCLGPUHost(
+        const Device& device,
+        MaskFormat maskFormat = MaskFormat::UChar,
+        RGBFormat rgbFormat = RGBFormat::Float );
+    ///  The same for one context over 'devices', which must be non-empty and all belong to one
+    ///  platform (for instance sub-devices from Device::split()). Each device gets a queue of
+    ///  its own; the first device's is _commandQueue.
+    explicit OpenCLGPUHost(
+        const std::vector< Device >& devices,
+        MaskFormat maskFormat = MaskFormat::UChar,
+        RGBFormat rgbFormat = RGBFormat::Float );
     OpenCLGPUHost( const OpenCLGPUHost& ) = delete;
     OpenCLGPUHost& operator = (const OpenCLGPUHost&) = delete;
     virtual ~OpenCLGPUHost();
@@ -37,22 +57,108 @@ protected:
     //cl::Program object created inside  the method had already been destroyed by the time
     //the caller got a copy of it.  Remember that cl::X is a _wrapper_ around an X handle.  It is
     //not itself an X handle.
+    //Programs are built with the program directory on the include path, with
+    //RGB_IMAGE_BUFFERS and _rgbFormat's define when _useImageBuffers is set (see rgbImage.h)
+    //and with _maskFormat's define (see mask.h).
+    //Each program is only built the first time any host on the same devices asks for it with
+    //the same options (see Runtime).
     void buildProgramFromFile(const std::string& fileName, cl::Program& program, bool& success, std::string& buildLog);
 
-    //utilities for getting our image types into
-    //and out of OpenCL domain.  Note use of cl_float4 instead of cl_float3.  Internally,
-    //we only use CL_RGBA, never CL_RGB.  This is because CL_RGB cannot be used with CL_FLOAT
-    // (see http://www.khronos.org/registry/cl/sdk/1.0/docs/man/xhtml/cl_image_format.html).
-    static std::unique_ptr< cl_float4[] > arrayFromRGBImage(const core::ImageRGB& rgbImage);
-    static void rgbImageFromArray(core::ImageRGB& rgbImage, const core::IntCoord& dims, cl_float4* array);
-    static std::unique_ptr< cl_int[] > arrayFromBoolImage(const core::ImageBinary& boolImage);    
+    /// Enqueue 'kernel' over a 'dims'-sized 2D domain with a tuned local size (see WorkGroupTuner).
+    /// The global size may be padded, so 'kernel' must ignore work-items outside 'dims'.
+    /// When recording, all of 'kernel's arguments must have been set with setKernelArg().
+    /// 'inPlaceBuffers' are the buffers 'kernel' updates in place (see WorkGroupTuner::enqueue()).
+    cl_int enqueueKernel(
+        cl::Kernel& kernel,
+        const core::IntCoord& dims,
+        const WorkGroupTuner::PrepareLocal& prepare = nullptr,
+        const WorkGroupTuner::Buffers& inPlaceBuffers = WorkGroupTuner::Buffers() );
+    /// Enqueue 'kernel' on device 'deviceIndex's queue over the 'dims'-sized domain starting at
+    /// 'offset', tuned for that device. Only the first device's launches can be recorded.
+    cl_int enqueueKernel(
+        size_t deviceIndex,
+        cl::Kernel& kernel,
+        const core::IntCoord& offset,
+        const core::IntCoord& dims,
+        const WorkGroupTuner::PrepareLocal& prepare = nullptr,
+        const WorkGroupTuner::Buffers& inPlaceBuffers = WorkGroupTuner::Buffers() );
+    /// Enqueue 'command' on _commandQueue, and append it to the recording if there is one.
+    /// 'name' identifies it in profiles.
+    cl_int enqueueCommand( const CommandRecording::Command& command, const std::string& name = "command" );
+
+    /// While 'recording' is non-null, what enqueueKernel() and enqueueCommand() enqueue is also
+    /// appended to it. Recorded launches get kernel objects of their own, with the arguments
+    /// the launched kernel had at the time, so they replay unaffected by later setKernelArg()
+    /// calls. Commands enqueued on _commandQueue directly are not recorded.
+    void setRecording( CommandRecording* recording );
+    bool isRecording() const;
+    /// kernel.setArg( index, value ), remembered for recording.
+    template< typename T >
+    cl_int setKernelArg( cl::Kernel& kernel, cl_uint index, const T& value );
+
+    /// While 'profile' is non-null, the queues have CL_QUEUE_PROFILING_ENABLE, and every launch
+    /// through enqueueKernel() and command through enqueueCommand() adds its event to 'profile',
+    /// as does every failed setKernelArg() or enqueue its error. Switching profiling on or off
+    /// finishes the queues and swaps them for ones with or without profiling.
+    void setProfile( Profile* profile );
+    Profile* profile() const;
+    /// An event for a command named 'name' to pass to an enqueue call on a queue directly,
+    /// so that the command is profiled; null when not profiling.
+    cl::Event* profileEvent( const std::string& name );
+    /// Note 'error', if it is one, in the profile as the error of 'name'; returns 'error'.
+    cl_int checkError( const std::string& name, cl_int error );
+
     static CLSizeCoords3 getImageReadWriteCoord(int x, int y, int z);
 
     std::vector< cl::Device > _devices;
     cl::Context _context;
     cl::CommandQueue _commandQueue;
+    /// One per device, in _devices' order.
+    std::vector< cl::CommandQueue > _deviceQueues;
+    std::vector< WorkGroupTuner > _workGroupTuners;
+    /// Keep RGB images in plain buffers rather than OpenCL images. Set if any device is a CPU,
+    /// whose image sampling is emulated and slow, or lacks image support.
+    bool _useImageBuffers;
+    /// Allocate RGB images in host memory and map them for transfers (see RGBImage). Set if
+    /// all devices share memory with the host; others transfer through pinned staging buffers.
+    bool _useHostMappedImages;
+    MaskFormat _maskFormat;
+    RGBFormat _rgbFormat;
+private:
+    /// Fill _deviceQueues from Runtime, with _queueProperties.
+    void acquireQueues();
+    /// Finish _deviceQueues and give them back to Runtime.
+    void releaseQueues();
+    /// Append a copy of 'kernel', with its remembered arguments, launched as WorkGroupTuner::launch()
+    /// would with 'localDims'.
+    cl_int recordLaunch(
+        const cl::Kernel& kernel,
+        const core::IntCoord& offset,
+        const core::IntCoord& dims,
+        const core::IntCoord& localDims );
+
+    cl_command_queue_properties _queueProperties;
+    Profile* _profile;
+    CommandRecording* _recording;
+    /// Per kernel, the arguments set through setKernelArg() while recording.
+    std::map< cl_kernel, std::map< cl_uint, std::function< cl_int( cl::Kernel& ) > > > _recordedKernelArgs;
 };
 
+template< typename T >
+cl_int OpenCLGPUHost::setKernelArg( cl::Kernel& kernel, cl_uint index, const T& value )
+{
+    if( _recording ) {
+        _recordedKernelArgs[ kernel() ][ index ] = [ index, value ]( cl::Kernel& k ) {
+            return k.setArg( index, value );
+        };
+    }
+    const cl_int error = kernel.setArg( index, value );
+    if( error != CL_SUCCESS && _profile ) {
+        _profile->addError( kernel.getInfo< CL_KERNEL_FUNCTION_NAME >() + " argument", error );
+    }
+    return error;
+}
+
 } // openCL
 
 #endif // #include guard
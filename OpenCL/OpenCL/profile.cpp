@@ -0,0 +1,101 @@
+#include <OpenCL/profile.h>
+
+#include <algorithm>
+#include <iomanip>
+
+namespace openCL {
+
+namespace {
+
+const double msPerNs = 1e-6;
+
+template< typename Key >
+void printTable( std::ostream& stream, const char* title, const std::map< Key, ProfileTimes >& rows )
+{
+    std::vector< std::pair< Key, ProfileTimes > > sorted( rows.begin(), rows.end() );
+    std::sort( sorted.begin(), sorted.end(), []( const auto& a, const auto& b ) {
+        return a.second.runningMs > b.second.runningMs;
+    } );
+
+    stream << title << "\n";
+    stream << std::setw( 32 ) << "" << std::setw( 8 ) << "count" << std::setw( 14 ) << "queued ms"
+           << std::setw( 14 ) << "submitted ms" << std::setw( 14 ) << "running ms" << "\n";
+    for( const auto& row : sorted ) {
+        stream << std::setw( 32 ) << row.first << std::setw( 8 ) << row.second.count
+               << std::setw( 14 ) << row.second.queuedMs << std::setw( 14 ) << row.second.submittedMs
+               << std::setw( 14 ) << row.second.runningMs << "\n";
+    }
+}
+
+} // unnamed
+
+void ProfileTimes::add( const ProfileTimes& times )
+{
+    count += times.count;
+    queuedMs += times.queuedMs;
+    submittedMs += times.submittedMs;
+    runningMs += times.runningMs;
+}
+
+void ProfileReport::print( std::ostream& stream ) const
+{
+    const auto flags = stream.flags();
+    stream << std::fixed << std::setprecision( 3 );
+    printTable( stream, "By command", byCommand );
+    printTable( stream, "By step", byStep );
+    printTable( stream, "By pyramid level", byLevel );
+    stream << "Total: " << total.count << " commands, " << total.runningMs << " ms running\n";
+    for( const auto& error : errors ) {
+        stream << "Error " << error.second << " in " << error.first << "\n";
+    }
+    stream.flags( flags );
+}
+
+void Profile::setStep( const std::string& step )
+{
+    _step = step;
+}
+
+void Profile::setLevel( int level )
+{
+    _level = level;
+}
+
+cl::Event* Profile::addEvent( const std::string& command )
+{
+    _entries.push_back( Entry{ command, _step, _level, cl::Event() } );
+    return &_entries.back().event;
+}
+
+void Profile::addError( const std::string& command, cl_int error )
+{
+    _errors.emplace_back( command, error );
+}
+
+ProfileReport Profile::report() const
+{
+    ProfileReport result;
+    result.errors = _errors;
+    for( const auto& entry : _entries ) {
+        if( !entry.event() || entry.event.wait() != CL_SUCCESS ) {
+            continue;
+        }
+        const cl_ulong queued = entry.event.getProfilingInfo< CL_PROFILING_COMMAND_QUEUED >();
+        const cl_ulong submit = entry.event.getProfilingInfo< CL_PROFILING_COMMAND_SUBMIT >();
+        const cl_ulong start = entry.event.getProfilingInfo< CL_PROFILING_COMMAND_START >();
+        const cl_ulong end = entry.event.getProfilingInfo< CL_PROFILING_COMMAND_END >();
+
+        ProfileTimes times;
+        times.count = 1;
+        times.queuedMs = ( submit - queued ) * msPerNs;
+        times.submittedMs = ( start - submit ) * msPerNs;
+        times.runningMs = ( end - start ) * msPerNs;
+        result.byCommand[ entry.command ].add( times );
+        result.byStep[ entry.step ].add( times );
+        result.byLevel[ entry.level ].add( times );
+        result.total.add( times );
+    }
+    return result;
+}
+
+} // openCL
@@ -0,0 +1,78 @@
+#ifndef OPENCL_PROFILE_H
+#define OPENCL_PROFILE_H
+
+#include <CL/cl.hpp>
+
+#include <deque>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace openCL {
+
+/// Device time spent on one or more commands, in milliseconds, summed over them.
+struct ProfileTimes
+{
+    int count = 0;
+    /// From being enqueued (CL_PROFILING_COMMAND_QUEUED) to being submitted to the device.
+    double queuedMs = 0;
+    /// From submission to starting to run.
+    double submittedMs = 0;
+    /// From starting to ending.
+    double runningMs = 0;
+
+    void add( const ProfileTimes& times );
+};
+
+/// The timings of a profiled run (see Profile), summed per command, per step and per pyramid
+/// level. Commands are named by their kernel function, or by the kind of transfer.
+struct ProfileReport
+{
+    std::map< std::string, ProfileTimes > byCommand;
+    std::map< std::string, ProfileTimes > byStep;
+    std::map< int, ProfileTimes > byLevel;
+    ProfileTimes total;
+    /// The commands that failed to be set up or enqueued, in order, with their error codes.
+    std::vector< std::pair< std::string, cl_int > > errors;
+
+    /// One table per grouping, slowest first.
+    void print( std::ostream& stream ) const;
+};
+
+/// Collects the events of the commands of one run on queues with CL_QUEUE_PROFILING_ENABLE,
+/// tagged with the step and pyramid level that were current when each was added.
+class Profile
+{
+public:
+    /// Tag the events added from now on.
+    void setStep( const std::string& step );
+    void setLevel( int level );
+
+    /// A new event for a command named 'command', for the caller to pass to the enqueue call.
+    /// Stays valid as long as this Profile does. Events the enqueue never sets are skipped.
+    cl::Event* addEvent( const std::string& command );
+    void addError( const std::string& command, cl_int error );
+
+    /// Waits for every event to complete.
+    ProfileReport report() const;
+private:
+    struct Entry
+    {
+        std::string command;
+        std::string step;
+        int level;
+        cl::Event event;
+    };
+
+    /// A deque so that the events handed out do not move.
+    std::deque< Entry > _entries;
+    std::vector< std::pair< std::string, cl_int > > _errors;
+    std::string _step;
+    int _level = -1;
+};
+
+} // openCL
+
+#endif // #include
@@ -0,0 +1,276 @@
+#include <OpenCL/rgbimage.h>
+
+#include <OpenCL/hostconversion.h>
+
+#include <Core/utility/twodarray.h>
+#include <Core/utility/vector3.h>
+
+#include <cstdint>
+
+namespace openCL {
+
+namespace {
+
+cl_channel_type channelType( RGBFormat format )
+{
+    switch( format ) {
+    case RGBFormat::Half:
+        return CL_HALF_FLOAT;
+    case RGBFormat::UNorm8:
+        return CL_UNORM_INT8;
+    case RGBFormat::Float:
+        break;
+    }
+    return CL_FLOAT;
+}
+
+CLSizeCoords3 originCoord()
+{
+    CLSizeCoords3 coord;
+    coord[ 0 ] = 0;
+    coord[ 1 ] = 0;
+    coord[ 2 ] = 0;
+    return coord;
+}
+
+CLSizeCoords3 regionCoord( const core::IntCoord& dims )
+{
+    CLSizeCoords3 coord;
+    coord[ 0 ] = dims.x();
+    coord[ 1 ] = dims.y();
+    coord[ 2 ] = 1;
+    return coord;
+}
+
+} // unnamed
+
+RGBImage::RGBImage(
+    const cl::Context& context,
+    bool asBuffer,
+    RGBFormat format,
+    bool hostMapped,
+    cl_mem_flags flags,
+    const core::IntCoord& dims,
+    cl_int* error )
+    : _isBuffer( asBuffer )
+    , _format( format )
+    , _hostMapped( hostMapped )
+    , _dims( dims )
+    , _context( context )
+{
+    if( _hostMapped ) {
+        flags |= CL_MEM_ALLOC_HOST_PTR;
+    }
+    if( _isBuffer ) {
+        _buffer = cl::Buffer( context, flags, numBytes(), nullptr, error );
+    } else {
+        _image = cl::Image2D(
+            context,
+            flags,
+            cl::ImageFormat( CL_RGBA, channelType( format ) ),
+            dims.x(),
+            dims.y(),
+            0,
+            nullptr,
+            error );
+    }
+}
+
+const cl::Memory& RGBImage::memory() const
+{
+    if( _isBuffer ) {
+        return _buffer;
+    }
+    return _image;
+}
+
+const core::IntCoord& RGBImage::dims() const
+{
+    return _dims;
+}
+
+bool RGBImage::isBuffer() const
+{
+    return _isBuffer;
+}
+
+RGBFormat RGBImage::format() const
+{
+    return _format;
+}
+
+size_t RGBImage::rowBytes() const
+{
+    return bytesPerPixel( _format ) * _dims.x();
+}
+
+size_t RGBImage::numBytes() const
+{
+    return rowBytes() * _dims.y();
+}
+
+void* RGBImage::map( const cl::CommandQueue& queue, cl_map_flags flags, size_t& rowPitch, cl_int* error, cl::Event* event ) const
+{
+    if( _isBuffer ) {
+        rowPitch = rowBytes();
+        return queue.enqueueMapBuffer( _buffer, CL_TRUE, flags, 0, numBytes(), nullptr, event, error );
+    }
+    size_t slicePitch = 0;
+    return queue.enqueueMapImage( 
+        _image, 
+        CL_TRUE, 
+        flags, 
+        originCoord(), 
+        regionCoord( _dims ), 
+        &rowPitch, 
+        &slicePitch, 
+        nullptr, 
+        event, 
+        error );
+}
+
+cl_int RGBImage::createStaging()
+{
+    if( _staging() ) {
+        return CL_SUCCESS;
+    }
+    // Host-allocated, so the device copies to and from it directly (it is pinned), and the
+    // host maps it without a copy.
+    cl_int error = CL_SUCCESS;
+    _staging = cl::Buffer( _context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, numBytes(), nullptr, &error );
+    return error;
+}
+
+cl_int RGBImage::enqueueWrite( const cl::CommandQueue& queue, const core::ImageRGBView& image, cl::Event* event )
+{
+    if( image.size() != _dims ) {
+        return CL_INVALID_VALUE;
+    }
+
+    cl_int error = CL_SUCCESS;
+    if( _hostMapped ) {
+        size_t rowPitch = 0;
+        void* mapped = map( queue, CL_MAP_WRITE, rowPitch, &error );
+        if( error != CL_SUCCESS ) {
+            return error;
+        }
+        hostConversion::packRGB( _format, image, static_cast< std::uint8_t* >( mapped ), rowPitch );
+        return queue.enqueueUnmapMemObject( memory(), mapped, nullptr, event );
+    }
+
+    error = createStaging();
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    void* mapped = queue.enqueueMapBuffer( _staging, CL_TRUE, CL_MAP_WRITE, 0, numBytes(), nullptr, nullptr, &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    hostConversion::packRGB( _format, image, static_cast< std::uint8_t* >( mapped ), rowBytes() );
+    error = queue.enqueueUnmapMemObject( _staging, mapped );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    if( _isBuffer ) {
+        return queue.enqueueCopyBuffer( _staging, _buffer, 0, 0, numBytes(), nullptr, event );
+    }
+    return queue.enqueueCopyBufferToImage( _staging, _image, 0, originCoord(), regionCoord( _dims ), nullptr, event );
+}
+
+cl_int RGBImage::read( const cl::CommandQueue& queue, core::ImageRGB& image, cl::Event* event )
+{
+    if( image.size() != _dims ) {
+        image.recreate( _dims.x(), _dims.y() );
+    }
+
+    cl_int error = CL_SUCCESS;
+    if( _hostMapped ) {
+        size_t rowPitch = 0;
+        void* mapped = map( queue, CL_MAP_READ, rowPitch, &error, event );
+        if( error != CL_SUCCESS ) {
+            return error;
+        }
+        hostConversion::unpackRGB( _format, static_cast< const std::uint8_t* >( mapped ), rowPitch, image );
+        return queue.enqueueUnmapMemObject( memory(), mapped );
+    }
+
+    error = createStaging();
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    error = _isBuffer
+        ? queue.enqueueCopyBuffer( _buffer, _staging, 0, 0, numBytes(), nullptr, event )
+        : queue.enqueueCopyImageToBuffer( _image, _staging, originCoord(), regionCoord( _dims ), 0, nullptr, event );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    void* mapped = queue.enqueueMapBuffer( _staging, CL_TRUE, CL_MAP_READ, 0, numBytes(), nullptr, nullptr, &error );
+    if( error != CL_SUCCESS ) {
+        return error;
+    }
+    hostConversion::unpackRGB( _format, static_cast< const std::uint8_t* >( mapped ), rowBytes(), image );
+    return queue.enqueueUnmapMemObject( _staging, mapped );
+}
+
+cl_int RGBImage::enqueueCopyTo( const cl::CommandQueue& queue, const RGBImage& dest, cl::Event* event ) const
+{
+    return enqueueCopyRowsTo( queue, dest, 0, _dims.y(), event );
+}
+
+cl_int RGBImage::enqueueCopyRowsTo(
+    const cl::CommandQueue& queue,
+    const RGBImage& dest,
+    int firstRow,
+    int numRows,
+    cl::Event* event ) const
+{
+    if( dest._isBuffer != _isBuffer || dest._format != _format || dest._dims != _dims 
+        || firstRow < 0 || numRows < 0 || firstRow + numRows > _dims.y() ) {
+        return CL_INVALID_VALUE;
+    }
+    if( numRows == 0 ) {
+        return CL_SUCCESS;
+    }
+    if( _isBuffer ) {
+        const size_t offset = rowBytes() * firstRow;
+        return queue.enqueueCopyBuffer( _buffer, dest._buffer, offset, offset, rowBytes() * numRows, nullptr, event );
+    }
+    auto origin = originCoord();
+    origin[ 1 ] = firstRow;
+    return queue.enqueueCopyImage( 
+        _image, 
+        dest._image, 
+        origin, 
+        origin, 
+        regionCoord( core::IntCoord( _dims.x(), numRows ) ),
+        nullptr,
+        event );
+}
+
+size_t RGBImage::bytesPerPixel( RGBFormat format )
+{
+    switch( format ) {
+    case RGBFormat::Float:
+        return 4 * sizeof( cl_float );
+    case RGBFormat::Half:
+        return 4 * sizeof( cl_half );
+    case RGBFormat::UNorm8:
+        return 4 * sizeof( cl_uchar );
+    }
+    return 0;
+}
+
+const char* RGBImage::buildOption( RGBFormat format )
+{
+    switch( format ) {
+    case RGBFormat::Half:
+        return "-D RGB_IMAGE_HALF";
+    case RGBFormat::UNorm8:
+        return "-D RGB_IMAGE_UNORM8";
+    case RGBFormat::Float:
+        break;
+    }
+    return "";
+}
+
+} // openCL
@@ -0,0 +1,96 @@
+#ifndef OPENCL_RGBIMAGE_H
+#define OPENCL_RGBIMAGE_H
+
+#include <OpenCL/opencltypes.h>
+
+#include <Core/image/imagetypes.h>
+#include <Core/image/imageview.h>
+#include <Core/utility/intcoord.h>
+
+namespace openCL {
+
+/// How an RGBImage stores each (RGBA) pixel. Kernels read and write float4 whatever the format,
+/// so the reduced formats trade precision for memory and bandwidth, not for arithmetic.
+enum class RGBFormat
+{
+    /// 4 floats; CL_FLOAT images.
+    Float,
+    /// 4 halfs; CL_HALF_FLOAT images. About 3 significant decimal digits.
+    Half,
+    /// 4 bytes mapping [0,255] to [0,1], with values outside [0,1] clamped; CL_UNORM_INT8 images.
+    /// As precise as 8-bit source images, but every write rounds to 1/255.
+    UNorm8
+};
+
+/// An RGB image in OpenCL device memory, stored either as a CL_RGBA image or as a row-major
+/// buffer, with pixels in an RGBFormat. The kernel side of this is rgbImage.h, whose
+/// RGB_IMAGE_RO/RGB_IMAGE_WO parameters accept memory() for whichever storage and format the
+/// program was built for (see buildOption()).
+///
+/// Host transfers convert between core::ImageRGB and the storage format in a single pass over
+/// host-visible memory: the image itself when it is 'hostMapped', otherwise a pinned staging
+/// buffer that the device copies to or from.
+class RGBImage
+{
+public:
+    /// 'hostMapped' allocates the image in host memory (CL_MEM_ALLOC_HOST_PTR) and maps it for
+    /// transfers, which costs no copy on devices that share memory with the host (see
+    /// Device::hostUnifiedMemory()); other devices should use the staging buffer.
+    RGBImage(
+        const cl::Context& context,
+        bool asBuffer,
+        RGBFormat format,
+        bool hostMapped,
+        cl_mem_flags flags,
+        const core::IntCoord& dims,
+        cl_int* error = nullptr );
+
+    const cl::Memory& memory() const;
+    const core::IntCoord& dims() const;
+    bool isBuffer() const;
+    RGBFormat format() const;
+
+    /// 'image' must be dims() in size. Returns once 'image' has been converted; any copy to the
+    /// device is left enqueued. An 'event', here and below, receives the event of the command
+    /// that moves the pixels to or from the device.
+    cl_int enqueueWrite( const cl::CommandQueue& queue, const core::ImageRGBView& image, cl::Event* event = nullptr );
+    /// Blocking; the pixels are converted straight into 'image', which is resized to dims() if
+    /// need be.
+    cl_int read( const cl::CommandQueue& queue, core::ImageRGB& image, cl::Event* event = nullptr );
+    /// 'dest' must have the same dimensions, storage and format as 'this'.
+    cl_int enqueueCopyTo( const cl::CommandQueue& queue, const RGBImage& dest, cl::Event* event = nullptr ) const;
+    /// Copy rows [firstRow, firstRow + numRows) into the same rows of 'dest', with the same
+    /// requirements as enqueueCopyTo().
+    cl_int enqueueCopyRowsTo(
+        const cl::CommandQueue& queue,
+        const RGBImage& dest,
+        int firstRow,
+        int numRows,
+        cl::Event* event = nullptr ) const;
+
+    static size_t bytesPerPixel( RGBFormat format );
+    /// The program build option that selects 'format' for buffers in rgbImage.h; empty for the
+    /// default, Float.
+    static const char* buildOption( RGBFormat format );
+private:
+    size_t rowBytes() const;
+    size_t numBytes() const;
+    /// Blocking map of the whole image; 'rowPitch' receives the bytes between mapped rows.
+    void* map( const cl::CommandQueue& queue, cl_map_flags flags, size_t& rowPitch, cl_int* error, cl::Event* event = nullptr ) const;
+    /// Allocate _staging if it is not already.
+    cl_int createStaging();
+
+    bool _isBuffer;
+    RGBFormat _format;
+    bool _hostMapped;
+    core::IntCoord _dims;
+    cl::Context _context;
+    cl::Image2D _image;
+    cl::Buffer _buffer;
+    /// Tightly packed rows in the storage format; only used when not _hostMapped.
+    cl::Buffer _staging;
+};
+
+} // openCL
+
+#endif // #include
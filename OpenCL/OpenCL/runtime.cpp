@@ -0,0 +1,140 @@
+#include <OpenCL/runtime.h>
+
+#include <fstream>
+#include <iterator>
+
+namespace openCL {
+
+Runtime& Runtime::instance()
+{
+    static Runtime runtime;
+    return runtime;
+}
+
+Runtime::Entry* Runtime::entry( const std::vector< cl::Device >& devices, cl_int* error )
+{
+    Key key;
+    for( const auto& device : devices ) {
+        key.push_back( device() );
+    }
+    auto found = _entries.find( key );
+    if( found != _entries.end() ) {
+        if( error ) {
+            *error = CL_SUCCESS;
+        }
+        return found->second.get();
+    }
+
+    cl_int contextError = CL_SUCCESS;
+    auto created = std::make_unique< Entry >();
+    created->context = cl::Context( devices, 0, 0, 0, &contextError );
+    if( error ) {
+        *error = contextError;
+    }
+    if( contextError != CL_SUCCESS ) {
+        return nullptr;
+    }
+    created->freeQueues.resize( devices.size() );
+    return _entries.emplace( key, std::move( created ) ).first->second.get();
+}
+
+cl::Context Runtime::context( const std::vector< cl::Device >& devices, cl_int* error )
+{
+    std::lock_guard< std::mutex > lock( _mutex );
+    const Entry* found = entry( devices, error );
+    return found ? found->context : cl::Context();
+}
+
+cl::CommandQueue Runtime::acquireQueue(
+    const std::vector< cl::Device >& devices,
+    size_t deviceIndex,
+    cl_command_queue_properties properties,
+    cl_int* error )
+{
+    std::lock_guard< std::mutex > lock( _mutex );
+    Entry* found = entry( devices, error );
+    if( !found ) {
+        return cl::CommandQueue();
+    }
+    auto& freeQueues = found->freeQueues[ deviceIndex ][ properties ];
+    if( !freeQueues.empty() ) {
+        const cl::CommandQueue queue = freeQueues.back();
+        freeQueues.pop_back();
+        return queue;
+    }
+    return cl::CommandQueue( found->context, devices[ deviceIndex ], properties, error );
+}
+
+void Runtime::releaseQueue(
+    const std::vector< cl::Device >& devices,
+    size_t deviceIndex,
+    cl_command_queue_properties properties,
+    const cl::CommandQueue& queue )
+{
+    std::lock_guard< std::mutex > lock( _mutex );
+    Entry* found = entry( devices, nullptr );
+    if( found ) {
+        found->freeQueues[ deviceIndex ][ properties ].push_back( queue );
+    }
+}
+
+cl::Program Runtime::program(
+    const std::vector< cl::Device >& devices,
+    const std::string& path,
+    const std::string& options,
+    bool& success,
+    std::string& buildLog )
+{
+    success = false;
+    buildLog = "";
+
+    // Building holds the lock, so two hosts asking for the same program build it once.
+    std::lock_guard< std::mutex > lock( _mutex );
+    Entry* found = entry( devices, nullptr );
+    if( !found ) {
+        buildLog = "Failed to create the context";
+        return cl::Program();
+    }
+    const auto key = std::make_pair( path, options );
+    const auto cached = found->programs.find( key );
+    if( cached != found->programs.end() ) {
+        success = true;
+        return cached->second;
+    }
+
+    std::ifstream file( path );
+    const std::string sourceCode( ( std::istreambuf_iterator< char >( file ) ), std::istreambuf_iterator< char >() );
+    if( sourceCode.empty() ) {
+        buildLog = "OpenCL source file was empty";
+        return cl::Program();
+    }
+    const cl::Program::Sources source{ sourceCode };
+
+    cl_int error = CL_SUCCESS;
+    cl::Program program( found->context, source, &error );
+    if( error != CL_SUCCESS ) {
+        buildLog = "Failed to construct the program object";
+        return cl::Program();
+    }
+    error = program.build( devices, options.c_str() );
+    if( error != CL_SUCCESS ) {
+        buildLog = program.getBuildInfo< CL_PROGRAM_BUILD_LOG >( devices[ 0 ], &error );
+        return cl::Program();
+    }
+    found->programs.emplace( key, program );
+    success = true;
+    return program;
+}
+
+void Runtime::clear()
+{
+    std::lock_guard< std::mutex > lock( _mutex );
+    for( auto& found : _entries ) {
+        found.second->programs.clear();
+        for( auto& freeQueues : found.second->freeQueues ) {
+            freeQueues.clear();
+        }
+    }
+}
+
+} // openCL
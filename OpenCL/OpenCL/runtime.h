@@ -0,0 +1,82 @@
+#ifndef OPENCL_RUNTIME_H
+#define OPENCL_RUNTIME_H
+
+#include <CL/cl.hpp>
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace openCL {
+
+/// The process-wide OpenCL objects that hosts (see OpenCLGPUHost) borrow instead of creating
+/// their own: per set of devices, one context, a pool of command queues for each device and the
+/// programs built so far. Creating a host on devices that have been used before then costs no
+/// context creation or program build. Thread-safe.
+///
+/// Kernels are not shared: they carry their arguments, so each host creates its own from the
+/// shared programs, which is cheap.
+class Runtime
+{
+public:
+    static Runtime& instance();
+
+    /// The context over exactly 'devices', in that order; created on first use.
+    cl::Context context( const std::vector< cl::Device >& devices, cl_int* error = nullptr );
+    /// A queue on 'devices'[ 'deviceIndex' ] in context( 'devices' ), with 'properties', that no
+    /// other host holds, taken from the pool or created. Return it with releaseQueue() when
+    /// done with it.
+    cl::CommandQueue acquireQueue(
+        const std::vector< cl::Device >& devices,
+        size_t deviceIndex,
+        cl_command_queue_properties properties = 0,
+        cl_int* error = nullptr );
+    /// Put 'queue', from acquireQueue() with the same arguments, back into the pool. The caller
+    /// must have finished it.
+    void releaseQueue(
+        const std::vector< cl::Device >& devices,
+        size_t deviceIndex,
+        cl_command_queue_properties properties,
+        const cl::CommandQueue& queue );
+
+    /// The program at 'path' built for 'devices' with 'options', built on first use. On
+    /// failure, 'success' is false and 'buildLog' says why, and the next call tries again.
+    cl::Program program(
+        const std::vector< cl::Device >& devices,
+        const std::string& path,
+        const std::string& options,
+        bool& success,
+        std::string& buildLog );
+
+    /// Drop the built programs and idle queues, so programs are rebuilt from disk on next use.
+    /// Contexts are kept, since hosts' queues belong to them.
+    void clear();
+private:
+    Runtime() = default;
+    Runtime( const Runtime& ) = delete;
+    Runtime& operator = ( const Runtime& ) = delete;
+
+    struct Entry
+    {
+        cl::Context context;
+        /// Idle queues, per device and by properties.
+        std::vector< std::map< cl_command_queue_properties, std::vector< cl::CommandQueue > > > freeQueues;
+        /// Keyed by path and build options.
+        std::map< std::pair< std::string, std::string >, cl::Program > programs;
+    };
+    using Key = std::vector< cl_device_id >;
+
+    /// The entry for 'devices', created if need be; null if its context cannot be. _mutex
+    /// must be held.
+    Entry* entry( const std::vector< cl::Device >& devices, cl_int* error );
+
+    std::mutex _mutex;
+    std::map< Key, std::unique_ptr< Entry > > _entries;
+};
+
+} // openCL
+
+#endif // #include
@@ -0,0 +1,254 @@
+#include <OpenCL/workgrouptuner.h>
+
+#include <OpenCL/device.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <fstream>
+#include <limits>
+#include <sstream>
+
+namespace openCL {
+
+namespace {
+
+// Domains smaller than this are not representative enough to tune on (and the coarsest
+// pyramid levels are tiny); they use the driver's choice until a profile exists.
+const int minTuningWorkItems = 128 * 128;
+// Timed launches per candidate, after one untimed warm-up launch.
+const int numTimedRuns = 3;
+
+int roundUp( int value, int multiple )
+{
+    return ( ( value + multiple - 1 ) / multiple ) * multiple;
+}
+
+} // unnamed
+
+const char* const WorkGroupTuner::profileFileName = "openCLWorkGroupProfiles.txt";
+
+WorkGroupTuner::WorkGroupTuner( const Device& device )
+    : _device( device.device() )
+    , _maxWorkGroupSize( device.maxWorkGroupSize() )
+    , _patchWidth( 0 )
+{
+    std::string driverVersion;
+    _device.getInfo( CL_DRIVER_VERSION, &driverVersion );
+    _deviceKey = device.name() + "/" + device.vendor() + "/" + driverVersion;
+    _device.getInfo( CL_DEVICE_MAX_WORK_ITEM_SIZES, &_maxWorkItemSizes );
+
+    loadProfiles();
+}
+
+void WorkGroupTuner::setPatchWidth( int patchWidth )
+{
+    _patchWidth = patchWidth;
+}
+
+cl_int WorkGroupTuner::enqueue(
+    const cl::CommandQueue& queue,
+    cl::Kernel& kernel,
+    const core::IntCoord& dims,
+    const PrepareLocal& prepare,
+    core::IntCoord* localDimsUsed,
+    const core::IntCoord& offset,
+    cl::Event* event,
+    const Buffers& inPlaceBuffers )
+{
+    core::IntCoord unused;
+    core::IntCoord& localDims = localDimsUsed ? *localDimsUsed : unused;
+
+    const auto key = profileKey( kernel );
+    auto found = _profiles.find( key );
+    if( found == _profiles.end() && dims.x() * dims.y() >= minTuningWorkItems ) {
+        const auto localCandidates = candidates( kernel, dims );
+        if( !localCandidates.empty() ) {
+            const auto best = tune( queue, kernel, dims, offset, localCandidates, prepare, inPlaceBuffers );
+            found = _profiles.emplace( key, best ).first;
+            saveProfile( key, best );
+        }
+    }
+
+    if( found != _profiles.end() && ( !prepare || prepare( found->second ) ) ) {
+        localDims = found->second;
+        return launch( queue, kernel, dims, localDims, offset, event );
+    }
+    if( !prepare ) {
+        localDims = core::IntCoord( 0, 0 );
+        return launch( queue, kernel, dims, localDims, offset, event );
+    }
+    for( const auto& candidate : candidates( kernel, dims ) ) {
+        if( prepare( candidate ) ) {
+            localDims = candidate;
+            return launch( queue, kernel, dims, localDims, offset, event );
+        }
+    }
+    return CL_INVALID_WORK_GROUP_SIZE;
+}
+
+cl_int WorkGroupTuner::launch(
+    const cl::CommandQueue& queue,
+    const cl::Kernel& kernel,
+    const core::IntCoord& dims,
+    const core::IntCoord& localDims,
+    const core::IntCoord& offset,
+    cl::Event* event )
+{
+    const auto globalOffset = offset == core::IntCoord( 0, 0 )
+        ? cl::NullRange
+        : cl::NDRange( offset.x(), offset.y() );
+    if( localDims.x() < 1 || localDims.y() < 1 ) {
+        return queue.enqueueNDRangeKernel(
+            kernel,
+            globalOffset,
+            cl::NDRange( dims.x(), dims.y() ),
+            cl::NullRange,
+            nullptr,
+            event );
+    }
+    return queue.enqueueNDRangeKernel(
+        kernel,
+        globalOffset,
+        cl::NDRange( roundUp( dims.x(), localDims.x() ), roundUp( dims.y(), localDims.y() ) ),
+        cl::NDRange( localDims.x(), localDims.y() ),
+        nullptr,
+        event );
+}
+
+std::vector< core::IntCoord > WorkGroupTuner::candidates(
+    const cl::Kernel& kernel,
+    const core::IntCoord& dims ) const
+{
+    // Ordered by preference, since the first usable one is the fallback for kernels that need
+    // an explicit local size before they are tuned.
+    static const std::array< core::IntCoord, 12 > all = {
+        core::IntCoord( 16, 16 ),
+        core::IntCoord( 16, 8 ),
+        core::IntCoord( 8, 8 ),
+        core::IntCoord( 32, 8 ),
+        core::IntCoord( 32, 4 ),
+        core::IntCoord( 64, 4 ),
+        core::IntCoord( 32, 16 ),
+        core::IntCoord( 8, 4 ),
+        core::IntCoord( 64, 2 ),
+        core::IntCoord( 32, 1 ),
+        core::IntCoord( 64, 1 ),
+        core::IntCoord( 128, 1 ) };
+
+    size_t maxArea = _maxWorkGroupSize;
+    size_t kernelMax = 0;
+    if( kernel.getWorkGroupInfo( _device, CL_KERNEL_WORK_GROUP_SIZE, &kernelMax ) == CL_SUCCESS ) {
+        maxArea = std::min( maxArea, kernelMax );
+    }
+
+    std::vector< core::IntCoord > result;
+    for( const auto& candidate : all ) {
+        // A 1D domain would only get padded, not covered, by taller work-groups.
+        if( dims.y() == 1 && candidate.y() != 1 ) {
+            continue;
+        }
+        if( static_cast< size_t >( candidate.x() * candidate.y() ) > maxArea ) {
+            continue;
+        }
+        if( _maxWorkItemSizes.size() >= 2
+            && ( static_cast< size_t >( candidate.x() ) > _maxWorkItemSizes[ 0 ]
+                || static_cast< size_t >( candidate.y() ) > _maxWorkItemSizes[ 1 ] ) ) {
+            continue;
+        }
+        result.push_back( candidate );
+    }
+    return result;
+}
+
+core::IntCoord WorkGroupTuner::tune(
+    const cl::CommandQueue& queue,
+    cl::Kernel& kernel,
+    const core::IntCoord& dims,
+    const core::IntCoord& offset,
+    const std::vector< core::IntCoord >& localCandidates,
+    const PrepareLocal& prepare,
+    const Buffers& inPlaceBuffers ) const
+{
+    using Clock = std::chrono::steady_clock;
+
+    // The timing runs would otherwise count as extra iterations of the kernel, making results
+    // depend on whether a profile existed.
+    Buffers snapshots;
+    for( const auto& buffer : inPlaceBuffers ) {
+        const auto size = buffer.getInfo< CL_MEM_SIZE >();
+        snapshots.emplace_back( buffer.getInfo< CL_MEM_CONTEXT >(), CL_MEM_READ_WRITE, size );
+        queue.enqueueCopyBuffer( buffer, snapshots.back(), 0, 0, size );
+    }
+
+    // Do not let earlier work in the queue count against the first candidate.
+    queue.finish();
+
+    core::IntCoord best = localCandidates.front();
+    auto bestTime = Clock::duration::max();
+    for( const auto& candidate : localCandidates ) {
+        if( prepare && !prepare( candidate ) ) {
+            continue;
+        }
+        // The warm-up launch also weeds out local sizes the kernel rejects.
+        if( launch( queue, kernel, dims, candidate, offset ) != CL_SUCCESS || queue.finish() != CL_SUCCESS ) {
+            continue;
+        }
+        const auto start = Clock::now();
+        for( int i = 0; i < numTimedRuns; i++ ) {
+            launch( queue, kernel, dims, candidate, offset );
+        }
+        if( queue.finish() != CL_SUCCESS ) {
+            continue;
+        }
+        const auto elapsed = Clock::now() - start;
+        if( elapsed < bestTime ) {
+            bestTime = elapsed;
+            best = candidate;
+        }
+    }
+
+    for( size_t i = 0; i < snapshots.size(); i++ ) {
+        queue.enqueueCopyBuffer( snapshots[ i ], inPlaceBuffers[ i ], 0, 0, snapshots[ i ].getInfo< CL_MEM_SIZE >() );
+    }
+    return best;
+}
+
+std::string WorkGroupTuner::profileKey( const cl::Kernel& kernel ) const
+{
+    std::ostringstream stream;
+    stream << _patchWidth << "\t" << kernel.getInfo< CL_KERNEL_FUNCTION_NAME >();
+    return stream.str();
+}
+
+void WorkGroupTuner::loadProfiles()
+{
+    // One profile per line: device key, patch width, kernel name, local width, local height,
+    // all tab-separated. Later lines win over earlier ones.
+    std::ifstream file( profileFileName );
+    std::string line;
+    while( std::getline( file, line ) ) {
+        std::istringstream stream( line );
+        std::string deviceKey, patchWidth, kernelName;
+        int localX = 0, localY = 0;
+        if( !std::getline( stream, deviceKey, '\t' )
+            || !std::getline( stream, patchWidth, '\t' )
+            || !std::getline( stream, kernelName, '\t' )
+            || !( stream >> localX >> localY ) ) {
+            continue;
+        }
+        if( deviceKey != _deviceKey || localX < 1 || localY < 1 ) {
+            continue;
+        }
+        _profiles[ patchWidth + "\t" + kernelName ] = core::IntCoord( localX, localY );
+    }
+}
+
+void WorkGroupTuner::saveProfile( const std::string& key, const core::IntCoord& localDims ) const
+{
+    // Failing to persist only costs a re-tune next run.
+    std::ofstream file( profileFileName, std::ios::app );
+    file << _deviceKey << "\t" << key << "\t" << localDims.x() << "\t" << localDims.y() << "\n";
+}
+
+} // openCL
@@ -0,0 +1,97 @@
+#ifndef OPENCL_WORKGROUPTUNER_H
+#define OPENCL_WORKGROUPTUNER_H
+
+#include <CL/cl.hpp>
+
+#include <Core/utility/intcoord.h>
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace openCL {
+
+class Device;
+
+/// Chooses the local (work-group) size of 2D kernel launches. The first launch of a kernel over
+/// a large enough domain times every candidate local size on the device and keeps the fastest.
+/// Winners are persisted per device, patch width and kernel in a profile file in the working
+/// directory, so later runs skip the timing. Global sizes are padded up to a multiple of the local
+/// size, so every kernel launched through here must ignore work-items outside the requested domain.
+class WorkGroupTuner
+{
+public:
+    /// Called before each launch with the local size about to be used. Sets any kernel arguments
+    /// that depend on it (such as __local buffers) and returns false if the kernel cannot run
+    /// with that local size. A kernel launched with a PrepareLocal always gets an explicit local
+    /// size, even before it has been tuned.
+    using PrepareLocal = std::function< bool( const core::IntCoord& localDims ) >;
+    using Buffers = std::vector< cl::Buffer >;
+
+    explicit WorkGroupTuner( const Device& device );
+
+    /// Profiles are keyed by patch width as well as by kernel; 0 (the default) means the
+    /// launches do not depend on a patch width.
+    void setPatchWidth( int patchWidth );
+
+    /// Enqueue 'kernel', whose arguments must already be set (apart from those set by 'prepare'),
+    /// over a 'dims'-sized 2D domain, or a 1D one if dims.y() is 1. If 'kernel' has no profile
+    /// yet and 'dims' is large enough to be representative, tune it first. Tuning runs 'kernel'
+    /// several times, so a kernel that updates buffers in place must name them in
+    /// 'inPlaceBuffers': they are copied aside before tuning and restored after it, and the
+    /// launch sees them as if no tuning had happened.
+    /// 'localDimsUsed', if given, receives the local size of the launch, as launch() takes it.
+    /// 'offset' is the global work offset of the domain. 'event', if given, receives the event
+    /// of the launch itself, not of any tuning runs.
+    cl_int enqueue(
+        const cl::CommandQueue& queue,
+        cl::Kernel& kernel,
+        const core::IntCoord& dims,
+        const PrepareLocal& prepare = nullptr,
+        core::IntCoord* localDimsUsed = nullptr,
+        const core::IntCoord& offset = core::IntCoord( 0, 0 ),
+        cl::Event* event = nullptr,
+        const Buffers& inPlaceBuffers = Buffers() );
+
+    /// Enqueue 'kernel' over 'dims', starting at 'offset', padded up to a multiple of
+    /// 'localDims', or with the driver's choice of local size if 'localDims' is (0,0).
+    static cl_int launch(
+        const cl::CommandQueue& queue,
+        const cl::Kernel& kernel,
+        const core::IntCoord& dims,
+        const core::IntCoord& localDims,
+        const core::IntCoord& offset = core::IntCoord( 0, 0 ),
+        cl::Event* event = nullptr );
+
+    /// Path, relative to the working directory, of the persisted profiles.
+    static const char* const profileFileName;
+private:
+    std::vector< core::IntCoord > candidates( const cl::Kernel& kernel, const core::IntCoord& dims ) const;
+    /// Time every candidate in 'candidates' and return the fastest one that ran, or the
+    /// first one if none succeeded. 'inPlaceBuffers' are left as they were.
+    core::IntCoord tune(
+        const cl::CommandQueue& queue,
+        cl::Kernel& kernel,
+        const core::IntCoord& dims,
+        const core::IntCoord& offset,
+        const std::vector< core::IntCoord >& candidates,
+        const PrepareLocal& prepare,
+        const Buffers& inPlaceBuffers ) const;
+    std::string profileKey( const cl::Kernel& kernel ) const;
+    void loadProfiles();
+    void saveProfile( const std::string& key, const core::IntCoord& localDims ) const;
+
+    cl::Device _device;
+    /// Identifies '_device' in the profile file.
+    std::string _deviceKey;
+    size_t _maxWorkGroupSize;
+    std::vector< size_t > _maxWorkItemSizes;
+    int _patchWidth;
+    /// Local size to use, keyed by profileKey(), for this device.
+    std::map< std::string, core::IntCoord > _profiles;
+};
+
+} // openCL
+
+#endif // #include
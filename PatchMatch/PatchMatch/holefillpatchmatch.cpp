@@ -2,7 +2,9 @@
 #include <patchmatchutility.h>
 
 #include <Core/exceptions/runtimeerror.h>
+#include <Core/image/bitimage.h>
 #include <Core/image/imageutility.h>
+#include <Core/image/imageview.h>
 
 namespace patchMatch {
 
@@ -11,36 +13,50 @@ HoleFillPatchMatch::HoleFillPatchMatch(
     const core::ImageRGB& sourceImage,
     const core::ImageRGB& targetImage,
     const core::ImageBinary& targetMask,
-    int numPyramidLevels)
+    int numPyramidLevels,
+    PatchDistance distance )
     : PatchMatch(
         patchWidth,
         sourceImage,
         targetImage,
         targetMask,
-        numPyramidLevels )
+        numPyramidLevels,
+        distance )
+{
+}
+
+HoleFillPatchMatch::HoleFillPatchMatch(
+    int patchWidth,
+    const core::ImageRGBView& sourceImage,
+    const core::ImageRGBView& targetImage,
+    const core::ImageBinaryView& targetMask,
+    int numPyramidLevels,
+    PatchDistance distance )
+    : PatchMatch(
+        patchWidth,
+        sourceImage,
+        targetImage,
+        targetMask,
+        numPyramidLevels,
+        distance )
 {
 }
 
 void HoleFillPatchMatch::makeFirstTargetPyramidSize(
-    const core::ImageRGB& targetOriginalSize,
-    const core::ImageBinary& targetMaskPyramidSize,
+    const core::ImageView< core::Vector3 >& targetImagePyramidSize,
+    const core::ImageBinaryView& targetMaskPyramidSize,
     core::ImageRGB& targetPyramidSize )
 {
-    core::ImageRGB downsampled;
-    core::imageUtility::downsample< core::Vector3 >(
-        targetOriginalSize,
-        downsampled,
-        targetMaskPyramidSize.size() );
     utility::holeFillingInitialFill(
-        downsampled,
+        targetImagePyramidSize,
         targetMaskPyramidSize,
         targetPyramidSize );
 }
 
 void HoleFillPatchMatch::makeTargetWeightsAndSourceMaskAtPyramidLevel(
     core::ImageScalar& weightsDest,
-    core::ImageBinary& sourceMaskDest,
-    const core::ImageBinary& targetMaskPyramidSize,
+    core::BitImage& sourceMaskDest,
+    const core::ImageBinaryView& targetMaskPyramidSize,
     const core::IntCoord& sourcePyramidSize)
 {
     core::IntCoord targetSize = targetMaskPyramidSize.size();
@@ -53,43 +69,33 @@ void HoleFillPatchMatch::makeTargetWeightsAndSourceMaskAtPyramidLevel(
 
     // Make source mask be the complement of (targetMask dilated by structuring element the size of a patch).
     const auto pWidth = patchWidth();
-    core::ImageBinary structure( pWidth, pWidth, true );
-    core::imageUtility::dilate(
-        structure,
-        core::IntCoord( pWidth / 2, pWidth / 2 ),
-        targetMaskPyramidSize,
-        sourceMaskDest );
-    //Now reverse the source mask
-    for( int x = 0; x < sourceMaskDest.width(); x++ ) {
-        for( int y = 0; y < sourceMaskDest.height(); y++ ) {
-            sourceMaskDest.set( x, y, !sourceMaskDest.get( x, y ) );
-        }
+    if( pWidth % 2 == 0 ) {
+        THROW_RUNTIME( "Even numbered dimensions not allowed!" );
     }
+    sourceMaskDest.assign( targetMaskPyramidSize );
+    sourceMaskDest.dilate( pWidth / 2 );
+    //Now reverse the source mask
+    sourceMaskDest.invert();
 
     // Get anchor weights. The deeper a point is in the hole, the lower its weight.
     core::imageUtility::getDistanceMapBidirectional( targetMaskPyramidSize, weightsDest );
     const double outsideHoleWeight = 100. ;
     const double gamma = 2.0;
     double overlapDist = patchWidth() / 2;
-    for( int x = 0; x < weightsDest.width(); x++ ) {
-        for( int y = 0; y < weightsDest.height(); y++ ) {
-            const auto dist = weightsDest.get(x,y);
-
-            if( dist < 0 ) {
-                // This is outside the hole.  We are still assigning it
-                // a weight because we want to weight outside the hole
-                // participants in the patch cost step.
-                weightsDest.set( x, y, outsideHoleWeight );
-                continue;
-            }
+    weightsDest.transform( [ & ]( double dist ) {
+        if( dist < 0 ) {
+            // This is outside the hole.  We are still assigning it
+            // a weight because we want to weight outside the hole
+            // participants in the patch cost step.
+            return outsideHoleWeight;
+        }
 
-            double weight = pow( gamma,-dist );
-            if( dist >= 0 && dist <= overlapDist ) {
-                weight*=2.0;
-            }
-            weightsDest.set( x, y, weight );
+        double weight = pow( gamma,-dist );
+        if( dist >= 0 && dist <= overlapDist ) {
+            weight*=2.0;
         }
-    }
+        return weight;
+    }, true );
 }
 
 void HoleFillPatchMatch::initMaskedOutPartsOfTargetPyramidSize(
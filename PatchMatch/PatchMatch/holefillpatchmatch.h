@@ -2,6 +2,7 @@
 #define IEC_HOLEFILLPATCHMATCH_H
 
 #include <Core/image/imagetypes.h>
+#include <Core/utility/twodarray.h>
 
 #include <PatchMatch/patchmatch.h>
 
@@ -18,18 +19,26 @@ public:
         const core::ImageRGB& sourceImage,
         const core::ImageRGB& targetImage,
         const core::ImageBinary& targetMask,
-        int numPyramidLevels );
+        int numPyramidLevels,
+        PatchDistance distance = PatchDistance::WeightedSSD );
+    HoleFillPatchMatch(
+        int patchWidth,
+        const core::ImageRGBView& sourceImage,
+        const core::ImageRGBView& targetImage,
+        const core::ImageBinaryView& targetMask,
+        int numPyramidLevels,
+        PatchDistance distance = PatchDistance::WeightedSSD );
 protected:
     void makeTargetWeightsAndSourceMaskAtPyramidLevel( 
         core::ImageScalar& weightsDest,
-        core::ImageBinary& sourceMaskDest,
-        const core::ImageBinary& targetMaskPyramidSize,
+        core::BitImage& sourceMaskDest,
+        const core::ImageBinaryView& targetMaskPyramidSize,
         const core::IntCoord& sourcePyramidSize );
     void initMaskedOutPartsOfTargetPyramidSize(
         core::ImageRGB& targetPyramidSizeRgb );
     void makeFirstTargetPyramidSize(
-        const core::ImageRGB& targetOriginalSize,
-        const core::ImageBinary& targetMaskPyramidSize,
+        const core::ImageView< core::Vector3 >& targetImagePyramidSize,
+        const core::ImageBinaryView& targetMaskPyramidSize,
         core::ImageRGB& targetPyramidSize );
 };
 
@@ -1,17 +1,91 @@
 #include <holefillpatchmatchopencl.h>
 #include <patchmatchutility.h>
 
+#include <OpenCL/device.h>
 #include <OpenCL/opencltypes.h>
+#include <OpenCL/runtime.h>
 
 #include <Core/exceptions/runtimeerror.h>
 #include <Core/utility/mathutility.h>
 
+#include <algorithm>
 #include <iostream>
+#include <limits>
 
 namespace patchMatch {
 
-HoleFillPatchMatchOpenCL::HoleFillPatchMatchOpenCL( const openCL::Device& device ) 
-    : OpenCLGPUHost( device )    
+namespace {
+
+// splitmix64's finalizer: turns nearby inputs into unrelated, well-mixed outputs.
+cl_ulong mix64( cl_ulong z )
+{
+    z = ( z ^ ( z >> 30 ) ) * 0xBF58476D1CE4E5B9ull;
+    z = ( z ^ ( z >> 27 ) ) * 0x94D049BB133111EBull;
+    return z ^ ( z >> 31 );
+}
+
+// Where the tiled kernels can run, the per-pixel kernels only switch to the active-pixel list
+// when at most this fraction of the target is active; for larger holes the tiles' shared target
+// apron is worth more than skipping the inactive pixels.
+const double maxActiveFractionForList = 0.25;
+
+// The launch limits every device in 'devices' meets.
+cl_ulong minLocalMemSize( const std::vector< openCL::Device >& devices )
+{
+    cl_ulong result = std::numeric_limits< cl_ulong >::max();
+    for( const auto& device : devices ) {
+        result = std::min( result, device.localMemSize() );
+    }
+    return result;
+}
+
+size_t minMaxWorkGroupSize( const std::vector< openCL::Device >& devices )
+{
+    size_t result = std::numeric_limits< size_t >::max();
+    for( const auto& device : devices ) {
+        result = std::min( result, device.maxWorkGroupSize() );
+    }
+    return result;
+}
+
+const char* stepName( HoleFillPatchMatchOpenCL::Step step )
+{
+    switch( step ) {
+    case HoleFillPatchMatchOpenCL::Blend: return "Blend";
+    case HoleFillPatchMatchOpenCL::Search: return "Search";
+    case HoleFillPatchMatchOpenCL::Propagate: return "Propagate";
+    case HoleFillPatchMatchOpenCL::NextPyramid: return "NextPyramid";
+    case HoleFillPatchMatchOpenCL::SearchAndPropagate: return "SearchAndPropagate";
+    case HoleFillPatchMatchOpenCL::Snapshot: return "Snapshot";
+    }
+    return "";
+}
+
+} // unnamed
+
+const cl_ulong HoleFillPatchMatchOpenCL::defaultRandomSeed = 42;
+
+HoleFillPatchMatchOpenCL::HoleFillPatchMatchOpenCL( 
+    const openCL::Device& device,
+    openCL::MaskFormat maskFormat,
+    openCL::RGBFormat imageFormat ) 
+    : HoleFillPatchMatchOpenCL( std::vector< openCL::Device >{ device }, maskFormat, imageFormat )
+{
+}
+
+HoleFillPatchMatchOpenCL::HoleFillPatchMatchOpenCL( 
+    const std::vector< openCL::Device >& devices,
+    openCL::MaskFormat maskFormat,
+    openCL::RGBFormat imageFormat ) 
+    : OpenCLGPUHost( devices, maskFormat, imageFormat )
+    , _randomSeed( defaultRandomSeed )
+    , _numRandomKeysUsed( 0 )
+    , _useTiledKernels( false )
+    , _localMemSize( minLocalMemSize( devices ) )
+    , _maxWorkGroupSize( minMaxWorkGroupSize( devices ) )
+    , _numActivePixels( 0 )
+    , _useActivePixelList( false )
+    , _prefixSumBlockSize( 256 )
 {
     const auto getKernel = [&](
         const cl::Program& program,
@@ -46,6 +120,10 @@ HoleFillPatchMatchOpenCL::HoleFillPatchMatchOpenCL( const openCL::Device& device
     getKernel(_utilityProgram, _downsampleBooleanImageKernel, "downsampleBooleanImage");
     getKernel(_utilityProgram, _internalDistanceMapInitKernel, "internalDistanceMapInit");
     getKernel(_utilityProgram, _distanceMapStepKernel, "internalDistanceMapStep");
+    getKernel(_utilityProgram, _prefixSumMaskBlocksKernel, "prefixSumMaskBlocks");
+    getKernel(_utilityProgram, _prefixSumBlocksKernel, "prefixSumBlocks");
+    getKernel(_utilityProgram, _prefixSumAddBlockOffsetsKernel, "prefixSumAddBlockOffsets");
+    getKernel(_utilityProgram, _compactMaskKernel, "compactMask");
 
     buildProgram(_holeFillProgram, "patches/holeFillPatchMatch.cl");
     getKernel(_holeFillProgram, _blendKernel, "blend");
@@ -58,11 +136,74 @@ HoleFillPatchMatchOpenCL::HoleFillPatchMatchOpenCL( const openCL::Device& device
     getKernel(_holeFillProgram, _blackOutMaskedAreaKernel, "blackOutMaskedArea");
     getKernel(_holeFillProgram, _initialHoleFillKernel, "initialHoleFill");
     getKernel(_holeFillProgram, _propagateKernel, "propagate");
+    getKernel(_holeFillProgram, _searchTiledKernel, "searchTiled");
+    getKernel(_holeFillProgram, _propagateTiledKernel, "propagateTiled");
+    getKernel(_holeFillProgram, _searchPropagateTiledKernel, "searchPropagateTiled");
+    getKernel(_holeFillProgram, _blendAndCostsTiledKernel, "blendAndCostsTiled");
+    getKernel(_holeFillProgram, _searchListKernel, "searchList");
+    getKernel(_holeFillProgram, _propagateListKernel, "propagateList");
+    getKernel(_holeFillProgram, _nnfCostsListKernel, "nnfCostsList");
+    getKernel(_holeFillProgram, _blendListKernel, "blendList");
+
+    // The prefix sum kernels run with a block size that they all and the device accept.
+    size_t maxBlockSize = _maxWorkGroupSize;
+    for( const auto* kernel : { 
+            &_prefixSumMaskBlocksKernel, 
+            &_prefixSumBlocksKernel, 
+            &_prefixSumAddBlockOffsetsKernel } ) {
+        size_t kernelMax = 0;
+        if( kernel->getWorkGroupInfo( _devices.front(), CL_KERNEL_WORK_GROUP_SIZE, &kernelMax ) == CL_SUCCESS ) {
+            maxBlockSize = std::min( maxBlockSize, kernelMax );
+        }
+    }
+    while( _prefixSumBlockSize > 1 && _prefixSumBlockSize > maxBlockSize ) {
+        _prefixSumBlockSize /= 2;
+    }
+}
+
+bool HoleFillPatchMatchOpenCL::tiledKernelsFit() const
+{
+    // The smallest tile worth using; the tuner may pick larger ones that also fit.
+    const core::IntCoord minTileDims( 8, 8 );
+
+    // All tiled kernels must accept the work-group size.
+    size_t maxTileArea = _maxWorkGroupSize;
+    for( const auto* kernel : { 
+            &_searchTiledKernel, 
+            &_propagateTiledKernel, 
+            &_searchPropagateTiledKernel, 
+            &_blendAndCostsTiledKernel } ) {
+        size_t kernelMax = 0;
+        if( kernel->getWorkGroupInfo( _devices.front(), CL_KERNEL_WORK_GROUP_SIZE, &kernelMax ) == CL_SUCCESS ) {
+            maxTileArea = std::min( maxTileArea, kernelMax );
+        }
+    }
+    return static_cast< size_t >( minTileDims.x() * minTileDims.y() ) <= maxTileArea
+        && targetApronBytes( minTileDims ) <= _localMemSize;
+}
+
+size_t HoleFillPatchMatchOpenCL::targetApronBytes( const core::IntCoord& tileDims ) const
+{
+    return sizeof( cl_float4 ) 
+        * ( tileDims.x() + _patchWidth - 1 ) 
+        * ( tileDims.y() + _patchWidth - 1 );
+}
+
+bool HoleFillPatchMatchOpenCL::prepareTiledLaunch(
+    cl::Kernel& kernel,
+    cl_uint apronArgIndex,
+    const core::IntCoord& tileDims )
+{
+    const auto apronBytes = targetApronBytes( tileDims );
+    if( apronBytes > _localMemSize ) {
+        return false;
+    }
+    return setKernelArg( kernel, apronArgIndex, cl::Local( apronBytes ) ) == CL_SUCCESS;
 }
 
 void HoleFillPatchMatchOpenCL::init(
-                         const core::ImageRGB& target,
-                         const core::ImageBinary& targetMask,
+                         const core::ImageRGBView& target,
+                         const core::ImageBinaryView& targetMask,
                          int numPyramidLevels,
                          int patchWidth)
 {
@@ -87,87 +228,37 @@ void HoleFillPatchMatchOpenCL::init(
     _patchWidth= patchWidth;
     _targetOriginalDims = target.size();
     _sourceOriginalDims = target.size();
+    _useTiledKernels = tiledKernelsFit();
+    for(auto& tuner : _workGroupTuners)
+    {
+        tuner.setPatchWidth(_patchWidth);
+    }
 
     //OpenCL stuff to make and put online:
-    // target original size
-    // source original size
+    // target original size, which doubles as the source original size
     // targetMask original size
 
-    //Get original size target image, source image, and target mask into OpenCL.
-    _targetOriginalSize = std::make_unique< cl::Image2D >(
-        _context,
-        CL_MEM_READ_ONLY,
-        cl::ImageFormat(CL_RGBA, CL_FLOAT),
-        target.width(), 
-        target.height(), 
-        0, 
-        nullptr,
-        &error );
-    _sourceOriginalSize = std::make_unique< cl::Image2D >(
+    //Get original size target image and target mask into OpenCL.
+    _targetOriginalSize = std::make_unique< openCL::RGBImage >(
         _context,
+        _useImageBuffers,
+        _rgbFormat,
+        _useHostMappedImages,
         CL_MEM_READ_ONLY,
-        cl::ImageFormat(CL_RGBA, CL_FLOAT),
-        target.width(), 
-        target.height(), 
-        0, 
-        nullptr,
+        target.size(),
         &error );
-    _targetMaskOriginalSize = std::make_unique< cl::Buffer >(
+    _targetMaskOriginalSize = std::make_unique< openCL::Mask >(
         _context,
+        _maskFormat,
         CL_MEM_READ_ONLY,
-        sizeof(cl_int) * target.width() * target.height(),
-        nullptr,
+        target.size(),
         &error );
     
-    const auto origin = getImageReadWriteCoord(0,0,0);
-    const auto region = getImageReadWriteCoord(target.width(),target.height(),1);
-    auto targetInputArray = OpenCLGPUHost::arrayFromRGBImage(target);
-
-    auto targetMaskInputArray = OpenCLGPUHost::arrayFromBoolImage(targetMask);
-    error = _commandQueue.enqueueWriteImage(
-        *_targetOriginalSize,
-        CL_FALSE,
-        origin,
-        region,
-        0,
-        0,
-        targetInputArray.get(),
-        0,
-        0);
-    error = _commandQueue.enqueueWriteImage(
-        *_sourceOriginalSize,
-        CL_FALSE,
-        origin,
-        region,
-        0,
-        0,
-        targetInputArray.get(),
-        0,
-        0);
-    error = _commandQueue.enqueueWriteBuffer(
-        *_targetMaskOriginalSize,
-        CL_FALSE,
-        0,
-        (sizeof(cl_int)) * target.width() * target.height(),
-        targetMaskInputArray.get(),
-        0,
-        0);
-
-    // Get our random seeds onto GPU. 
-    // Seed with constant to ensure determinism.
-    srand(42);
-    cl_ulong* randomSeedsArray = new cl_ulong[target.width()*target.height()];
-    for(int i=0; i<target.width()*target.height(); i++) {
-        randomSeedsArray[i] = rand();
-    }
-    _randomBuffer = std::make_unique< cl::Buffer >(
-        _context,
-        CL_MEM_READ_WRITE,
-        sizeof(cl_ulong)*target.width()*target.height(),
-        nullptr,
-        &error );
-    error = _commandQueue.enqueueWriteBuffer(*_randomBuffer,CL_FALSE,0,
-                                             sizeof(cl_ulong)*target.width()*target.height(),randomSeedsArray,0,0);
+    error = _targetOriginalSize->enqueueWrite(_commandQueue,target);
+    error = _targetMaskOriginalSize->enqueueWrite(_commandQueue,targetMask);
+
+    // Restart the random sequence so that a run depends only on _randomSeed.
+    _numRandomKeysUsed = 0;
 
     error =_commandQueue.finish();
     // At this point, our target and targetMask original size are inside OpenCL, 
@@ -186,13 +277,13 @@ void HoleFillPatchMatchOpenCL::init(
 void HoleFillPatchMatchOpenCL::cleanupMemObjects()
 {
     _targetOriginalSize = nullptr;
-    _sourceOriginalSize = nullptr;
     _targetMaskOriginalSize = nullptr;
     _targetPyramidSize = nullptr;
     _targetMaskPyramidSize = nullptr;
     _sourcePyramidSize = nullptr;
     _sourceMaskPyramidSize = nullptr;
-    _randomBuffer = nullptr;
+    _activePixels = nullptr;
+    _bands.clear();
     for(int i=0; i<2; i++)
     {
         _nnfCoords[i] = nullptr;
@@ -201,12 +292,32 @@ void HoleFillPatchMatchOpenCL::cleanupMemObjects()
     }
 }
 
+void HoleFillPatchMatchOpenCL::setRandomSeed(cl_ulong seed)
+{
+    _randomSeed = seed;
+}
+
+cl_ulong HoleFillPatchMatchOpenCL::nextRandomKey()
+{
+    // The kernels' generator wants odd keys with well-mixed bits.
+    _numRandomKeysUsed++;
+    return mix64( _randomSeed + 0x9E3779B97F4A7C15ull * _numRandomKeysUsed ) | 1;
+}
+
 void HoleFillPatchMatchOpenCL::planStep(Step step)
 {
     //do not allow enqueueing bogus procedures, like doing two blend steps in a row
-    if (step == Blend && _steps.back() == Blend) {
+    if (step == Blend && !_steps.empty() && _steps.back() == Blend) {
         THROW_RUNTIME("Makes no sense to do two blends back to back.");
     }
+    if (step == Snapshot && (_steps.empty() || _steps.back() != Blend)) {
+        THROW_RUNTIME("A snapshot must directly follow a blend.");
+    }
+    //a search directly followed by a propagate runs as one fused step
+    if (step == Propagate && !_steps.empty() && _steps.back() == Search) {
+        _steps.back() = SearchAndPropagate;
+        return;
+    }
     _steps.push(step);
 }
 
@@ -223,6 +334,10 @@ void HoleFillPatchMatchOpenCL::executeSteps(core::ImageRGB& blendResult)
     {
         Step nextStep = _steps.front();
         _steps.pop();
+        if(profile())
+        {
+            profile()->setStep(stepName(nextStep));
+        }
         switch(nextStep)
         {
         case NextPyramid:
@@ -232,17 +347,29 @@ void HoleFillPatchMatchOpenCL::executeSteps(core::ImageRGB& blendResult)
         }
         case Blend:
         {
-            enqueueBlend();
+            enqueueBlend(_nnfReadIndex);
+            exchangeBandHalos(true);
             break;
         }
         case Search:
         {
             enqueueSearch();
+            exchangeBandHalos(false);
             break;
         }
         case Propagate:
         {
-            enqueuePropagate();
+            enqueuePropagate(core::mathUtility::jumpfloodInitialK(_targetPyramidDims.x(),_targetPyramidDims.y()));
+            break;
+        }
+        case SearchAndPropagate:
+        {
+            enqueueSearchAndPropagate();
+            break;
+        }
+        case Snapshot:
+        {
+            enqueueSnapshot();
             break;
         }
         };
@@ -251,25 +378,208 @@ void HoleFillPatchMatchOpenCL::executeSteps(core::ImageRGB& blendResult)
     //read back the target pyramid size image - the one that was just
     //written to in the blend step at the end of the queue, the one that
     //is now the read image
-    auto outputArray = std::make_unique< cl_float4[] >( _targetPyramidDims.x() * _targetPyramidDims.y() );
-    error = _commandQueue.enqueueReadImage(
-        *_targetPyramidSize,
-        CL_FALSE,
-        getImageReadWriteCoord(0,0,0),
-        getImageReadWriteCoord(_targetPyramidDims.x(),_targetPyramidDims.y(),1),
-        0,
-        0,
-        outputArray.get(),
-        0,
-        0 );
-    error = _commandQueue.finish();
+    if(profile())
+    {
+        profile()->setStep("Read");
+    }
+    mergeBands();
+    error = _targetPyramidSize->read(_commandQueue,blendResult,profileEvent("readImage"));
+}
+
+std::future< void > HoleFillPatchMatchOpenCL::executeStepsAsync(core::ImageRGB& blendResult, SnapshotCallback onSnapshot)
+{
+    //fail on the caller's thread where we can
+    if (!stepsValidForExecution()) {
+        THROW_RUNTIME("Queue is invalid");
+    }
+
+    return std::async(std::launch::async,[this,&blendResult,onSnapshot]() {
+        _snapshotCallback = onSnapshot;
+        try {
+            executeSteps(blendResult);
+        } catch (...) {
+            _snapshotCallback = nullptr;
+            try {
+                finishSnapshots();
+            } catch (...) {
+            }
+            throw;
+        }
+        _snapshotCallback = nullptr;
+        finishSnapshots();
+    });
+}
+
+void HoleFillPatchMatchOpenCL::enqueueSnapshot()
+{
+    if (!_snapshotCallback) {
+        return;
+    }
+    cl_int error = CL_SUCCESS;
+
+    //a copy, so that the following steps can go on writing the target
+    mergeBands();
+    const auto snapshot = std::make_shared< openCL::RGBImage >(
+        _context,
+        _useImageBuffers,
+        _rgbFormat,
+        _useHostMappedImages,
+        CL_MEM_READ_WRITE,
+        _targetPyramidDims,
+        &error );
+    cl::Event copied;
+    if (error == CL_SUCCESS) {
+        error = _targetPyramidSize->enqueueCopyTo(_commandQueue,*snapshot,&copied);
+    }
+    if (error == CL_SUCCESS) {
+        error = _commandQueue.flush();
+    }
+    if (error != CL_SUCCESS) {
+        THROW_RUNTIME("Failed to copy snapshot");
+    }
+
+    //read back on a queue of our own, which does not wait for the steps enqueued after the copy
+    const std::shared_future< void > previous = _snapshots.empty() ? std::shared_future< void >() : _snapshots.back();
+    const auto devices = _devices;
+    const auto callback = _snapshotCallback;
+    const int level = _currentPyramidLevel;
+    _snapshots.push_back(std::async(std::launch::async,[=]() {
+        if (previous.valid()) {
+            previous.wait();
+        }
+        cl_int readError = copied.wait();
+        core::ImageRGB image;
+        if (readError == CL_SUCCESS) {
+            const auto queue = openCL::Runtime::instance().acquireQueue(devices,0,0,&readError);
+            if (readError == CL_SUCCESS) {
+                readError = snapshot->read(queue,image);
+                if (queue.finish() == CL_SUCCESS) {
+                    openCL::Runtime::instance().releaseQueue(devices,0,0,queue);
+                }
+            }
+        }
+        if (readError != CL_SUCCESS) {
+            THROW_RUNTIME("Failed to read snapshot");
+        }
+        callback(level,image);
+    }).share());
+}
+
+void HoleFillPatchMatchOpenCL::finishSnapshots()
+{
+    auto snapshots = std::move(_snapshots);
+    _snapshots.clear();
+    for (const auto& snapshot : snapshots) {
+        snapshot.wait();
+    }
+    for (const auto& snapshot : snapshots) {
+        snapshot.get();
+    }
+}
+
+void HoleFillPatchMatchOpenCL::executeSteps(core::ImageRGB& blendResult, openCL::ProfileReport& report)
+{
+    openCL::Profile runProfile;
+    setProfile(&runProfile);
+    try {
+        executeSteps(blendResult);
+    } catch (...) {
+        setProfile(nullptr);
+        throw;
+    }
+    setProfile(nullptr);
+    report = runProfile.report();
+}
+
+std::unique_ptr< HoleFillPatchMatchOpenCL::RecordedSteps > HoleFillPatchMatchOpenCL::recordSteps(core::ImageRGB& blendResult)
+{
+    if (_currentPyramidLevel >= 0) {
+        THROW_RUNTIME("Steps can only be recorded directly after init()");
+    }
+    if (_deviceQueues.size() > 1) {
+        THROW_RUNTIME("Steps can only be recorded on a single device");
+    }
+    if (!stepsValidForExecution()) {
+        THROW_RUNTIME("Queue is invalid");
+    }
+
+    auto recorded = std::unique_ptr< RecordedSteps >(new RecordedSteps);
+    recorded->_owner = this;
+    recorded->_dims = _targetOriginalDims;
+    recorded->_patchWidth = _patchWidth;
+    recorded->_numPyramidLevels = _numPyramidLevels;
+    recorded->_targetOriginalSize = std::make_unique< openCL::RGBImage >(*_targetOriginalSize);
+    recorded->_targetMaskOriginalSize = std::make_unique< openCL::Mask >(*_targetMaskOriginalSize);
+
+    setRecording(&recorded->_commands);
+    try {
+        executeSteps(blendResult);
+    } catch (...) {
+        setRecording(nullptr);
+        throw;
+    }
+    setRecording(nullptr);
 
-    OpenCLGPUHost::rgbImageFromArray(blendResult,_targetPyramidDims,outputArray.get());
+    recorded->_result = std::make_unique< openCL::RGBImage >(*_targetPyramidSize);
+    return recorded;
+}
+
+void HoleFillPatchMatchOpenCL::replaySteps(
+    RecordedSteps& steps,
+    const core::ImageRGBView& target,
+    const core::ImageBinaryView& targetMask,
+    core::ImageRGB& blendResult)
+{
+    if (steps._owner != this) {
+        THROW_RUNTIME("Steps were recorded by another object");
+    }
+    if (target.size() != steps._dims || targetMask.size() != steps._dims) {
+        THROW_RUNTIME("Images must be the size the steps were recorded for");
+    }
+
+    //the recording holds on to everything it uses, so our own objects can go
+    cleanupMemObjects();
+    _steps = std::queue< Step >();
+
+    cl_int error = steps._targetOriginalSize->enqueueWrite(_commandQueue,target);
+    if (error == CL_SUCCESS) {
+        error = steps._targetMaskOriginalSize->enqueueWrite(_commandQueue,targetMask);
+    }
+    if (error == CL_SUCCESS) {
+        error = steps._commands.enqueue(_commandQueue);
+    }
+    if (error == CL_SUCCESS) {
+        error = steps._result->read(_commandQueue,blendResult);
+    }
+    if (error != CL_SUCCESS) {
+        THROW_RUNTIME("Failed to replay recorded steps");
+    }
+}
+
+const core::IntCoord& HoleFillPatchMatchOpenCL::RecordedSteps::dims() const
+{
+    return _dims;
+}
+
+int HoleFillPatchMatchOpenCL::RecordedSteps::patchWidth() const
+{
+    return _patchWidth;
+}
+
+int HoleFillPatchMatchOpenCL::RecordedSteps::numPyramidLevels() const
+{
+    return _numPyramidLevels;
+}
+
+size_t HoleFillPatchMatchOpenCL::RecordedSteps::numCommands() const
+{
+    return _commands.size();
 }
 
 bool HoleFillPatchMatchOpenCL::stepsValidForExecution()
 {
-    if(_steps.back()!=Blend) return false;
+    if(_steps.empty()) return false;
+    if(_steps.back()!=Blend && _steps.back()!=Snapshot) return false;
     return true;
 }
 
@@ -278,8 +588,6 @@ void HoleFillPatchMatchOpenCL::enqueueSetupNextPyramidLevel()
     cl_int error=CL_SUCCESS;
 
     //Need to:
-    // -recreate randomBufferIndices
-    // -populate randomBufferIndices
     // -recreate targetPyramidSize and sourcePyramidSize
     // -fill targetPyramidSize and sourcePyramidSize by downsampling/copying from _originalSize images
     // -recreate targetMaskPyramidSize object
@@ -300,7 +608,10 @@ void HoleFillPatchMatchOpenCL::enqueueSetupNextPyramidLevel()
     //      -swap NNF buffers
 
     //absolutely must finish all pending OpenCL operations since
-    //we will be deleting and recreating buffers/images
+    //we will be deleting and recreating buffers/images; the next level is upsampled from
+    //the whole of the first device's nnf
+    mergeBands();
+    _bands.clear();
     error=_commandQueue.finish();
 
     //this is first pyramid level
@@ -312,93 +623,88 @@ void HoleFillPatchMatchOpenCL::enqueueSetupNextPyramidLevel()
         }
         _currentPyramidLevel--;
     }
+    if(profile())
+    {
+        profile()->setLevel(_currentPyramidLevel);
+    }
 
     core::IntCoord prevTargetDims = _targetPyramidDims;
     core::IntCoord prevSourceDims = _sourcePyramidDims;
     utility::pyramidLevelSizes(_currentPyramidLevel,_numPyramidLevels,_patchWidth,_targetOriginalDims,
                                          _sourceOriginalDims,_targetPyramidDims,_sourcePyramidDims);
 
-    _targetPyramidSize = std::make_unique< cl::Image2D >(
+    _targetPyramidSize = std::make_unique< openCL::RGBImage >(
         _context,
+        _useImageBuffers,
+        _rgbFormat,
+        _useHostMappedImages,
         CL_MEM_READ_WRITE,
-        cl::ImageFormat(CL_RGBA, CL_FLOAT),
-        _targetPyramidDims.x(), 
-        _targetPyramidDims.y(), 
-        0, 
-        nullptr,
+        _targetPyramidDims,
         &error );
-    _sourcePyramidSize = std::make_unique< cl::Image2D >(
+    _sourcePyramidSize = std::make_unique< openCL::RGBImage >(
         _context,
+        _useImageBuffers,
+        _rgbFormat,
+        _useHostMappedImages,
         CL_MEM_READ_WRITE,
-        cl::ImageFormat(CL_RGBA, CL_FLOAT),
-        _sourcePyramidDims.x(), 
-        _sourcePyramidDims.y(), 
-        0, 
-        nullptr,
+        _sourcePyramidDims,
         &error );
     if(_currentPyramidLevel==0)
     {
-        error = _commandQueue.enqueueCopyImage(*_targetOriginalSize,*_targetPyramidSize,
-                                               getImageReadWriteCoord(0,0,0),
-                                               getImageReadWriteCoord(0,0,0),
-                                               getImageReadWriteCoord(_targetPyramidDims.x(),_targetPyramidDims.y(),1));
-        error = _commandQueue.enqueueCopyImage(*_sourceOriginalSize,*_sourcePyramidSize,
-                                               getImageReadWriteCoord(0,0,0),
-                                               getImageReadWriteCoord(0,0,0),
-                                               getImageReadWriteCoord(_sourcePyramidDims.x(),_sourcePyramidDims.y(),1));
+        error = enqueueCopy(*_targetOriginalSize,*_targetPyramidSize);
+        error = enqueueCopy(*_targetOriginalSize,*_sourcePyramidSize);
     }
     else
     {
-        error = _downsampleRGBImageKernel.setArg(0,*_targetOriginalSize);
-        error = _downsampleRGBImageKernel.setArg(1,*_targetPyramidSize);
-        error = _commandQueue.enqueueNDRangeKernel(_downsampleRGBImageKernel,
-                                           cl::NullRange,
-                                           cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                           cl::NullRange);
-        error = _downsampleRGBImageKernel.setArg(0,*_sourceOriginalSize);
-        error = _downsampleRGBImageKernel.setArg(1,*_sourcePyramidSize);
-        error = _commandQueue.enqueueNDRangeKernel(_downsampleRGBImageKernel,
-                                           cl::NullRange,
-                                           cl::NDRange(_sourcePyramidDims.x(),_sourcePyramidDims.y()),
-                                           cl::NullRange);
-    }
-
-    _targetMaskPyramidSize = std::make_unique< cl::Buffer >(
+        const auto downsample = [&](const openCL::RGBImage& from, const openCL::RGBImage& to)
+        {
+            error = setKernelArg(_downsampleRGBImageKernel,0,from.memory());
+            error = setKernelArg(_downsampleRGBImageKernel,1,to.memory());
+            error = setKernelArg(_downsampleRGBImageKernel,2,from.dims().x());
+            error = setKernelArg(_downsampleRGBImageKernel,3,from.dims().y());
+            error = setKernelArg(_downsampleRGBImageKernel,4,to.dims().x());
+            error = setKernelArg(_downsampleRGBImageKernel,5,to.dims().y());
+            error = enqueueKernel(_downsampleRGBImageKernel,to.dims());
+        };
+        downsample(*_targetOriginalSize,*_targetPyramidSize);
+        downsample(*_targetOriginalSize,*_sourcePyramidSize);
+    }
+
+    _targetMaskPyramidSize = std::make_unique< openCL::Mask >(
         _context,
+        _maskFormat,
         CL_MEM_READ_WRITE,
-        sizeof(int)*_targetPyramidDims.x()*_targetPyramidDims.y(),
-        nullptr,
+        _targetPyramidDims,
         &error );
-    _sourceMaskPyramidSize = std::make_unique< cl::Buffer >( 
+    _sourceMaskPyramidSize = std::make_unique< openCL::Mask >( 
         _context,
+        _maskFormat,
         CL_MEM_READ_WRITE,
-        sizeof(int)*_sourcePyramidDims.x()*_sourcePyramidDims.y(),
-        nullptr,
+        _sourcePyramidDims,
         &error );
     if(_currentPyramidLevel==0)
     {
-        error = _commandQueue.enqueueCopyBuffer(*_targetMaskOriginalSize,*_targetMaskPyramidSize,
-                                                0,0,sizeof(int)*_targetPyramidDims.x()*_targetPyramidDims.y());
+        error = enqueueCopy(*_targetMaskOriginalSize,*_targetMaskPyramidSize);
     }
     else
     {
-        error = _downsampleBooleanImageKernel.setArg(0,*_targetMaskOriginalSize);
-        error = _downsampleBooleanImageKernel.setArg(1,*_targetMaskPyramidSize);
-        error = _downsampleBooleanImageKernel.setArg(2,_targetOriginalDims.x());
-        error = _downsampleBooleanImageKernel.setArg(3,_targetOriginalDims.y());
-        error = _downsampleBooleanImageKernel.setArg(4,(int)1);
-        error = _commandQueue.enqueueNDRangeKernel(_downsampleBooleanImageKernel,
-                                                   cl::NullRange,
-                                                   cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                                   cl::NullRange);
-    }
-    error = _sourceMaskFromTargetMaskKernel.setArg(0,*_targetMaskPyramidSize);
-    error = _sourceMaskFromTargetMaskKernel.setArg(1,*_sourceMaskPyramidSize);
-    error = _sourceMaskFromTargetMaskKernel.setArg(2,_patchWidth);
-    error = _commandQueue.enqueueNDRangeKernel(_sourceMaskFromTargetMaskKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_sourcePyramidDims.x(),_sourcePyramidDims.y()),
-                                               cl::NullRange);
+        error = setKernelArg(_downsampleBooleanImageKernel,0,_targetMaskOriginalSize->buffer());
+        error = setKernelArg(_downsampleBooleanImageKernel,1,_targetMaskPyramidSize->buffer());
+        error = setKernelArg(_downsampleBooleanImageKernel,2,_targetOriginalDims.x());
+        error = setKernelArg(_downsampleBooleanImageKernel,3,_targetOriginalDims.y());
+        error = setKernelArg(_downsampleBooleanImageKernel,4,(int)1);
+        error = setKernelArg(_downsampleBooleanImageKernel,5,_targetPyramidDims.x());
+        error = setKernelArg(_downsampleBooleanImageKernel,6,_targetPyramidDims.y());
+        error = enqueueKernel(_downsampleBooleanImageKernel,_targetPyramidDims);
+    }
+    error = setKernelArg(_sourceMaskFromTargetMaskKernel,0,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_sourceMaskFromTargetMaskKernel,1,_sourceMaskPyramidSize->buffer());
+    error = setKernelArg(_sourceMaskFromTargetMaskKernel,2,_patchWidth);
+    error = setKernelArg(_sourceMaskFromTargetMaskKernel,3,_sourcePyramidDims.x());
+    error = setKernelArg(_sourceMaskFromTargetMaskKernel,4,_sourcePyramidDims.y());
+    error = enqueueKernel(_sourceMaskFromTargetMaskKernel,_sourcePyramidDims);
+
+    enqueueSetupActivePixels();
 
     //anchorWeights
     enqueueSetupAnchorWeights();
@@ -419,7 +725,137 @@ void HoleFillPatchMatchOpenCL::enqueueSetupNextPyramidLevel()
         enqueueSetupNextNNF(prevTargetDims,prevSourceDims);
     }
 
+    //the list kernels never write inactive pixels' nnf entries, and no band writes the rows
+    //outside it, so both nnf buffers need to agree on them from the start
+    if(_useActivePixelList || _deviceQueues.size()>1)
+    {
+        const int numPixels = _targetPyramidDims.x()*_targetPyramidDims.y();
+        error = _commandQueue.enqueueCopyBuffer(*(_nnfCoords[_nnfReadIndex]),*(_nnfCoords[!_nnfReadIndex]),
+                                                0,0,2*sizeof(int)*numPixels,
+                                                nullptr,profileEvent("copyBuffer"));
+        error = _commandQueue.enqueueCopyBuffer(*(_nnfCosts[_nnfReadIndex]),*(_nnfCosts[!_nnfReadIndex]),
+                                                0,0,sizeof(float)*numPixels,
+                                                nullptr,profileEvent("copyBuffer"));
+    }
+
+    enqueueSetupBands();
+}
+
+void HoleFillPatchMatchOpenCL::enqueueSetupActivePixels()
+{
+    cl_int error = CL_SUCCESS;
+
+    //active pixels are the masked ones: their positions in the list are the prefix sums of
+    //the mask
+    //a recording cannot depend on the mask it was recorded with, so it uses the grid kernels
+    //and the list is not split into bands
+    if(isRecording() || _deviceQueues.size()>1)
+    {
+        _useActivePixelList = false;
+        _activePixels = nullptr;
+        return;
+    }
+
+    const int numPixels = _targetPyramidDims.x()*_targetPyramidDims.y();
+    const cl::Buffer prefixSums(_context,CL_MEM_READ_WRITE,sizeof(cl_int)*numPixels,nullptr,&error);
+    _numActivePixels = prefixSum(_targetMaskPyramidSize->buffer(),prefixSums,numPixels,true);
+    _useActivePixelList = !_useTiledKernels 
+        || _numActivePixels <= maxActiveFractionForList*numPixels;
+    if(!_useActivePixelList)
+    {
+        _activePixels = nullptr;
+        return;
+    }
+
+    _activePixels = std::make_unique< cl::Buffer >(
+        _context,
+        CL_MEM_READ_WRITE,
+        sizeof(cl_int)*std::max(_numActivePixels,1),
+        nullptr,
+        &error );
+    error = setKernelArg(_compactMaskKernel,0,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_compactMaskKernel,1,prefixSums);
+    error = setKernelArg(_compactMaskKernel,2,*_activePixels);
+    error = setKernelArg(_compactMaskKernel,3,numPixels);
+    error = enqueueKernel(_compactMaskKernel,core::IntCoord(numPixels,1));
+}
+
+int HoleFillPatchMatchOpenCL::prefixSum(
+    const cl::Buffer& input,
+    const cl::Buffer& output,
+    int count,
+    bool inputIsMask)
+{
+    cl_int error = CL_SUCCESS;
+
+    const int blockSize = static_cast< int >( _prefixSumBlockSize );
+    const int numBlocks = (count+blockSize-1)/blockSize;
+    const cl::NDRange globalSize(numBlocks*blockSize);
+    const cl::NDRange localSize(blockSize);
+
+    const cl::Buffer blockSums(_context,CL_MEM_READ_WRITE,sizeof(cl_int)*numBlocks,nullptr,&error);
+    cl::Kernel& blocksKernel = inputIsMask ? _prefixSumMaskBlocksKernel : _prefixSumBlocksKernel;
+    error = setKernelArg(blocksKernel,0,input);
+    error = setKernelArg(blocksKernel,1,output);
+    error = setKernelArg(blocksKernel,2,blockSums);
+    error = setKernelArg(blocksKernel,3,count);
+    error = setKernelArg(blocksKernel,4,cl::Local(sizeof(cl_int)*blockSize));
+    error = _commandQueue.enqueueNDRangeKernel(blocksKernel,cl::NullRange,globalSize,localSize,
+                                               nullptr,profileEvent(inputIsMask ? "prefixSumMaskBlocks" : "prefixSumBlocks"));
+
+    cl_int total = 0;
+    if(numBlocks==1)
+    {
+        error = _commandQueue.enqueueReadBuffer(blockSums,CL_TRUE,0,sizeof(cl_int),&total,
+                                                nullptr,profileEvent("readBuffer"));
+        return total;
+    }
+
+    //the blocks' offsets are the prefix sums of their totals
+    const cl::Buffer blockOffsets(_context,CL_MEM_READ_WRITE,sizeof(cl_int)*numBlocks,nullptr,&error);
+    total = prefixSum(blockSums,blockOffsets,numBlocks,false);
+    error = setKernelArg(_prefixSumAddBlockOffsetsKernel,0,output);
+    error = setKernelArg(_prefixSumAddBlockOffsetsKernel,1,blockOffsets);
+    error = setKernelArg(_prefixSumAddBlockOffsetsKernel,2,count);
+    error = _commandQueue.enqueueNDRangeKernel(_prefixSumAddBlockOffsetsKernel,cl::NullRange,globalSize,localSize,
+                                               nullptr,profileEvent("prefixSumAddBlockOffsets"));
+    return total;
+}
+
+cl_int HoleFillPatchMatchOpenCL::enqueueOverActivePixels(
+    cl::Kernel& kernel,
+    cl_uint listArgIndex,
+    const openCL::WorkGroupTuner::Buffers& inPlaceBuffers)
+{
+    if(_numActivePixels==0)
+    {
+        return CL_SUCCESS;
+    }
+    cl_int error = setKernelArg(kernel,listArgIndex,*_activePixels);
+    if(error==CL_SUCCESS)
+    {
+        error = setKernelArg(kernel,listArgIndex+1,_numActivePixels);
+    }
+    if(error!=CL_SUCCESS)
+    {
+        return error;
+    }
+    return enqueueKernel(kernel,core::IntCoord(_numActivePixels,1),nullptr,inPlaceBuffers);
+}
+
+cl_int HoleFillPatchMatchOpenCL::enqueueCopy(const openCL::RGBImage& from, const openCL::RGBImage& to)
+{
+    //the copies keep the images' memory objects alive in a recording
+    return enqueueCommand([from,to](const cl::CommandQueue& queue, cl::Event* event) {
+        return from.enqueueCopyTo(queue,to,event);
+    },"copyImage");
+}
 
+cl_int HoleFillPatchMatchOpenCL::enqueueCopy(const openCL::Mask& from, const openCL::Mask& to)
+{
+    return enqueueCommand([from,to](const cl::CommandQueue& queue, cl::Event* event) {
+        return from.enqueueCopyTo(queue,to,event);
+    },"copyMask");
 }
 
 void HoleFillPatchMatchOpenCL::enqueueInitialHoleFill()
@@ -427,50 +863,39 @@ void HoleFillPatchMatchOpenCL::enqueueInitialHoleFill()
     cl_int error = CL_SUCCESS;
 
     //black out the target image where masked
-    error = _blackOutMaskedAreaKernel.setArg(0,*_targetMaskPyramidSize);
-    error = _blackOutMaskedAreaKernel.setArg(1,*_targetPyramidSize);
-    error = _commandQueue.enqueueNDRangeKernel(_blackOutMaskedAreaKernel,
-                                       cl::NullRange,
-                                       cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                       cl::NullRange);
+    error = setKernelArg(_blackOutMaskedAreaKernel,0,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_blackOutMaskedAreaKernel,1,_targetPyramidSize->memory());
+    error = setKernelArg(_blackOutMaskedAreaKernel,2,_targetPyramidDims.x());
+    error = setKernelArg(_blackOutMaskedAreaKernel,3,_targetPyramidDims.y());
+    error = enqueueKernel(_blackOutMaskedAreaKernel,_targetPyramidDims);
 
     //finish the queue because we are going to make a new entity
     error = _commandQueue.finish();
 
     //make a new image buffer which will automatically be deleted when this function exits
-    cl::Image2D targetBuffer = cl::Image2D(_context,
-                                      CL_MEM_READ_WRITE,
-                                      cl::ImageFormat(CL_RGBA, CL_FLOAT),
-                                      _targetPyramidDims.x(), _targetPyramidDims.y(), 0, 0,&error);
-    error = _commandQueue.enqueueCopyImage(*_targetPyramidSize,targetBuffer,
-                                           getImageReadWriteCoord(0,0,0),
-                                           getImageReadWriteCoord(0,0,0),
-                                           getImageReadWriteCoord(_targetPyramidDims.x(),_targetPyramidDims.y(),1));
-    cl::Image2D* readBuffer = _targetPyramidSize.get();
-    cl::Image2D* writeBuffer = &targetBuffer;
+    const openCL::RGBImage targetBuffer(_context,_useImageBuffers,_rgbFormat,_useHostMappedImages,CL_MEM_READ_WRITE,_targetPyramidDims,&error);
+    error = enqueueCopy(*_targetPyramidSize,targetBuffer);
+    const openCL::RGBImage* readBuffer = _targetPyramidSize.get();
+    const openCL::RGBImage* writeBuffer = &targetBuffer;
 
     //MODFLAG
     const int numBlurs=100;
 
-    error = _initialHoleFillKernel.setArg(0,*_targetMaskPyramidSize);
+    error = setKernelArg(_initialHoleFillKernel,0,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_initialHoleFillKernel,3,_targetPyramidDims.x());
+    error = setKernelArg(_initialHoleFillKernel,4,_targetPyramidDims.y());
     for(int i=0; i<numBlurs; i++)
     {
-        error = _initialHoleFillKernel.setArg(1,*readBuffer);
-        error = _initialHoleFillKernel.setArg(2,*writeBuffer);
-        error = _commandQueue.enqueueNDRangeKernel(_initialHoleFillKernel,
-                                           cl::NullRange,
-                                           cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                           cl::NullRange);
+        error = setKernelArg(_initialHoleFillKernel,1,readBuffer->memory());
+        error = setKernelArg(_initialHoleFillKernel,2,writeBuffer->memory());
+        error = enqueueKernel(_initialHoleFillKernel,_targetPyramidDims);
         std::swap(readBuffer, writeBuffer);
     }
 
     //if our last buffer is our temp buffer, we need to copy targetBuffer back to targetPyramidSize
     if(readBuffer == &targetBuffer)
     {
-        error = _commandQueue.enqueueCopyImage(targetBuffer,*_targetPyramidSize,
-                                               getImageReadWriteCoord(0,0,0),
-                                               getImageReadWriteCoord(0,0,0),
-                                               getImageReadWriteCoord(_targetPyramidDims.x(),_targetPyramidDims.y(),1));
+        error = enqueueCopy(targetBuffer,*_targetPyramidSize);
 
     }
 
@@ -500,25 +925,24 @@ void HoleFillPatchMatchOpenCL::enqueueSetupFirstNNF()
     }
 
     //prepare the initial fill kernel
-    error = _nnfInitialFillKernel.setArg(0,*_targetMaskPyramidSize);
-    error = _nnfInitialFillKernel.setArg(1,*_sourceMaskPyramidSize);
-    error = _nnfInitialFillKernel.setArg(2,_sourcePyramidDims.x());
-    error = _nnfInitialFillKernel.setArg(3,_sourcePyramidDims.y());
-    error = _nnfInitialFillKernel.setArg(4,_patchWidth);
-    error = _nnfInitialFillKernel.setArg(5,*_randomBuffer);
-    error = _nnfInitialFillKernel.setArg(6,*_targetPyramidSize);
-    error = _nnfInitialFillKernel.setArg(7,*_sourcePyramidSize);
-    error = _nnfInitialFillKernel.setArg(8,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _nnfInitialFillKernel.setArg(9,*(_nnfCoords[!_nnfReadIndex]));
-    error = _nnfInitialFillKernel.setArg(10,*(_nnfCosts[!_nnfReadIndex]));
+    error = setKernelArg(_nnfInitialFillKernel,0,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_nnfInitialFillKernel,1,_sourceMaskPyramidSize->buffer());
+    error = setKernelArg(_nnfInitialFillKernel,2,_sourcePyramidDims.x());
+    error = setKernelArg(_nnfInitialFillKernel,3,_sourcePyramidDims.y());
+    error = setKernelArg(_nnfInitialFillKernel,4,_patchWidth);
+    error = setKernelArg(_nnfInitialFillKernel,5,nextRandomKey());
+    error = setKernelArg(_nnfInitialFillKernel,6,_targetPyramidSize->memory());
+    error = setKernelArg(_nnfInitialFillKernel,7,_sourcePyramidSize->memory());
+    error = setKernelArg(_nnfInitialFillKernel,8,*(_anchorWeights[_anchorWeightsReadIndex]));
+    error = setKernelArg(_nnfInitialFillKernel,9,*(_nnfCoords[!_nnfReadIndex]));
+    error = setKernelArg(_nnfInitialFillKernel,10,*(_nnfCosts[!_nnfReadIndex]));
+    error = setKernelArg(_nnfInitialFillKernel,11,_targetPyramidDims.x());
+    error = setKernelArg(_nnfInitialFillKernel,12,_targetPyramidDims.y());
 
     //swap buffers
     _nnfReadIndex = !_nnfReadIndex;
 
-    error = _commandQueue.enqueueNDRangeKernel(_nnfInitialFillKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
+    error = enqueueKernel(_nnfInitialFillKernel,_targetPyramidDims);
 
 }
 
@@ -559,63 +983,28 @@ void HoleFillPatchMatchOpenCL::enqueueSetupNextNNF(const core::IntCoord& prevTar
     //    int prevSourceWidth,
     //    int prevSourceHeight,
     //    int patchWidth,
-    //    global ulong* randomBuffer,
+    //    ulong randomKey,
     //    global int* prevNNFCoords,
     //    global int* nextNNFCoords)
     //upsample coords
-    error = _nnfUpsampleCoordsKernel.setArg(0,prevTargetDims.x());
-    error = _nnfUpsampleCoordsKernel.setArg(1,prevTargetDims.y());
-    error = _nnfUpsampleCoordsKernel.setArg(2,*_targetMaskPyramidSize);
-    error = _nnfUpsampleCoordsKernel.setArg(3,*_sourceMaskPyramidSize);
-    error = _nnfUpsampleCoordsKernel.setArg(4,_sourcePyramidDims.x());
-    error = _nnfUpsampleCoordsKernel.setArg(5,_sourcePyramidDims.y());
-    error = _nnfUpsampleCoordsKernel.setArg(6,prevSourceDims.x());
-    error = _nnfUpsampleCoordsKernel.setArg(7,prevSourceDims.y());
-    error = _nnfUpsampleCoordsKernel.setArg(8,_patchWidth);
-    error = _nnfUpsampleCoordsKernel.setArg(9,*_randomBuffer);
-    error = _nnfUpsampleCoordsKernel.setArg(10,*(_nnfCoords[_nnfReadIndex]));
-    error = _nnfUpsampleCoordsKernel.setArg(11,*(_nnfCoords[!_nnfReadIndex]));
-    error = _commandQueue.enqueueNDRangeKernel(_nnfUpsampleCoordsKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
-
-    //blend to get new targetImagePyramidSize from coords
-    error = _blendKernel.setArg(0,*(_nnfCoords[!_nnfReadIndex]));
-    error = _blendKernel.setArg(1,*_targetMaskPyramidSize);
-    error = _blendKernel.setArg(2,*_sourceMaskPyramidSize);
-    error = _blendKernel.setArg(3,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _blendKernel.setArg(4,*_sourcePyramidSize);
-    error = _blendKernel.setArg(5,*_targetPyramidSize);
-    error = _blendKernel.setArg(6,_patchWidth);
-    error = _commandQueue.enqueueNDRangeKernel(_blendKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
-
-    //now find costs
-     //       __read_only image2d_t targetImage,
-     //       __read_only image2d_t sourceImage,
-     //       global float* anchorWeights,
-     //       global int* targetMask,
-     //       global int* sourceMask,
-     //       int sourceWidth,
-     //       int patchWidth,
-     //       global int* nnfCoords, //read only
-     //       global float* nnfCosts //write only
-    error = _nnfCostsKernel.setArg(0,*_targetPyramidSize);
-    error = _nnfCostsKernel.setArg(1,*_sourcePyramidSize);
-    error = _nnfCostsKernel.setArg(2,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _nnfCostsKernel.setArg(3,*_targetMaskPyramidSize);
-    error = _nnfCostsKernel.setArg(4,*_sourceMaskPyramidSize);
-    error = _nnfCostsKernel.setArg(5,_sourcePyramidDims.x());
-    error = _nnfCostsKernel.setArg(6,_patchWidth);
-    error = _nnfCostsKernel.setArg(7,*(_nnfCoords[!_nnfReadIndex]));
-    error = _nnfCostsKernel.setArg(8,*(_nnfCosts[!_nnfReadIndex]));
-    error = _commandQueue.enqueueNDRangeKernel(_nnfCostsKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
+    error = setKernelArg(_nnfUpsampleCoordsKernel,0,prevTargetDims.x());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,1,prevTargetDims.y());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,2,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,3,_sourceMaskPyramidSize->buffer());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,4,_sourcePyramidDims.x());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,5,_sourcePyramidDims.y());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,6,prevSourceDims.x());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,7,prevSourceDims.y());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,8,_patchWidth);
+    error = setKernelArg(_nnfUpsampleCoordsKernel,9,nextRandomKey());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,10,*(_nnfCoords[_nnfReadIndex]));
+    error = setKernelArg(_nnfUpsampleCoordsKernel,11,*(_nnfCoords[!_nnfReadIndex]));
+    error = setKernelArg(_nnfUpsampleCoordsKernel,12,_targetPyramidDims.x());
+    error = setKernelArg(_nnfUpsampleCoordsKernel,13,_targetPyramidDims.y());
+    error = enqueueKernel(_nnfUpsampleCoordsKernel,_targetPyramidDims);
+
+    //blend to get new targetImagePyramidSize from coords, and find costs
+    enqueueBlend(!_nnfReadIndex);
 
     //we need to finish queue at this point because we are about to recreate nnf objects
     error = _commandQueue.finish();
@@ -659,12 +1048,11 @@ void HoleFillPatchMatchOpenCL::enqueueSetupAnchorWeights()
 
     //temporarily turn _anchorWeights[writeIndex] into an internal distance map based on
     //_targetMaskPyramidSize.
-    error = _internalDistanceMapInitKernel.setArg(0,*_targetMaskPyramidSize);
-    error = _internalDistanceMapInitKernel.setArg(1,*(_anchorWeights[!_anchorWeightsReadIndex]));
-    error = _commandQueue.enqueueNDRangeKernel(_internalDistanceMapInitKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
+    error = setKernelArg(_internalDistanceMapInitKernel,0,_targetMaskPyramidSize->buffer());
+    error = setKernelArg(_internalDistanceMapInitKernel,1,*(_anchorWeights[!_anchorWeightsReadIndex]));
+    error = setKernelArg(_internalDistanceMapInitKernel,2,_targetPyramidDims.x());
+    error = setKernelArg(_internalDistanceMapInitKernel,3,_targetPyramidDims.y());
+    error = enqueueKernel(_internalDistanceMapInitKernel,_targetPyramidDims);
     //swap buffers
     _anchorWeightsReadIndex = !_anchorWeightsReadIndex;
 
@@ -673,13 +1061,12 @@ void HoleFillPatchMatchOpenCL::enqueueSetupAnchorWeights()
 
     while(k>0)
     {
-        error = _distanceMapStepKernel.setArg(0,*(_anchorWeights[_anchorWeightsReadIndex]));
-        error = _distanceMapStepKernel.setArg(1,*(_anchorWeights[!_anchorWeightsReadIndex]));
-        error = _distanceMapStepKernel.setArg(2,k);
-        error = _commandQueue.enqueueNDRangeKernel(_distanceMapStepKernel,
-                                                   cl::NullRange,
-                                                   cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                                   cl::NullRange);
+        error = setKernelArg(_distanceMapStepKernel,0,*(_anchorWeights[_anchorWeightsReadIndex]));
+        error = setKernelArg(_distanceMapStepKernel,1,*(_anchorWeights[!_anchorWeightsReadIndex]));
+        error = setKernelArg(_distanceMapStepKernel,2,k);
+        error = setKernelArg(_distanceMapStepKernel,3,_targetPyramidDims.x());
+        error = setKernelArg(_distanceMapStepKernel,4,_targetPyramidDims.y());
+        error = enqueueKernel(_distanceMapStepKernel,_targetPyramidDims);
         //swap buffers
         _anchorWeightsReadIndex = !_anchorWeightsReadIndex;
 
@@ -687,64 +1074,97 @@ void HoleFillPatchMatchOpenCL::enqueueSetupAnchorWeights()
     }
 
     //Now turn a distmap into actual anchor weights
-    error = _anchorWeightsFromInternalDistMapKernel.setArg(0,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _anchorWeightsFromInternalDistMapKernel.setArg(1,*(_anchorWeights[!_anchorWeightsReadIndex]));
-    error = _anchorWeightsFromInternalDistMapKernel.setArg(2,_patchWidth);
-    error = _commandQueue.enqueueNDRangeKernel(_anchorWeightsFromInternalDistMapKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
+    error = setKernelArg(_anchorWeightsFromInternalDistMapKernel,0,*(_anchorWeights[_anchorWeightsReadIndex]));
+    error = setKernelArg(_anchorWeightsFromInternalDistMapKernel,1,*(_anchorWeights[!_anchorWeightsReadIndex]));
+    error = setKernelArg(_anchorWeightsFromInternalDistMapKernel,2,_patchWidth);
+    error = setKernelArg(_anchorWeightsFromInternalDistMapKernel,3,_targetPyramidDims.x());
+    error = setKernelArg(_anchorWeightsFromInternalDistMapKernel,4,_targetPyramidDims.y());
+    error = enqueueKernel(_anchorWeightsFromInternalDistMapKernel,_targetPyramidDims);
     //swap buffers
     _anchorWeightsReadIndex = !_anchorWeightsReadIndex;
 
 }
 
-void HoleFillPatchMatchOpenCL::enqueueBlend()
+void HoleFillPatchMatchOpenCL::enqueueBlend(bool nnfIndex)
 {
     cl_int error;
 
-    error = _blendKernel.setArg(0,*(_nnfCoords[_nnfReadIndex]));
-    error = _blendKernel.setArg(1,*_targetMaskPyramidSize);
-    error = _blendKernel.setArg(2,*_sourceMaskPyramidSize);
-    error = _blendKernel.setArg(3,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _blendKernel.setArg(4,*_sourcePyramidSize);
-    error = _blendKernel.setArg(5,*_targetPyramidSize);
-    error = _blendKernel.setArg(6,_patchWidth);
-    error = _commandQueue.enqueueNDRangeKernel(_blendKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
-
-    //Now need to update the nnf costs, since targetImage may be completely different now (costs may no longer be
-    //valid).
-      //      __read_only image2d_t targetImage,
-      //      __read_only image2d_t sourceImage,
-      //      global float* anchorWeights,
-      //      global int* targetMask,
-      //      global int* sourceMask,
-      //      int sourceWidth,
-      //      int patchWidth,
-      //      global int* nnfCoords, //read only
-      //      global float* nnfCosts //write only
-    error = _nnfCostsKernel.setArg(0,*_targetPyramidSize);
-    error = _nnfCostsKernel.setArg(1,*_sourcePyramidSize);
-    error = _nnfCostsKernel.setArg(2,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _nnfCostsKernel.setArg(3,*_targetMaskPyramidSize);
-    error = _nnfCostsKernel.setArg(4,*_sourceMaskPyramidSize);
-    error = _nnfCostsKernel.setArg(5,_sourcePyramidDims.x());
-    error = _nnfCostsKernel.setArg(6,_patchWidth);
-    error = _nnfCostsKernel.setArg(7,*(_nnfCoords[_nnfReadIndex]));
-    error = _nnfCostsKernel.setArg(8,*(_nnfCosts[_nnfReadIndex]));
-    error = _commandQueue.enqueueNDRangeKernel(_nnfCostsKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
+    for(size_t band=0; band<numBands(); band++)
+    {
+        if( _useTiledKernels && !_useActivePixelList ) {
+            //The fused kernel reads the unmasked target pixels from an image it does not write.
+            //In hole filling the source _is_ the target with its unmasked pixels untouched, so
+            //_sourcePyramidSize serves.
+            cl::Kernel& kernel = _blendAndCostsTiledKernel;
+            error = setKernelArg(kernel,0,bandNNFCoords(band,nnfIndex));
+            error = setKernelArg(kernel,1,_targetMaskPyramidSize->buffer());
+            error = setKernelArg(kernel,2,_sourceMaskPyramidSize->buffer());
+            error = setKernelArg(kernel,3,*(_anchorWeights[_anchorWeightsReadIndex]));
+            error = setKernelArg(kernel,4,_sourcePyramidSize->memory());
+            error = setKernelArg(kernel,5,_sourcePyramidSize->memory());
+            error = setKernelArg(kernel,6,bandTarget(band).memory());
+            error = setKernelArg(kernel,7,_patchWidth);
+            error = setKernelArg(kernel,8,_targetPyramidDims.x());
+            error = setKernelArg(kernel,9,_targetPyramidDims.y());
+            error = setKernelArg(kernel,10,_sourcePyramidDims.x());
+            error = setKernelArg(kernel,11,_sourcePyramidDims.y());
+            error = setKernelArg(kernel,12,bandNNFCosts(band,nnfIndex));
+            error = enqueueOverBand(band,kernel,13,[&](const core::IntCoord& tileDims) {
+                return prepareTiledLaunch(kernel,14,tileDims);
+            });
+            continue;
+        }
+
+        cl::Kernel& blendKernel = _useActivePixelList ? _blendListKernel : _blendKernel;
+        error = setKernelArg(blendKernel,0,bandNNFCoords(band,nnfIndex));
+        error = setKernelArg(blendKernel,1,_targetMaskPyramidSize->buffer());
+        error = setKernelArg(blendKernel,2,_sourceMaskPyramidSize->buffer());
+        error = setKernelArg(blendKernel,3,*(_anchorWeights[_anchorWeightsReadIndex]));
+        error = setKernelArg(blendKernel,4,_sourcePyramidSize->memory());
+        error = setKernelArg(blendKernel,5,bandTarget(band).memory());
+        error = setKernelArg(blendKernel,6,_patchWidth);
+        error = setKernelArg(blendKernel,7,_targetPyramidDims.x());
+        error = setKernelArg(blendKernel,8,_targetPyramidDims.y());
+        error = setKernelArg(blendKernel,9,_sourcePyramidDims.x());
+        error = setKernelArg(blendKernel,10,_sourcePyramidDims.y());
+        error = _useActivePixelList
+            ? enqueueOverActivePixels(blendKernel,11)
+            : enqueueOverBand(band,blendKernel,11);
+
+        //Now need to update the nnf costs, since targetImage may be completely different now (costs may no longer be
+        //valid).
+          //      __read_only image2d_t targetImage,
+          //      __read_only image2d_t sourceImage,
+          //      global float* anchorWeights,
+          //      global int* targetMask,
+          //      global int* sourceMask,
+          //      int sourceWidth,
+          //      int patchWidth,
+          //      global int* nnfCoords, //read only
+          //      global float* nnfCosts //write only
+        cl::Kernel& costsKernel = _useActivePixelList ? _nnfCostsListKernel : _nnfCostsKernel;
+        error = setKernelArg(costsKernel,0,bandTarget(band).memory());
+        error = setKernelArg(costsKernel,1,_sourcePyramidSize->memory());
+        error = setKernelArg(costsKernel,2,*(_anchorWeights[_anchorWeightsReadIndex]));
+        error = setKernelArg(costsKernel,3,_targetMaskPyramidSize->buffer());
+        error = setKernelArg(costsKernel,4,_sourceMaskPyramidSize->buffer());
+        error = setKernelArg(costsKernel,5,_sourcePyramidDims.x());
+        error = setKernelArg(costsKernel,6,_patchWidth);
+        error = setKernelArg(costsKernel,7,bandNNFCoords(band,nnfIndex));
+        error = setKernelArg(costsKernel,8,bandNNFCosts(band,nnfIndex));
+        error = setKernelArg(costsKernel,9,_targetPyramidDims.x());
+        error = setKernelArg(costsKernel,10,_targetPyramidDims.y());
+        error = setKernelArg(costsKernel,11,_sourcePyramidDims.y());
+        error = _useActivePixelList
+            ? enqueueOverActivePixels(costsKernel,12)
+            : enqueueOverBand(band,costsKernel,12);
+    }
 
 }
 
 void HoleFillPatchMatchOpenCL::enqueueSearch()
 {
-    //    global ulong* randomSeeds,
+    //    ulong randomKey,
     //    global float* anchorWeights,
     //    __read_only image2d_t targetImage,
     //    __read_only image2d_t sourceImage,
@@ -752,36 +1172,64 @@ void HoleFillPatchMatchOpenCL::enqueueSearch()
     //    global int* sourceMask,
     //    int patchWidth,
     //    global int* nnfCoords, //readandwrite
-    //    global float* nnfCosts //readandwrite
+    //    global float* nnfCosts, //readandwrite
+    //    int targetWidth,
+    //    int targetHeight,
+    //    int sourceWidth,
+    //    int sourceHeight,
+    //  (all but the list variant:)
+    //    int rowEnd,
+    //  (tiled variant only:)
+    //    local float4* targetApron
+    //  (list variant only:)
+    //    global const int* activePixels,
+    //    int numActivePixels
     cl_int error;
 
-    error = _searchKernel.setArg(0,*_randomBuffer);
-    error = _searchKernel.setArg(1,*(_anchorWeights[_anchorWeightsReadIndex]));
-    error = _searchKernel.setArg(2,*_targetPyramidSize);
-    error = _searchKernel.setArg(3,*_sourcePyramidSize);
-    error = _searchKernel.setArg(4,*_targetMaskPyramidSize);
-    error = _searchKernel.setArg(5,*_sourceMaskPyramidSize);
-    error = _searchKernel.setArg(6,_patchWidth);
-    //Note that, even though this kernel _does_ write to the passed nnf buffers, we
-    //are passing the read buffers, not the write buffers.  This is because the kernel
-    //does not _need_ to use both buffers.  Might as well just write to the active buffer and
-    //save a buffer swap (not that that would cost anything, necessarily).
-    error = _searchKernel.setArg(7,*(_nnfCoords[_nnfReadIndex]));
-    error = _searchKernel.setArg(8,*(_nnfCosts[_nnfReadIndex]));
-    error = _commandQueue.enqueueNDRangeKernel(_searchKernel,
-                                               cl::NullRange,
-                                               cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                               cl::NullRange);
-}
-
-void HoleFillPatchMatchOpenCL::enqueuePropagate()
-{
-    //now compute the distance map with jumpflood
-    int k = core::mathUtility::jumpfloodInitialK(_targetPyramidDims.x(),_targetPyramidDims.y());
+    cl::Kernel& kernel = _useActivePixelList ? _searchListKernel
+        : _useTiledKernels ? _searchTiledKernel : _searchKernel;
+    for(size_t band=0; band<numBands(); band++)
+    {
+        error = setKernelArg(kernel,0,nextRandomKey());
+        error = setKernelArg(kernel,1,*(_anchorWeights[_anchorWeightsReadIndex]));
+        error = setKernelArg(kernel,2,bandTarget(band).memory());
+        error = setKernelArg(kernel,3,_sourcePyramidSize->memory());
+        error = setKernelArg(kernel,4,_targetMaskPyramidSize->buffer());
+        error = setKernelArg(kernel,5,_sourceMaskPyramidSize->buffer());
+        error = setKernelArg(kernel,6,_patchWidth);
+        //Note that, even though this kernel _does_ write to the passed nnf buffers, we
+        //are passing the read buffers, not the write buffers.  This is because the kernel
+        //does not _need_ to use both buffers.  Might as well just write to the active buffer and
+        //save a buffer swap (not that that would cost anything, necessarily).
+        error = setKernelArg(kernel,7,bandNNFCoords(band,_nnfReadIndex));
+        error = setKernelArg(kernel,8,bandNNFCosts(band,_nnfReadIndex));
+        error = setKernelArg(kernel,9,_targetPyramidDims.x());
+        error = setKernelArg(kernel,10,_targetPyramidDims.y());
+        error = setKernelArg(kernel,11,_sourcePyramidDims.x());
+        error = setKernelArg(kernel,12,_sourcePyramidDims.y());
+        //the search updates the nnf in place, so tuning it must not leave extra iterations behind
+        const openCL::WorkGroupTuner::Buffers nnf = {
+            bandNNFCoords(band,_nnfReadIndex),
+            bandNNFCosts(band,_nnfReadIndex) };
+        if( _useActivePixelList ) {
+            error = enqueueOverActivePixels(kernel,13,nnf);
+        } else if( _useTiledKernels ) {
+            error = enqueueOverBand(band,kernel,13,[&](const core::IntCoord& tileDims) {
+                return prepareTiledLaunch(kernel,14,tileDims);
+            },nnf);
+        } else {
+            error = enqueueOverBand(band,kernel,13,nullptr,nnf);
+        }
+    }
+}
 
+void HoleFillPatchMatchOpenCL::enqueuePropagate(int k, int lastK)
+{
     cl_int error = CL_SUCCESS;
 
-    while(k>0)
+    cl::Kernel& kernel = _useActivePixelList ? _propagateListKernel
+        : _useTiledKernels ? _propagateTiledKernel : _propagateKernel;
+    while(k>=lastK)
     {
 
         //global float* anchorWeights,
@@ -795,27 +1243,295 @@ void HoleFillPatchMatchOpenCL::enqueuePropagate()
         //global int* nnfCoordsWrite, //writeonly
         //global float* nnfCostsRead //readonly
         //global float* nnfCostsWrite //writeonly
-        error = _propagateKernel.setArg(0,*(_anchorWeights[_anchorWeightsReadIndex]));
-        error = _propagateKernel.setArg(1,*_targetPyramidSize);
-        error = _propagateKernel.setArg(2,*_sourcePyramidSize);
-        error = _propagateKernel.setArg(3,*_targetMaskPyramidSize);
-        error = _propagateKernel.setArg(4,*_sourceMaskPyramidSize);
-        error = _propagateKernel.setArg(5,_patchWidth);
-        error = _propagateKernel.setArg(6,k);
-        error = _propagateKernel.setArg(7,*(_nnfCoords[_nnfReadIndex]));
-        error = _propagateKernel.setArg(8,*(_nnfCoords[!_nnfReadIndex]));
-        error = _propagateKernel.setArg(9,*(_nnfCosts[_nnfReadIndex]));
-        error = _propagateKernel.setArg(10,*(_nnfCosts[!_nnfReadIndex]));
-        error = _commandQueue.enqueueNDRangeKernel(_propagateKernel,
-                                                   cl::NullRange,
-                                                   cl::NDRange(_targetPyramidDims.x(),_targetPyramidDims.y()),
-                                                   cl::NullRange);
+        //int targetWidth,
+        //int targetHeight,
+        //int sourceWidth,
+        //int sourceHeight,
+        //  (all but the list variant:)
+        //int rowEnd,
+        //  (tiled variant only:)
+        //local float4* targetApron
+        //  (list variant only:)
+        //global const int* activePixels,
+        //int numActivePixels
+        for(size_t band=0; band<numBands(); band++)
+        {
+            error = setKernelArg(kernel,0,*(_anchorWeights[_anchorWeightsReadIndex]));
+            error = setKernelArg(kernel,1,bandTarget(band).memory());
+            error = setKernelArg(kernel,2,_sourcePyramidSize->memory());
+            error = setKernelArg(kernel,3,_targetMaskPyramidSize->buffer());
+            error = setKernelArg(kernel,4,_sourceMaskPyramidSize->buffer());
+            error = setKernelArg(kernel,5,_patchWidth);
+            error = setKernelArg(kernel,6,k);
+            error = setKernelArg(kernel,7,bandNNFCoords(band,_nnfReadIndex));
+            error = setKernelArg(kernel,8,bandNNFCoords(band,!_nnfReadIndex));
+            error = setKernelArg(kernel,9,bandNNFCosts(band,_nnfReadIndex));
+            error = setKernelArg(kernel,10,bandNNFCosts(band,!_nnfReadIndex));
+            error = setKernelArg(kernel,11,_targetPyramidDims.x());
+            error = setKernelArg(kernel,12,_targetPyramidDims.y());
+            error = setKernelArg(kernel,13,_sourcePyramidDims.x());
+            error = setKernelArg(kernel,14,_sourcePyramidDims.y());
+            if( _useActivePixelList ) {
+                error = enqueueOverActivePixels(kernel,15);
+            } else if( _useTiledKernels ) {
+                error = enqueueOverBand(band,kernel,15,[&](const core::IntCoord& tileDims) {
+                    return prepareTiledLaunch(kernel,16,tileDims);
+                });
+            } else {
+                error = enqueueOverBand(band,kernel,15);
+            }
+        }
 
         //swap buffers
         _nnfReadIndex = !_nnfReadIndex;
+        //every round reads its neighbours' rows as the last round left them, halos included
+        exchangeBandHalos(false);
 
         k/=2;
     }
 }
 
+void HoleFillPatchMatchOpenCL::enqueueSearchAndPropagate()
+{
+    int k = core::mathUtility::jumpfloodInitialK(_targetPyramidDims.x(),_targetPyramidDims.y());
+    if( !_useTiledKernels || _useActivePixelList || k<1 ) {
+        enqueueSearch();
+        enqueuePropagate(k);
+        return;
+    }
+
+    //the rounds before the last
+    enqueuePropagate(k,2);
+
+    //the search and the final round, k=1.  Same arguments as propagateTiled, plus the search's
+    //random key in front.
+    cl_int error;
+    cl::Kernel& kernel = _searchPropagateTiledKernel;
+    for(size_t band=0; band<numBands(); band++)
+    {
+        error = setKernelArg(kernel,0,nextRandomKey());
+        error = setKernelArg(kernel,1,*(_anchorWeights[_anchorWeightsReadIndex]));
+        error = setKernelArg(kernel,2,bandTarget(band).memory());
+        error = setKernelArg(kernel,3,_sourcePyramidSize->memory());
+        error = setKernelArg(kernel,4,_targetMaskPyramidSize->buffer());
+        error = setKernelArg(kernel,5,_sourceMaskPyramidSize->buffer());
+        error = setKernelArg(kernel,6,_patchWidth);
+        error = setKernelArg(kernel,7,1);
+        error = setKernelArg(kernel,8,bandNNFCoords(band,_nnfReadIndex));
+        error = setKernelArg(kernel,9,bandNNFCoords(band,!_nnfReadIndex));
+        error = setKernelArg(kernel,10,bandNNFCosts(band,_nnfReadIndex));
+        error = setKernelArg(kernel,11,bandNNFCosts(band,!_nnfReadIndex));
+        error = setKernelArg(kernel,12,_targetPyramidDims.x());
+        error = setKernelArg(kernel,13,_targetPyramidDims.y());
+        error = setKernelArg(kernel,14,_sourcePyramidDims.x());
+        error = setKernelArg(kernel,15,_sourcePyramidDims.y());
+        error = enqueueOverBand(band,kernel,16,[&](const core::IntCoord& tileDims) {
+            return prepareTiledLaunch(kernel,17,tileDims);
+        });
+    }
+
+    //swap buffers
+    _nnfReadIndex = !_nnfReadIndex;
+    exchangeBandHalos(false);
+}
+
+size_t HoleFillPatchMatchOpenCL::numBands() const
+{
+    return std::max< size_t >(_bands.size(),1);
+}
+
+cl::Buffer& HoleFillPatchMatchOpenCL::bandNNFCoords(size_t band, bool index) const
+{
+    return band==0 ? *(_nnfCoords[index]) : *(_bands[band].nnfCoords[index]);
+}
+
+cl::Buffer& HoleFillPatchMatchOpenCL::bandNNFCosts(size_t band, bool index) const
+{
+    return band==0 ? *(_nnfCosts[index]) : *(_bands[band].nnfCosts[index]);
+}
+
+const openCL::RGBImage& HoleFillPatchMatchOpenCL::bandTarget(size_t band) const
+{
+    return band==0 ? *_targetPyramidSize : *(_bands[band].target);
+}
+
+cl_int HoleFillPatchMatchOpenCL::enqueueOverBand(
+    size_t band,
+    cl::Kernel& kernel,
+    cl_uint rowEndArgIndex,
+    const openCL::WorkGroupTuner::PrepareLocal& prepare,
+    const openCL::WorkGroupTuner::Buffers& inPlaceBuffers)
+{
+    if(_bands.empty())
+    {
+        const cl_int error = setKernelArg(kernel,rowEndArgIndex,_targetPyramidDims.y());
+        if(error!=CL_SUCCESS)
+        {
+            return error;
+        }
+        return enqueueKernel(kernel,_targetPyramidDims,prepare,inPlaceBuffers);
+    }
+    const Band& b = _bands[band];
+    //the launch is rounded up to whole work-groups, so without this the rows past the band's
+    //end would be worked on too, from halo copies that are about to be overwritten
+    const cl_int error = setKernelArg(kernel,rowEndArgIndex,b.rowEnd);
+    if(error!=CL_SUCCESS)
+    {
+        return error;
+    }
+    return enqueueKernel(
+        band,
+        kernel,
+        core::IntCoord(0,b.rowBegin),
+        core::IntCoord(_targetPyramidDims.x(),b.rowEnd-b.rowBegin),
+        prepare,
+        inPlaceBuffers);
+}
+
+void HoleFillPatchMatchOpenCL::enqueueSetupBands()
+{
+    cl_int error = CL_SUCCESS;
+
+    _bands.clear();
+    //every band must be at least a halo high, so that halos only reach into adjacent bands
+    const int numBandsHere = std::min(
+        static_cast< int >(_deviceQueues.size()),
+        _targetPyramidDims.y()/bandHaloRows());
+    if(numBandsHere<2)
+    {
+        return;
+    }
+
+    const int width = _targetPyramidDims.x();
+    const int numPixels = width*_targetPyramidDims.y();
+    _bands.resize(numBandsHere);
+    for(int i=0; i<numBandsHere; i++)
+    {
+        Band& band = _bands[i];
+        band.rowBegin = (_targetPyramidDims.y()*i)/numBandsHere;
+        band.rowEnd = (_targetPyramidDims.y()*(i+1))/numBandsHere;
+        if(i==0)
+        {
+            continue;
+        }
+
+        //start the band's copies off as the whole of the first device's: both nnf buffers
+        //alike, since a band never writes the rows outside it and its halos
+        for(int j=0; j<2; j++)
+        {
+            band.nnfCoords[j] = std::make_unique< cl::Buffer >(
+                _context,CL_MEM_READ_WRITE,2*sizeof(int)*numPixels,nullptr,&error);
+            band.nnfCosts[j] = std::make_unique< cl::Buffer >(
+                _context,CL_MEM_READ_WRITE,sizeof(float)*numPixels,nullptr,&error);
+            error = _commandQueue.enqueueCopyBuffer(*(_nnfCoords[_nnfReadIndex]),*(band.nnfCoords[j]),
+                                                    0,0,2*sizeof(int)*numPixels,
+                                                    nullptr,profileEvent("copyBuffer"));
+            error = _commandQueue.enqueueCopyBuffer(*(_nnfCosts[_nnfReadIndex]),*(band.nnfCosts[j]),
+                                                    0,0,sizeof(float)*numPixels,
+                                                    nullptr,profileEvent("copyBuffer"));
+        }
+        band.target = std::make_unique< openCL::RGBImage >(
+            _context,
+            _useImageBuffers,
+            _rgbFormat,
+            _useHostMappedImages,
+            CL_MEM_READ_WRITE,
+            _targetPyramidDims,
+            &error );
+        error = _targetPyramidSize->enqueueCopyTo(_commandQueue,*(band.target),profileEvent("copyImage"));
+    }
+
+    //the other devices' queues must not start on the copies before they are made
+    error = _commandQueue.finish();
+}
+
+int HoleFillPatchMatchOpenCL::bandHaloRows() const
+{
+    //the rows a patch centred in one band reaches into the next, and then the rows whose nnf
+    //entries the blend of those reads
+    return _patchWidth;
+}
+
+void HoleFillPatchMatchOpenCL::finishBandQueues()
+{
+    for(const auto& queue : _deviceQueues)
+    {
+        queue.flush();
+    }
+    for(const auto& queue : _deviceQueues)
+    {
+        queue.finish();
+    }
+}
+
+void HoleFillPatchMatchOpenCL::exchangeBandHalos(bool includeTarget)
+{
+    if(_bands.empty())
+    {
+        return;
+    }
+    cl_int error = CL_SUCCESS;
+
+    //every band's writes must be done before the copies read them, and the copies must be
+    //done before any band overwrites their sources again
+    finishBandQueues();
+
+    const int width = _targetPyramidDims.x();
+    const int halo = bandHaloRows();
+    //copy rows [first,end) from band 'from's copies to band 'to's, on 'to's queue
+    const auto copyRows = [&](size_t from, size_t to, int first, int end)
+    {
+        const cl::CommandQueue& queue = _deviceQueues[to];
+        const int numRows = end-first;
+        error = queue.enqueueCopyBuffer(bandNNFCoords(from,_nnfReadIndex),bandNNFCoords(to,_nnfReadIndex),
+                                        2*sizeof(int)*width*first,2*sizeof(int)*width*first,2*sizeof(int)*width*numRows,
+                                        nullptr,profileEvent("copyBuffer"));
+        error = queue.enqueueCopyBuffer(bandNNFCosts(from,_nnfReadIndex),bandNNFCosts(to,_nnfReadIndex),
+                                        sizeof(float)*width*first,sizeof(float)*width*first,sizeof(float)*width*numRows,
+                                        nullptr,profileEvent("copyBuffer"));
+        if(includeTarget)
+        {
+            error = bandTarget(from).enqueueCopyRowsTo(queue,bandTarget(to),first,numRows,profileEvent("copyImageRows"));
+        }
+    };
+    for(size_t i=0; i+1<_bands.size(); i++)
+    {
+        const int boundary = _bands[i+1].rowBegin;
+        copyRows(i+1,i,boundary,std::min(boundary+halo,_bands[i+1].rowEnd));
+        copyRows(i,i+1,std::max(boundary-halo,_bands[i].rowBegin),boundary);
+    }
+
+    finishBandQueues();
+}
+
+void HoleFillPatchMatchOpenCL::mergeBands()
+{
+    if(_bands.empty())
+    {
+        return;
+    }
+    cl_int error = CL_SUCCESS;
+
+    finishBandQueues();
+
+    //each band's own rows go back into the first device's objects
+    const int width = _targetPyramidDims.x();
+    for(size_t i=1; i<_bands.size(); i++)
+    {
+        const Band& band = _bands[i];
+        const int numRows = band.rowEnd-band.rowBegin;
+        error = _commandQueue.enqueueCopyBuffer(*(band.nnfCoords[_nnfReadIndex]),*(_nnfCoords[_nnfReadIndex]),
+                                                2*sizeof(int)*width*band.rowBegin,2*sizeof(int)*width*band.rowBegin,
+                                                2*sizeof(int)*width*numRows,
+                                                nullptr,profileEvent("copyBuffer"));
+        error = _commandQueue.enqueueCopyBuffer(*(band.nnfCosts[_nnfReadIndex]),*(_nnfCosts[_nnfReadIndex]),
+                                                sizeof(float)*width*band.rowBegin,sizeof(float)*width*band.rowBegin,
+                                                sizeof(float)*width*numRows,
+                                                nullptr,profileEvent("copyBuffer"));
+        error = band.target->enqueueCopyRowsTo(_commandQueue,*_targetPyramidSize,band.rowBegin,numRows,
+                                               profileEvent("copyImageRows"));
+    }
+    error = _commandQueue.finish();
+}
+
 } // patchMatch
@@ -1,17 +1,25 @@
 #ifndef IEC_HOLEFILLPATCHMATCHOPENCL_H
 #define IEC_HOLEFILLPATCHMATCHOPENCL_H
 
+#include <OpenCL/commandrecording.h>
+#include <OpenCL/mask.h>
 #include <OpenCL/openclgpuhost.h>
+#include <OpenCL/profile.h>
+#include <OpenCL/rgbimage.h>
 
 #include <Core/image/imagetypes.h>
+#include <Core/image/imageview.h>
 #include <Core/utility/twodarray.h>
 #include <Core/utility/vector3.h>
 
 #include <boost/noncopyable.hpp>
 
 #include <array>
+#include <functional>
+#include <future>
 #include <memory>
 #include <queue>
+#include <vector>
 
 namespace patchMatch {
 
@@ -19,26 +27,118 @@ namespace patchMatch {
 class HoleFillPatchMatchOpenCL : public openCL::OpenCLGPUHost, private boost::noncopyable
 {
 public:
-    HoleFillPatchMatchOpenCL( const openCL::Device& device );
+    /// 'maskFormat' is how the target and source masks are stored on the device; Bits reads
+    /// the least memory but sets pixels with atomics. 'imageFormat' is how the RGB images
+    /// (inputs, pyramid levels and blend results) are stored; Half and UNorm8 halve and
+    /// quarter their memory traffic, and UNorm8 loses nothing for 8-bit inputs other than
+    /// rounding each blend result to 8 bits.
+    HoleFillPatchMatchOpenCL(
+        const openCL::Device& device,
+        openCL::MaskFormat maskFormat = openCL::MaskFormat::UChar,
+        openCL::RGBFormat imageFormat = openCL::RGBFormat::Float );
+    /// Split each pyramid level's target into horizontal bands, one per device in 'devices'
+    /// (which must share a platform), and run the steps on all of them at once, exchanging
+    /// patch-width halos of NNF and target rows after each step (and after each propagation
+    /// round). Levels too small for every device to get a band at least a halo high use fewer
+    /// devices.
+    HoleFillPatchMatchOpenCL(
+        const std::vector< openCL::Device >& devices,
+        openCL::MaskFormat maskFormat = openCL::MaskFormat::UChar,
+        openCL::RGBFormat imageFormat = openCL::RGBFormat::Float );
 
     enum Step
     {
         Blend,
         Search,
         Propagate,
-        NextPyramid
+        NextPyramid,
+        /// Search and Propagate. planStep() plans this in place of a Search that is directly
+        /// followed by a Propagate, so the two can share a kernel launch. With the fused kernel
+        /// the search runs with the last propagate round rather than before the first.
+        SearchAndPropagate,
+        /// Hand the result of the directly preceding Blend to the snapshot callback of
+        /// executeStepsAsync(); does nothing in other runs.
+        Snapshot
     };
 
+    /// The images are only read during the call, so they may view any caller memory,
+    /// including 8-bit pixels (see core::ImageRGBView). The target is also the source, so it is
+    /// uploaded once and both roles share the one device copy.
     void init(
-        const core::ImageRGB& targetOriginalSize,
-        const core::ImageBinary& targetMask, 
+        const core::ImageRGBView& targetOriginalSize,
+        const core::ImageBinaryView& targetMask, 
         int numPyramidLevels, 
         int patchWidth );
 
+    /// Random numbers on the device are a pure function of this seed (and of the steps
+    /// executed), so two runs with the same seed and plan give the same result. Takes effect
+    /// at the next init(); the default is 'defaultRandomSeed'.
+    void setRandomSeed( cl_ulong seed );
+    static const cl_ulong defaultRandomSeed;
+
+    /// Consecutive steps that have a fused implementation are merged as they are planned
+    /// (see SearchAndPropagate).
     void planStep(Step step);
 
-    /// The most recently planned step must be 'Blend'; else throw exception.
+    /// The most recently planned step must be 'Blend' (or a Snapshot of one); else throw exception.
     void executeSteps(core::ImageRGB& blendResult);
+
+    /// Called with the pyramid level and the blended target of each Snapshot step.
+    using SnapshotCallback = std::function< void( int pyramidLevel, const core::ImageRGB& snapshot ) >;
+    /// Same as executeSteps(), but run on another thread; 'blendResult' holds the result once
+    /// the returned future is ready, and this object must not be used until then. Each
+    /// Snapshot's image is copied on the device as soon as its Blend is enqueued, then read
+    /// back on a queue of its own once the copy's event completes, so 'onSnapshot' sees it
+    /// while later steps still run. Snapshots are delivered in order, on a third thread, and
+    /// all of them before the future is ready; an exception from 'onSnapshot' or from the run
+    /// is rethrown by the future's get().
+    std::future< void > executeStepsAsync(core::ImageRGB& blendResult, SnapshotCallback onSnapshot = nullptr);
+    /// Same as executeSteps(), but also time every device command of the run, and note every
+    /// failed kernel argument or enqueue, in 'report'. The timings are grouped by kernel (or
+    /// transfer), by step and by pyramid level. Runs on queues with profiling enabled, which
+    /// may be slower.
+    void executeSteps(core::ImageRGB& blendResult, openCL::ProfileReport& report);
+
+    /// The device commands of a plan run by recordSteps(): kernel launches with their
+    /// arguments and local sizes fixed, and copies, along with every memory object they use.
+    /// Replaying it needs no planning, validation, argument setting or buffer allocation.
+    class RecordedSteps : private boost::noncopyable
+    {
+    public:
+        /// Size of the images it was recorded for and must be replayed with.
+        const core::IntCoord& dims() const;
+        int patchWidth() const;
+        int numPyramidLevels() const;
+        size_t numCommands() const;
+    private:
+        friend class HoleFillPatchMatchOpenCL;
+        RecordedSteps() = default;
+
+        const HoleFillPatchMatchOpenCL* _owner;
+        core::IntCoord _dims;
+        int _patchWidth;
+        int _numPyramidLevels;
+        openCL::CommandRecording _commands;
+        /// The inputs the commands start from, and the image the last blend writes.
+        std::unique_ptr< openCL::RGBImage > _targetOriginalSize;
+        std::unique_ptr< openCL::Mask > _targetMaskOriginalSize;
+        std::unique_ptr< openCL::RGBImage > _result;
+    };
+
+    /// Same as executeSteps(), which must not have been called since init(), but also record
+    /// the plan for replaySteps(). The recording reuses the random keys of this run, and does
+    /// not use the active-pixel list, whose launch sizes depend on the mask. Throws if this
+    /// object runs on more than one device.
+    std::unique_ptr< RecordedSteps > recordSteps(core::ImageRGB& blendResult);
+    /// Run 'steps', recorded by this object, on a new target and mask of steps.dims() and
+    /// read the final blend into 'blendResult', which is what the recording run would have
+    /// given for these inputs. Drops this object's own run, so init() must be called again
+    /// before more steps are planned here.
+    void replaySteps(
+        RecordedSteps& steps,
+        const core::ImageRGBView& target,
+        const core::ImageBinaryView& targetMask,
+        core::ImageRGB& blendResult);
 private:
     void cleanupMemObjects();
     bool stepsValidForExecution();
@@ -50,9 +150,81 @@ private:
         const core::IntCoord& prevTargetDims, 
         const core::IntCoord& prevSourceDims ); 
     void enqueueInitialHoleFill();
-    void enqueueBlend();
+    /// Build _activePixels from _targetMaskPyramidSize and decide _useActivePixelList. Blocks
+    /// until the number of active pixels is known.
+    void enqueueSetupActivePixels();
+    /// Blend the target from the NNF in buffer 'nnfIndex', then recompute that buffer's costs
+    /// against the result.
+    void enqueueBlend( bool nnfIndex );
     void enqueueSearch();
-    void enqueuePropagate();
+    /// Jumpflood rounds with jump distances 'k', k/2, ..., down to 'lastK', exchanging band
+    /// halos after each.
+    void enqueuePropagate( int k, int lastK = 1 );
+    /// Where the tiled kernels are in use, the propagate rounds down to k=2, then the search
+    /// fused with the final round (k=1); otherwise enqueueSearch() then a full
+    /// enqueuePropagate().
+    void enqueueSearchAndPropagate();
+    /// Copy the target for the snapshot callback, if there is one, and start reading it back.
+    void enqueueSnapshot();
+    /// Wait for every snapshot started by enqueueSnapshot() to be delivered, and rethrow the
+    /// first exception any of them threw.
+    void finishSnapshots();
+
+    /// Exclusive prefix sums of the 'count' ints in 'input' into 'output', returning the total.
+    /// With 'inputIsMask', 'input' is an openCL::Mask's buffer, whose set pixels count as 1.
+    /// Blocks until the total is known.
+    int prefixSum( const cl::Buffer& input, const cl::Buffer& output, int count, bool inputIsMask );
+    /// Device-side copies, through enqueueCommand() so that they are recorded.
+    cl_int enqueueCopy( const openCL::RGBImage& from, const openCL::RGBImage& to );
+    cl_int enqueueCopy( const openCL::Mask& from, const openCL::Mask& to );
+    /// Launch one of the ...List kernels, whose other arguments are set, over _activePixels;
+    /// 'listArgIndex' is the index of its activePixels argument. 'inPlaceBuffers' as for
+    /// enqueueKernel().
+    cl_int enqueueOverActivePixels(
+        cl::Kernel& kernel,
+        cl_uint listArgIndex,
+        const openCL::WorkGroupTuner::Buffers& inPlaceBuffers = openCL::WorkGroupTuner::Buffers() );
+
+    /// The bands of the current level; 1 when the level is not decomposed. Band i runs on
+    /// device i; band 0 owns the primary NNF buffers and target.
+    size_t numBands() const;
+    cl::Buffer& bandNNFCoords( size_t band, bool index ) const;
+    cl::Buffer& bandNNFCosts( size_t band, bool index ) const;
+    const openCL::RGBImage& bandTarget( size_t band ) const;
+    /// Enqueue 'kernel' over the rows of 'band', on its device, first setting its argument
+    /// 'rowEndArgIndex' to the row after the band's last (the target height when there are no
+    /// bands). 'inPlaceBuffers' as for enqueueKernel().
+    cl_int enqueueOverBand(
+        size_t band,
+        cl::Kernel& kernel,
+        cl_uint rowEndArgIndex,
+        const openCL::WorkGroupTuner::PrepareLocal& prepare = nullptr,
+        const openCL::WorkGroupTuner::Buffers& inPlaceBuffers = openCL::WorkGroupTuner::Buffers() );
+    /// Decide the bands of the current level and give bands 1.. their copies of the NNF and
+    /// target. Blocks until the copies are made.
+    void enqueueSetupBands();
+    /// Rows each band needs of its neighbours.
+    int bandHaloRows() const;
+    void finishBandQueues();
+    /// Copy each band's edge rows of the read NNF (and of the target, if 'includeTarget') into
+    /// its neighbours' copies. Blocking.
+    void exchangeBandHalos( bool includeTarget );
+    /// Copy each band's rows back into band 0's objects, which then hold the whole level.
+    /// Blocking.
+    void mergeBands();
+
+    /// A fresh key for the kernels' counter-based random generator; every launch that draws
+    /// random numbers gets its own.
+    cl_ulong nextRandomKey();
+
+    /// Whether the tiled kernels (search/propagate and the fused ones) can run here at all: the
+    /// device must accept a small tile and have the local memory for its target apron (tile
+    /// plus patch halo).
+    bool tiledKernelsFit() const;
+    size_t targetApronBytes( const core::IntCoord& tileDims ) const;
+    /// WorkGroupTuner::PrepareLocal for the tiled kernels: size the __local apron argument
+    /// at 'apronArgIndex' for 'tileDims', or return false if the apron does not fit.
+    bool prepareTiledLaunch( cl::Kernel& kernel, cl_uint apronArgIndex, const core::IntCoord& tileDims );
 
     /// These are the pending operations which will be performed as soon as the user
     /// invokes executeSteps().
@@ -82,21 +254,34 @@ private:
     cl::Kernel _blackOutMaskedAreaKernel;
     cl::Kernel _initialHoleFillKernel;
     cl::Kernel _propagateKernel;
+    cl::Kernel _searchTiledKernel;
+    cl::Kernel _propagateTiledKernel;
+    cl::Kernel _searchPropagateTiledKernel;
+    cl::Kernel _blendAndCostsTiledKernel;
+    cl::Kernel _searchListKernel;
+    cl::Kernel _propagateListKernel;
+    cl::Kernel _nnfCostsListKernel;
+    cl::Kernel _blendListKernel;
     cl::Program _utilityProgram;
     cl::Kernel _downsampleRGBImageKernel;
     cl::Kernel _downsampleBooleanImageKernel;
     cl::Kernel _internalDistanceMapInitKernel;
     cl::Kernel _distanceMapStepKernel;
+    cl::Kernel _prefixSumMaskBlocksKernel;
+    cl::Kernel _prefixSumBlocksKernel;
+    cl::Kernel _prefixSumAddBlockOffsetsKernel;
+    cl::Kernel _compactMaskKernel;
 
     // OpenCL images (note that original size images are non-pointers, which mean
     // they do not need to be recreated during the lifetime of this class object.
-    std::unique_ptr< cl::Image2D > _targetOriginalSize;
-    std::unique_ptr< cl::Image2D > _sourceOriginalSize;
-    std::unique_ptr< cl::Buffer > _targetMaskOriginalSize;
-    std::unique_ptr< cl::Image2D > _targetPyramidSize;
-    std::unique_ptr< cl::Buffer > _targetMaskPyramidSize;
-    std::unique_ptr< cl::Image2D > _sourcePyramidSize;
-    std::unique_ptr< cl::Buffer > _sourceMaskPyramidSize;
+    // RGB images are OpenCL images or plain buffers depending on _useImageBuffers.
+    /// Also the full-size source: hole filling takes its patches from the target itself.
+    std::unique_ptr< openCL::RGBImage > _targetOriginalSize;
+    std::unique_ptr< openCL::Mask > _targetMaskOriginalSize;
+    std::unique_ptr< openCL::RGBImage > _targetPyramidSize;
+    std::unique_ptr< openCL::Mask > _targetMaskPyramidSize;
+    std::unique_ptr< openCL::RGBImage > _sourcePyramidSize;
+    std::unique_ptr< openCL::Mask > _sourceMaskPyramidSize;
 
     //Anchor weights is double-buffered because we use jumpflood (an inherently
     //double-buffered algorithm) to initialize it.  Jumpflood is used to create
@@ -110,10 +295,46 @@ private:
     std::array< std::unique_ptr< cl::Buffer >, 2 > _nnfCosts;
     bool _nnfReadIndex;  //treated as index into _nnfCoords and _nnfCosts
 
-    //A set of seeds enabling us to have a random sequence for every target pixel.  This is initialized
-    //with seeds generated by rand() on the CPU side, but that is done only at initialization, NOT
-    //at each pyramid level.
-    std::unique_ptr< cl::Buffer > _randomBuffer;
+    //The kernels' random numbers are hashed from a per-launch key and the pixel index (see
+    //nextRand() in holeFillPatchMatch.cl); the keys are derived from _randomSeed.
+    cl_ulong _randomSeed;
+    cl_ulong _numRandomKeysUsed;
+
+    /// Decided per init() since the apron grows with the patch width; the tile size itself
+    /// is left to the work-group tuner.
+    bool _useTiledKernels;
+    cl_ulong _localMemSize;
+    size_t _maxWorkGroupSize;
+
+    /// Indices of the masked target pixels at the current pyramid level, in order. Decided per
+    /// level: when _useActivePixelList is set, search, propagate, blend and the cost updates
+    /// run over this list instead of the whole target, and leave other pixels' nnf entries as
+    /// they are.
+    std::unique_ptr< cl::Buffer > _activePixels;
+    int _numActivePixels;
+    bool _useActivePixelList;
+    /// Elements per work-group in prefixSum(); a power of two.
+    size_t _prefixSumBlockSize;
+
+    /// Rows [rowBegin, rowEnd) of the target, and, for bands after the first, full-size copies
+    /// of the NNF and target of which only those rows and their halos are kept current. Jumps
+    /// longer than the halo read the rows beyond it as they were when the level was set up:
+    /// old, but valid, matches.
+    struct Band
+    {
+        int rowBegin;
+        int rowEnd;
+        std::array< std::unique_ptr< cl::Buffer >, 2 > nnfCoords;
+        std::array< std::unique_ptr< cl::Buffer >, 2 > nnfCosts;
+        std::unique_ptr< openCL::RGBImage > target;
+    };
+    /// Empty when the current level is not decomposed.
+    std::vector< Band > _bands;
+
+    /// Set during executeStepsAsync().
+    SnapshotCallback _snapshotCallback;
+    /// The deliveries of the snapshots of the current run, in order.
+    std::vector< std::shared_future< void > > _snapshots;
 };
 
 } // patchMatch
@@ -18,8 +18,16 @@ core::IntCoord NNF::getStoredSourceCoord( const core::IntCoord& coord ) const
 
 void NNF::init( int width, int height )
 {
-    _sourceCoords.recreate( width, height );
-    _matchCosts.recreate( width, height );
+    // Zeroed rather than left uninitialized: not every entry is written before the search
+    // reads its neighbours.
+    _sourceCoords.recreate( width, height, core::IntCoord(), core::RowLayout::AlignedRows );
+    _matchCosts.recreate( width, height, 0.0, core::RowLayout::AlignedRows );
+}
+
+void NNF::reserve( int width, int height )
+{
+    _sourceCoords.reserve( width, height, core::RowLayout::AlignedRows );
+    _matchCosts.reserve( width, height, core::RowLayout::AlignedRows );
 }
 
 double NNF::getStoredMatchCost( int targetX, int targetY ) const
@@ -26,6 +26,8 @@ public:
     /// Remove all stored data.  Set targetCoord => (0,0) for all targetCoord.  
     /// Set all _matchCosts to 0.
     void init(int width, int height);
+    /// Make room for init() at up to 'width' by 'height' without allocating.
+    void reserve(int width, int height);
     int width() const { return _sourceCoords.width(); }
     int height() const { return _sourceCoords.height(); }
 private:
@@ -0,0 +1,215 @@
+#ifndef IEC_PATCHDISTANCE_H
+#define IEC_PATCHDISTANCE_H
+
+#include <patchmatchutility.h>
+
+#include <Core/image/imagetypes.h>
+#include <Core/image/imageview.h>
+#include <Core/utility/intcoord.h>
+#include <Core/utility/twodarray.h>
+#include <Core/utility/vector3.h>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace patchMatch {
+
+/// Patch-distance policies for PatchMatch's CPU engine. Each is a small object, made once per
+/// pass over the NNF, whose call operator returns the cost of matching 'targetAnchor' in the
+/// current level's target image to 'sourceAnchor' in its source image. Once the cost passes
+/// 'costNotToExceed' a policy may stop and return any value above it. The engine's loops are
+/// templates on the policy, so each loop is compiled once per policy and calls it directly.
+namespace distance {
+
+/// Anchor-weighted RGB SSD in double precision (see utility::patchCost()).
+class WeightedSSD
+{
+public:
+    WeightedSSD(
+        int patchWidth,
+        const core::ImageView< core::Vector3 >& source,
+        const core::ImageRGB& target,
+        const core::ImageScalar& anchorWeights )
+        : _patchWidth( patchWidth )
+        , _source( source )
+        , _target( target )
+        , _anchorWeights( anchorWeights )
+    {
+    }
+
+    double operator()(
+        const core::IntCoord& sourceAnchor,
+        const core::IntCoord& targetAnchor,
+        double costNotToExceed = std::numeric_limits< double >::max() ) const
+    {
+        return utility::patchCost(
+            sourceAnchor,
+            targetAnchor,
+            _patchWidth,
+            _source,
+            _target,
+            _anchorWeights,
+            costNotToExceed );
+    }
+private:
+    int _patchWidth;
+    const core::ImageView< core::Vector3 >& _source;
+    const core::ImageRGB& _target;
+    const core::ImageScalar& _anchorWeights;
+};
+
+/// WeightedSSD from 8-bit images and single-precision weights (see utility::integerPatchCost()).
+class IntegerWeightedSSD
+{
+public:
+    IntegerWeightedSSD(
+        int patchWidth,
+        const core::TwoDArray< std::uint32_t >& source,
+        const core::TwoDArray< std::uint32_t >& target,
+        const core::TwoDArray< float >& anchorWeights )
+        : _patchWidth( patchWidth )
+        , _source( source )
+        , _target( target )
+        , _anchorWeights( anchorWeights )
+    {
+    }
+
+    double operator()(
+        const core::IntCoord& sourceAnchor,
+        const core::IntCoord& targetAnchor,
+        double costNotToExceed = std::numeric_limits< double >::max() ) const
+    {
+        return utility::integerPatchCost(
+            sourceAnchor,
+            targetAnchor,
+            _patchWidth,
+            _source,
+            _target,
+            _anchorWeights,
+            costNotToExceed );
+    }
+private:
+    int _patchWidth;
+    const core::TwoDArray< std::uint32_t >& _source;
+    const core::TwoDArray< std::uint32_t >& _target;
+    const core::TwoDArray< float >& _anchorWeights;
+};
+
+/// The sum over a patch of 'PixelCost'( source color, target color ), ignoring the anchor
+/// weights, walking the patch a row at a time and checking the bound after each row.
+template< typename PixelCost >
+class UnweightedDistance
+{
+public:
+    UnweightedDistance(
+        int patchWidth,
+        const core::ImageView< core::Vector3 >& source,
+        const core::ImageRGB& target )
+        : _patchWidth( patchWidth )
+        , _source( source )
+        , _target( target )
+    {
+    }
+
+    double operator()(
+        const core::IntCoord& sourceAnchor,
+        const core::IntCoord& targetAnchor,
+        double costNotToExceed = std::numeric_limits< double >::max() ) const
+    {
+        const int halfWidth = _patchWidth / 2;
+        double sumCost = 0;
+        for( int patchY = -halfWidth; patchY <= halfWidth; patchY++ ) {
+            const core::Vector3* source = _source.row( sourceAnchor.y() + patchY ) + sourceAnchor.x() - halfWidth;
+            const core::Vector3* target = _target.row( targetAnchor.y() + patchY ) + targetAnchor.x() - halfWidth;
+            for( int x = 0; x < _patchWidth; x++ ) {
+                sumCost += PixelCost::cost( source[ x ], target[ x ] );
+            }
+            if( sumCost > costNotToExceed ) {
+                break;
+            }
+        }
+        return sumCost;
+    }
+private:
+    int _patchWidth;
+    const core::ImageView< core::Vector3 >& _source;
+    const core::ImageRGB& _target;
+};
+
+struct SquaredDifference
+{
+    static double cost( const core::Vector3& a, const core::Vector3& b )
+    {
+        const auto rDiff = a.x() - b.x();
+        const auto gDiff = a.y() - b.y();
+        const auto bDiff = a.z() - b.z();
+        return rDiff * rDiff + gDiff * gDiff + bDiff * bDiff;
+    }
+};
+
+struct AbsoluteDifference
+{
+    static double cost( const core::Vector3& a, const core::Vector3& b )
+    {
+        return std::abs( a.x() - b.x() ) + std::abs( a.y() - b.y() ) + std::abs( a.z() - b.z() );
+    }
+};
+
+/// RGB SSD without the anchor weights.
+using SSD = UnweightedDistance< SquaredDifference >;
+/// RGB SAD without the anchor weights: cheaper than SSD, and less swayed by a few badly
+/// matched pixels.
+using SAD = UnweightedDistance< AbsoluteDifference >;
+
+/// WeightedSSD, but a candidate is first checked against a lower bound on its cost from the
+/// mean colors of the two patches: for n pixels whose weights are at least wMin, the weighted
+/// SSD is at least wMin * n * |mean difference|^2. When that bound already passes
+/// 'costNotToExceed' the patch is not read. Costs are the same as WeightedSSD's, so the NNF
+/// evolves the same way, only faster where the colors of candidates differ a lot.
+class MeanBoundedWeightedSSD
+{
+public:
+    /// 'sourceMeans' and 'targetMeans' hold each patch's mean color at its anchor, and
+    /// 'targetWeightMins' each target patch's smallest weight (see utility::patchMeans() and
+    /// utility::patchMinimums()).
+    MeanBoundedWeightedSSD(
+        const WeightedSSD& weightedSSD,
+        int patchWidth,
+        const core::ImageRGB& sourceMeans,
+        const core::ImageRGB& targetMeans,
+        const core::ImageScalar& targetWeightMins )
+        : _weightedSSD( weightedSSD )
+        // Trimmed a little so that rounding never lifts the bound above the true cost.
+        , _boundScale( patchWidth * patchWidth * ( 1. - 1e-9 ) )
+        , _sourceMeans( sourceMeans )
+        , _targetMeans( targetMeans )
+        , _targetWeightMins( targetWeightMins )
+    {
+    }
+
+    double operator()(
+        const core::IntCoord& sourceAnchor,
+        const core::IntCoord& targetAnchor,
+        double costNotToExceed = std::numeric_limits< double >::max() ) const
+    {
+        const double lowerBound = _boundScale
+            * _targetWeightMins.getRef( targetAnchor )
+            * SquaredDifference::cost( _sourceMeans.getRef( sourceAnchor ), _targetMeans.getRef( targetAnchor ) );
+        if( lowerBound > costNotToExceed ) {
+            return lowerBound;
+        }
+        return _weightedSSD( sourceAnchor, targetAnchor, costNotToExceed );
+    }
+private:
+    WeightedSSD _weightedSSD;
+    double _boundScale;
+    const core::ImageRGB& _sourceMeans;
+    const core::ImageRGB& _targetMeans;
+    const core::ImageScalar& _targetWeightMins;
+};
+
+} // distance
+} // patchMatch
+
+#endif // #include
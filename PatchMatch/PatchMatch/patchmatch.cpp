@@ -1,17 +1,23 @@
 #include <patchMatch.h>
 #include <patchMatchUtility.h>
+#include <patchdistance.h>
 
 #include <nnf.h>
 
 #include <Core/exceptions/runtimeerror.h>
 #include <Core/utility/mathutility.h>
 #include <Core/utility/twodarray.h>
+#include <Core/image/bitimage.h>
+#include <Core/image/haloimage.h>
+#include <Core/image/imagepyramid.h>
 #include <Core/image/imageutility.h>
+#include <Core/image/imageview.h>
 
 #include <omp.h>
 
 #include <boost/optional.hpp>
 
+#include <algorithm>
 #include <vector>
 
 namespace patchMatch {
@@ -21,27 +27,93 @@ constexpr bool useJumpFloodForPropagation = false;
 struct PatchMatch::Implementation
 {
     void blend( core::ImageRGB& store ) const;
-    void search();
-    void propagateLineOrder( bool topToBottom );
-    void propagateJumpFlood();
+    /// The passes over the NNF, comparing patches with 'distance' (see patchdistance.h).
+    template< typename Distance >
+    void search( const Distance& distance );
+    template< typename Distance >
+    void propagateLineOrder( const Distance& distance, bool topToBottom );
+    template< typename Distance >
+    void propagateJumpFlood( const Distance& distance );
+    /// Copy the images into the '_owned' buffers, once when the source is the target, and
+    /// take on the copies (see setInputs()).
+    void copyInputs(
+        int patchWidth,
+        const core::ImageRGB& sourceImage,
+        const core::ImageRGB& targetImage,
+        const core::ImageBinary& targetMask,
+        int numPyramidLevels );
+    /// Validate and take on the constructor arguments, and forget the source pyramid.
+    void setInputs(
+        int patchWidth,
+        const core::ImageRGBView& sourceImage,
+        const core::ImageRGBView& targetImage,
+        const core::ImageBinaryView& targetMask,
+        int numPyramidLevels );
+    /// Reserve every buffer that is rebuilt per pyramid level or per iteration at its level-0
+    /// size, so that the rebuilds reuse its storage and a whole run allocates a fixed number of
+    /// times however many levels and iterations it has.
+    void reserveLevelBuffers();
+    /// Point '_sourcePyramidSize' and '_targetMaskPyramidSize' at the current level of their
+    /// pyramids.
+    void setUpPyramidSizeImages();
+    /// Return 'visit'( distance ), 'distance' being the policy that '_distance' and
+    /// '_costPrecision' call for, over the current level's images. Called once per pass, so
+    /// that the pass's loops are compiled for the policy and call it directly.
+    template< typename Visit >
+    auto withDistance( Visit&& visit ) const;
+    /// The cost of matching 'targetAnchor' to 'sourceAnchor' at the current level, for the
+    /// one-off costs of setting up a level; the passes use withDistance() instead.
+    double patchCost(
+        const core::IntCoord& sourceAnchor,
+        const core::IntCoord& targetAnchor,
+        double costNotToExceed = std::numeric_limits< double >::max() ) const;
+    /// Bring what the distance policy derives from the current level's source image and
+    /// weights, or from its target image, up to date after they change.
+    void prepareSourceAndWeights();
+    void prepareTarget();
+    /// Fill '_sourceAnchors' and '_targetAnchors' from the current level's masks.
+    void makeAnchorMaps( const core::IntCoord& sourceSize, const core::IntCoord& targetSize );
+    /// The target image's pyramid, which is '_sourcePyramid' when the target is the source.
+    core::ImagePyramid< core::Vector3, core::ImageRGBView >& targetPyramid();
+    /// Go back to before the first pyramid level, keeping all buffers.
+    void startOver();
+
+    /// Copies of the inputs when the caller did not pass views; the views below point into
+    /// them. '_ownedSource' stays unused when the source is the target.
+    core::ImageRGB _ownedSource;
+    core::ImageRGB _ownedTarget;
+    core::ImageBinary _ownedTargetMask;
 
     /// Full-size source image (for pyramid level 0).
-    core::ImageRGB _sourceOriginal;
-    /// Current pyramid level-sized source image.
-    core::ImageRGB _sourcePyramidSize;
+    core::ImageRGBView _sourceOriginal;
+    /// Current pyramid level-sized source image: the current level of '_sourcePyramid'.
+    core::ImageView< core::Vector3 > _sourcePyramidSize;
+    /// The source image at every pyramid level, built as levels are reached. Kept by
+    /// resetTargetMask(), since it depends only on the source. Level 0 is '_sourceOriginal'
+    /// itself unless that holds 8-bit pixels.
+    core::ImagePyramid< core::Vector3, core::ImageRGBView > _sourcePyramid;
     /// Same size as '_sourcePyramidSize'. True-marked pixels are valid potential 
     /// locations for the NNF to refer to; false-marked pixels are excluded from the NNF.
-    core::ImageBinary _sourceMaskPyramidSize;
+    core::BitImage _sourceMaskPyramidSize;
 
-    /// Full-size target image (for pyramid level 0).
-    core::ImageRGB _targetOriginal;
+    /// Full-size target image (for pyramid level 0). May view the same pixels as
+    /// '_sourceOriginal'.
+    core::ImageRGBView _targetOriginal;
     /// Same size as '_targetOriginal' True-marked pixels identify the actual target
     /// image--a subset of '_targetOriginal' that the NNF must store source-image
     /// locations for. False-marked pixels are not part of the actual target image,
     /// are not involved in the NNF or the PatchMatch problem in any sense, e.g.,
     /// those pixels in '_targetOriginal' will not change their color.
-    core::ImageBinary _targetMaskOriginal;
-    core::ImageBinary _targetMaskPyramidSize;
+    core::ImageBinaryView _targetMaskOriginal;
+    /// The current level of '_targetMaskPyramid'.
+    core::ImageBinaryView _targetMaskPyramidSize;
+    /// Unused when '_targetIsSource', since the source pyramid serves both.
+    core::ImagePyramid< core::Vector3, core::ImageRGBView > _targetPyramid;
+    bool _targetIsSource = false;
+    /// Like '_sourcePyramid', but for '_targetMaskOriginal'.
+    core::ImagePyramid< bool > _targetMaskPyramid;
+    /// The target image's size at every pyramid level.
+    std::vector< core::IntCoord > _targetLevelSizes;
     /// Current pyramid level-sized target image.
     core::ImageRGB _targetPyramidSize;
     /// Same size as the current pyramid-level target image. 
@@ -50,6 +122,32 @@ struct PatchMatch::Implementation
     /// For every valid target image position X, identifies the location of a patch in the source image
     /// that should be pasted at X. This spatial correspondence is w.r.t. the current pyramid level.
     std::unique_ptr< NNF > _nnf;
+    /// Where the next NNF is built, when upsampling or jump flooding, before being swapped
+    /// with '_nnf'.
+    std::unique_ptr< NNF > _nnfBuffer;
+    /// True where a patch anchored at that position of the current level's source (target)
+    /// image lies inside the image and '_sourceMaskPyramidSize' ('_targetMaskPyramidSize') is
+    /// true at the anchor; false elsewhere, including a border of patchWidth/2 cells, so that
+    /// whether a candidate anchor may be used is one lookup.
+    core::HaloImage< bool > _sourceAnchors;
+    core::HaloImage< bool > _targetAnchors;
+    PatchDistance _distance = PatchDistance::WeightedSSD;
+    /// For PatchDistance::MeanBoundedWeightedSSD: the mean color of the patch anchored at each
+    /// pixel of the current level's source and target images, and the smallest anchor weight
+    /// of each target patch.
+    core::ImageRGB _sourcePatchMeans;
+    core::ImageRGB _targetPatchMeans;
+    core::ImageScalar _targetWeightMins;
+    core::ImageRGB _patchMeansScratch;
+    core::ImageScalar _weightMinsScratch;
+    CostPrecision _costPrecision = CostPrecision::Double;
+    /// For CostPrecision::Integer8: the current level's source and target images as 8-bit
+    /// RGBA, and its anchor weights in single precision (see utility::integerPatchCost()).
+    core::TwoDArray< std::uint32_t > _source8;
+    core::TwoDArray< std::uint32_t > _target8;
+    core::TwoDArray< float > _anchorWeightsFloat;
+    /// The previous level's '_targetMaskPyramidSize', while upsampling the NNF.
+    core::ImageBinaryView _prevTargetMask;
 
     int _patchWidth = 0 ;
     /// boost::none means first pyramid level hasn't been set up yet.
@@ -58,7 +156,41 @@ struct PatchMatch::Implementation
     bool _initialized = false;
 };
 
-void PatchMatch::Implementation::propagateJumpFlood()
+template< typename Visit >
+auto PatchMatch::Implementation::withDistance( Visit&& visit ) const
+{
+    const distance::WeightedSSD weightedSSD(
+        _patchWidth,
+        _sourcePyramidSize,
+        _targetPyramidSize,
+        _anchorWeightsPyramidSize );
+    switch( _distance ) {
+    case PatchDistance::SSD:
+        return visit( distance::SSD( _patchWidth, _sourcePyramidSize, _targetPyramidSize ) );
+    case PatchDistance::SAD:
+        return visit( distance::SAD( _patchWidth, _sourcePyramidSize, _targetPyramidSize ) );
+    case PatchDistance::MeanBoundedWeightedSSD:
+        return visit( distance::MeanBoundedWeightedSSD(
+            weightedSSD,
+            _patchWidth,
+            _sourcePatchMeans,
+            _targetPatchMeans,
+            _targetWeightMins ) );
+    case PatchDistance::WeightedSSD:
+        break;
+    }
+    if( _costPrecision == CostPrecision::Integer8 ) {
+        return visit( distance::IntegerWeightedSSD(
+            _patchWidth,
+            _source8,
+            _target8,
+            _anchorWeightsFloat ) );
+    }
+    return visit( weightedSSD );
+}
+
+template< typename Distance >
+void PatchMatch::Implementation::propagateJumpFlood( const Distance& distance )
 {
     // I am implementing jumpflood as suggested in http://www.comp.nus.edu.sg/~tants/jfa/i3d06.pdf.
     // Recall the simple case where imageWidth=imageHeight and imageWidth is power of 2.  You just
@@ -71,22 +203,17 @@ void PatchMatch::Implementation::propagateJumpFlood()
     int k = ceil(log((double)targetDim) / log(2.0));
 
     const auto& target = _targetPyramidSize;
-    const auto& targetMask = _targetMaskPyramidSize;
-    const auto& source = _sourcePyramidSize;
-    const auto& sourceMask = _sourceMaskPyramidSize;
-    const auto& anchorWeights = _anchorWeightsPyramidSize;
-    const auto targetSize = target.size();
-    const auto sourceSize = source.size();
+    const auto& targetAnchors = _targetAnchors;
+    const auto& sourceAnchors = _sourceAnchors;
 
     const auto yMin = _patchWidth / 2;
     const auto yMax = target.height() - _patchWidth / 2 - 1;
     const auto xMin = _patchWidth / 2;
     const auto xMax = target.width() - _patchWidth / 2 - 1;
 
-    auto nnfBuffer = std::make_unique< NNF >();
-    nnfBuffer->init(target.width(), target.height());
+    _nnfBuffer->init(target.width(), target.height());
     NNF* nnfRead = _nnf.get();
-    NNF* nnfWrite = nnfBuffer.get();
+    NNF* nnfWrite = _nnfBuffer.get();
 
     while (k > 0) {
 #pragma omp parallel
@@ -106,28 +233,19 @@ void PatchMatch::Implementation::propagateJumpFlood()
                                 continue;
                             }
 
+                            // Both may be up to k away from the image, so clamp into the border.
                             const core::IntCoord votingNeighbor(x + i, y + j);
-                            if (!utility::isPossibleAnchorPosition(votingNeighbor, _patchWidth, targetSize)) {
-                                continue;
-                            }
-                            if (!targetMask.get(votingNeighbor)) {
+                            if (!targetAnchors.getClamped(votingNeighbor)) {
                                 continue;
                             }
                             const core::IntCoord candidateMatch =
                                 nnfRead->getStoredSourceCoord(votingNeighbor) - core::IntCoord(i, j);
-                            if (!utility::isPossibleAnchorPosition(candidateMatch, _patchWidth, sourceSize)) {
+                            if (!sourceAnchors.getClamped(candidateMatch)) {
                                 continue;
                             }
-                            if (!sourceMask.get(candidateMatch)) {
-                                continue;
-                            }
-                            const auto matchCost = utility::patchCost(
+                            const auto matchCost = distance(
                                 candidateMatch,
                                 targetCoord,
-                                _patchWidth,
-                                source,
-                                target,
-                                anchorWeights,
                                 bestMatchCost);
                             if (matchCost < bestMatchCost) {
                                 bestMatchCost = matchCost;
@@ -144,7 +262,7 @@ void PatchMatch::Implementation::propagateJumpFlood()
     }
 
     if ( _nnf.get()  ==  nnfWrite ) {
-        _nnf = std::move( nnfBuffer );
+        std::swap( _nnf, _nnfBuffer );
     }
 }
 
@@ -152,7 +270,8 @@ void PatchMatch::Implementation::blend( core::ImageRGB& dest ) const
 {
     if (dest.width() != _targetPyramidSize.width()
      || dest.height() != _targetPyramidSize.height()) {
-        dest.recreate( _targetPyramidSize.width(), _targetPyramidSize.height() );
+        dest.recreateUninitialized(
+            _targetPyramidSize.width(), _targetPyramidSize.height(), core::RowLayout::AlignedRows );
     }
 
     const int yMin = 0;
@@ -161,6 +280,7 @@ void PatchMatch::Implementation::blend( core::ImageRGB& dest ) const
     const auto& currentTarget = _targetPyramidSize;
     const auto& targetMask = _targetMaskPyramidSize;
     const auto& sourceMask = _sourceMaskPyramidSize;
+    const auto& targetAnchors = _targetAnchors;
     const auto& anchorWeights = _anchorWeightsPyramidSize;
     const auto& nnf = _nnf;
     const auto width = dest.width();
@@ -186,13 +306,8 @@ void PatchMatch::Implementation::blend( core::ImageRGB& dest ) const
                     for (int patchY = -patchWidth / 2; patchY <= patchWidth / 2; patchY++) {
                         const auto targetAnchorX = x + patchX;
                         const auto targetAnchorY = y + patchY;
-                        if (targetAnchorX < patchWidth / 2
-                            || targetAnchorY < patchWidth / 2
-                            || targetAnchorX > dest.width() - 1 - patchWidth / 2
-                            || targetAnchorY > dest.height() - 1 - patchWidth / 2) {
-                            continue;
-                        }
-                        if (!targetMask.get(targetAnchorX, targetAnchorY)) {
+                        // At most patchWidth/2 outside the image, so within the border.
+                        if (!targetAnchors.get(targetAnchorX, targetAnchorY)) {
                             continue;
                         }
 
@@ -249,18 +364,17 @@ void PatchMatch::Implementation::blend( core::ImageRGB& dest ) const
     } // omp
 }
 
-void PatchMatch::Implementation::search()
+template< typename Distance >
+void PatchMatch::Implementation::search( const Distance& distance )
 {
     const int yMin = _patchWidth / 2;
     const int yMax = _targetPyramidSize.height() - _patchWidth / 2 - 1;
     const int xMin = _patchWidth / 2;
     const int xMax = _targetPyramidSize.width() - _patchWidth / 2 - 1;
 
-    const auto& const dest = _targetPyramidSize;
     const auto& const source = _sourcePyramidSize;
     const auto& targetMask = _targetMaskPyramidSize;
-    const auto& sourceMask = _sourceMaskPyramidSize;
-    const auto& anchorWeights = _anchorWeightsPyramidSize;
+    const auto& sourceAnchors = _sourceAnchors;
     const auto& nnf = _nnf;
     const auto patchWidth = _patchWidth;
 
@@ -296,18 +410,14 @@ void PatchMatch::Implementation::search()
                     const auto candidateSourceX = core::mathUtility::randInt( minX, maxX );
                     const auto candidateSourceY = core::mathUtility::randInt( minY, maxY );
 
-                    if (sourceMask.get(candidateSourceX, candidateSourceY))
+                    if (sourceAnchors.get(candidateSourceX, candidateSourceY))
                     {
                         const auto currentMatchCost = nnf->getStoredMatchCost(x, y);
                         const core::IntCoord potentialSourceAnchor(candidateSourceX, candidateSourceY);
                         const auto potentialMatchCost = 
-                            utility::patchCost(
+                            distance(
                                 potentialSourceAnchor,
                                 targetAnchor, 
-                                patchWidth,
-                                source, 
-                                dest,
-                                anchorWeights,
                                 currentMatchCost );
                         if ( potentialMatchCost < currentMatchCost )
                         {
@@ -322,7 +432,8 @@ void PatchMatch::Implementation::search()
     } // omp
 }
 
-void PatchMatch::Implementation::propagateLineOrder( bool topToBottom )
+template< typename Distance >
+void PatchMatch::Implementation::propagateLineOrder( const Distance& distance, bool topToBottom )
 {
     const int yStart = topToBottom ? _patchWidth / 2 : _targetPyramidSize.height() - _patchWidth / 2 - 1;
     const int yEndExclusive = topToBottom ? _targetPyramidSize.height() - _patchWidth / 2 : _patchWidth / 2 - 1;
@@ -340,34 +451,20 @@ void PatchMatch::Implementation::propagateLineOrder( bool topToBottom )
             const core::IntCoord anchor(x, y);
 
             for (int c = 0; c < numNeighbors; c++) {
-                if (c == 0 && x == xStart) continue;
-                if (c == 1 && y == yStart) continue;
-
+                // False for the neighbors of the first row and column, which are no anchors.
                 const auto neighborTargetAnchor = anchor + offsets[c];
-
-                if (!_targetMaskPyramidSize.get(neighborTargetAnchor)) continue;
+                if (!_targetAnchors.get(neighborTargetAnchor)) continue;
 
                 //what is the current cost
                 const auto currentMatchCost = _nnf->getStoredMatchCost(x, y);
                 const auto candidateSourceAnchor = 
                     _nnf->getStoredSourceCoord(neighborTargetAnchor.x(), neighborTargetAnchor.y()) - offsets[c];
 
-                if ( !_sourceMaskPyramidSize.get( candidateSourceAnchor ) ) continue;
-                if ( !utility::isPossibleAnchorPosition(
-                    candidateSourceAnchor.x(), 
-                    candidateSourceAnchor.y(), 
-                    _patchWidth, 
-                    _sourcePyramidSize.size())) {
-                    continue;
-                }
+                if ( !_sourceAnchors.get( candidateSourceAnchor ) ) continue;
 
-                const auto potentialMatchCost = utility::patchCost(
+                const auto potentialMatchCost = distance(
                     candidateSourceAnchor,
                     anchor,
-                    _patchWidth,
-                    _sourcePyramidSize,
-                    _targetPyramidSize,
-                    _anchorWeightsPyramidSize,
                     currentMatchCost);
                 if (potentialMatchCost < currentMatchCost) {
                     _nnf->set(anchor, candidateSourceAnchor, potentialMatchCost);
@@ -382,8 +479,102 @@ PatchMatch::PatchMatch(
     const core::ImageRGB& sourceImage,
     const core::ImageRGB& targetImage,
     const core::ImageBinary& targetMask,
-    int numPyramidLevels )
+    int numPyramidLevels,
+    PatchDistance distance )
     : _imp( std::make_unique< Implementation >() )
+{
+    _imp->_distance = distance;
+    _imp->copyInputs( patchWidth, sourceImage, targetImage, targetMask, numPyramidLevels );
+}
+
+PatchMatch::PatchMatch(
+    int patchWidth,
+    const core::ImageRGBView& sourceImage,
+    const core::ImageRGBView& targetImage,
+    const core::ImageBinaryView& targetMask,
+    int numPyramidLevels,
+    PatchDistance distance )
+    : _imp( std::make_unique< Implementation >() )
+{
+    _imp->_distance = distance;
+    _imp->setInputs( patchWidth, sourceImage, targetImage, targetMask, numPyramidLevels );
+}
+
+void PatchMatch::reset(
+    const core::ImageRGB& sourceImage,
+    const core::ImageRGB& targetImage,
+    const core::ImageBinary& targetMask,
+    int numPyramidLevels )
+{
+    _imp->copyInputs( _imp->_patchWidth, sourceImage, targetImage, targetMask, numPyramidLevels );
+    _imp->startOver();
+}
+
+void PatchMatch::reset(
+    const core::ImageRGBView& sourceImage,
+    const core::ImageRGBView& targetImage,
+    const core::ImageBinaryView& targetMask,
+    int numPyramidLevels )
+{
+    _imp->setInputs( _imp->_patchWidth, sourceImage, targetImage, targetMask, numPyramidLevels );
+    _imp->startOver();
+}
+
+void PatchMatch::resetTargetMask( const core::ImageBinary& targetMask )
+{
+    if ( targetMask.size() != _imp->_targetOriginal.size() ) {
+        THROW_RUNTIME("targetMask and targetImage must have same size.");
+    }
+    core::ImageBinary::clone( targetMask, _imp->_ownedTargetMask );
+    _imp->_targetMaskOriginal = _imp->_ownedTargetMask;
+    _imp->_targetMaskPyramid.reset( _imp->_targetMaskOriginal, _imp->_targetLevelSizes );
+    _imp->startOver();
+}
+
+void PatchMatch::resetTargetMask( const core::ImageBinaryView& targetMask )
+{
+    if ( targetMask.size() != _imp->_targetOriginal.size() ) {
+        THROW_RUNTIME("targetMask and targetImage must have same size.");
+    }
+    _imp->_targetMaskOriginal = targetMask;
+    _imp->_targetMaskPyramid.reset( _imp->_targetMaskOriginal, _imp->_targetLevelSizes );
+    _imp->startOver();
+}
+
+void PatchMatch::Implementation::copyInputs(
+    int patchWidth,
+    const core::ImageRGB& sourceImage,
+    const core::ImageRGB& targetImage,
+    const core::ImageBinary& targetMask,
+    int numPyramidLevels )
+{
+    core::ImageRGB::clone( targetImage, _ownedTarget );
+    core::ImageBinary::clone( targetMask, _ownedTargetMask );
+    const core::ImageRGB* ownedSource = &_ownedTarget;
+    if ( &sourceImage != &targetImage ) {
+        core::ImageRGB::clone( sourceImage, _ownedSource );
+        ownedSource = &_ownedSource;
+    }
+    setInputs(
+        patchWidth,
+        *ownedSource,
+        _ownedTarget,
+        _ownedTargetMask,
+        numPyramidLevels );
+}
+
+void PatchMatch::Implementation::startOver()
+{
+    _pyramidLevel = _numPyramidLevels - 1;
+    _initialized = false;
+}
+
+void PatchMatch::Implementation::setInputs(
+    int patchWidth,
+    const core::ImageRGBView& sourceImage,
+    const core::ImageRGBView& targetImage,
+    const core::ImageBinaryView& targetMask,
+    int numPyramidLevels )
 {
     if (!utility::patchWidthValid(patchWidth)) {
         THROW_RUNTIME("Illegal patch width.");
@@ -402,12 +593,133 @@ PatchMatch::PatchMatch(
         THROW_RUNTIME("Illegal numPyramidLevels");
     }
 
-    _imp->_numPyramidLevels = numPyramidLevels;
-    _imp->_pyramidLevel = numPyramidLevels - 1;
-    _imp->_patchWidth = patchWidth;
-    core::ImageRGB::clone( targetImage, _imp->_targetOriginal );
-    core::ImageRGB::clone( sourceImage, _imp->_sourceOriginal );
-    core::ImageBinary::clone( targetMask, _imp->_targetMaskOriginal );
+    _numPyramidLevels = numPyramidLevels;
+    _pyramidLevel = numPyramidLevels - 1;
+    _patchWidth = patchWidth;
+    _sourceOriginal = sourceImage;
+    _targetOriginal = targetImage;
+    _targetMaskOriginal = targetMask;
+
+    std::vector< core::IntCoord > sourceLevelSizes( numPyramidLevels );
+    _targetLevelSizes.resize( numPyramidLevels );
+    for( int level = 0; level < numPyramidLevels; level++ ) {
+        utility::pyramidLevelSizes(
+            level,
+            numPyramidLevels,
+            patchWidth,
+            _targetOriginal.size(),
+            _sourceOriginal.size(),
+            _targetLevelSizes[ level ],
+            sourceLevelSizes[ level ] );
+    }
+    _sourcePyramid.reset( _sourceOriginal, sourceLevelSizes );
+    _targetIsSource = _targetOriginal.sameAs( _sourceOriginal );
+    if( !_targetIsSource ) {
+        _targetPyramid.reset( _targetOriginal, _targetLevelSizes );
+    }
+    _targetMaskPyramid.reset( _targetMaskOriginal, _targetLevelSizes );
+}
+
+void PatchMatch::Implementation::reserveLevelBuffers()
+{
+    core::IntCoord targetSize, sourceSize;
+    utility::pyramidLevelSizes(
+        0,
+        _numPyramidLevels,
+        _patchWidth,
+        _targetOriginal.size(),
+        _sourceOriginal.size(),
+        targetSize,
+        sourceSize );
+
+    // Room for aligned rows is also room for packed ones, whichever way a buffer is recreated.
+    const auto aligned = core::RowLayout::AlignedRows;
+    _sourceMaskPyramidSize.reserve( sourceSize.x(), sourceSize.y() );
+    _targetPyramidSize.reserve( targetSize.x(), targetSize.y(), aligned );
+    _sourceAnchors.reserve( sourceSize.x(), sourceSize.y(), _patchWidth / 2 );
+    _targetAnchors.reserve( targetSize.x(), targetSize.y(), _patchWidth / 2 );
+    _anchorWeightsPyramidSize.reserve( targetSize.x(), targetSize.y(), aligned );
+    if( _distance == PatchDistance::MeanBoundedWeightedSSD ) {
+        _sourcePatchMeans.reserve( sourceSize.x(), sourceSize.y(), aligned );
+        _targetPatchMeans.reserve( targetSize.x(), targetSize.y(), aligned );
+        _targetWeightMins.reserve( targetSize.x(), targetSize.y(), aligned );
+        _patchMeansScratch.reserve(
+            std::max( sourceSize.x(), targetSize.x() ),
+            std::max( sourceSize.y(), targetSize.y() ),
+            aligned );
+        _weightMinsScratch.reserve( targetSize.x(), targetSize.y(), aligned );
+    }
+    if( _costPrecision == CostPrecision::Integer8 ) {
+        _source8.reserve( sourceSize.x(), sourceSize.y(), aligned );
+        _target8.reserve( targetSize.x(), targetSize.y(), aligned );
+        _anchorWeightsFloat.reserve( targetSize.x(), targetSize.y(), aligned );
+    }
+    if( !_nnf ) {
+        _nnf = std::make_unique< NNF >();
+        _nnfBuffer = std::make_unique< NNF >();
+    }
+    _nnf->reserve( targetSize.x(), targetSize.y() );
+    _nnfBuffer->reserve( targetSize.x(), targetSize.y() );
+}
+
+void PatchMatch::Implementation::setUpPyramidSizeImages()
+{
+    _sourcePyramidSize = _sourcePyramid.level( _pyramidLevel );
+    _targetMaskPyramidSize = _targetMaskPyramid.level( _pyramidLevel );
+}
+
+double PatchMatch::Implementation::patchCost(
+    const core::IntCoord& sourceAnchor,
+    const core::IntCoord& targetAnchor,
+    double costNotToExceed ) const
+{
+    return withDistance( [ & ]( const auto& distance ) {
+        return distance( sourceAnchor, targetAnchor, costNotToExceed );
+    } );
+}
+
+void PatchMatch::Implementation::prepareSourceAndWeights()
+{
+    if( _distance == PatchDistance::MeanBoundedWeightedSSD ) {
+        utility::patchMeans( _sourcePyramidSize, _patchWidth, _patchMeansScratch, _sourcePatchMeans );
+        utility::patchMinimums( _anchorWeightsPyramidSize, _patchWidth, _weightMinsScratch, _targetWeightMins );
+    }
+    if( _costPrecision == CostPrecision::Integer8 ) {
+        utility::quantizeRGB8( _sourcePyramidSize, _source8 );
+        utility::convertWeights( _anchorWeightsPyramidSize, _anchorWeightsFloat );
+    }
+}
+
+void PatchMatch::Implementation::prepareTarget()
+{
+    if( _distance == PatchDistance::MeanBoundedWeightedSSD ) {
+        utility::patchMeans( _targetPyramidSize, _patchWidth, _patchMeansScratch, _targetPatchMeans );
+    }
+    if( _costPrecision == CostPrecision::Integer8 ) {
+        utility::quantizeRGB8( _targetPyramidSize, _target8 );
+    }
+}
+
+void PatchMatch::Implementation::makeAnchorMaps(
+    const core::IntCoord& sourceSize,
+    const core::IntCoord& targetSize )
+{
+    const int halo = _patchWidth / 2;
+    _sourceAnchors.recreate( sourceSize.x(), sourceSize.y(), halo, false );
+    _sourceAnchors.fillInterior( [ & ]( int x, int y ) {
+        return utility::isPossibleAnchorPosition( x, y, _patchWidth, sourceSize )
+            && _sourceMaskPyramidSize.get( x, y );
+    }, true );
+    _targetAnchors.recreate( targetSize.x(), targetSize.y(), halo, false );
+    _targetAnchors.fillInterior( [ & ]( int x, int y ) {
+        return utility::isPossibleAnchorPosition( x, y, _patchWidth, targetSize )
+            && _targetMaskPyramidSize.get( x, y );
+    }, true );
+}
+
+core::ImagePyramid< core::Vector3, core::ImageRGBView >& PatchMatch::Implementation::targetPyramid()
+{
+    return _targetIsSource ? _sourcePyramid : _targetPyramid;
 }
 
 PatchMatch::~PatchMatch()
@@ -430,12 +742,14 @@ int PatchMatch::patchWidth() const
 void PatchMatch::propagate()
 {
     ensureInitialized();
-    if( useJumpFloodForPropagation ) {
-        _imp->propagateJumpFlood();
-    } else {
-        _imp->propagateLineOrder(true);
-        _imp->propagateLineOrder(false);
-    }
+    _imp->withDistance( [ this ]( const auto& distance ) {
+        if( useJumpFloodForPropagation ) {
+            _imp->propagateJumpFlood( distance );
+        } else {
+            _imp->propagateLineOrder( distance, true );
+            _imp->propagateLineOrder( distance, false );
+        }
+    } );
 }
 
 void PatchMatch::getTargetImagePyramidSize(core::ImageRGB& rgbStore)
@@ -447,16 +761,17 @@ void PatchMatch::getTargetImagePyramidSize(core::ImageRGB& rgbStore)
 void PatchMatch::getSourceImagePyramidSize( core::ImageRGB& rgbStore )
 {
     ensureInitialized();
-    core::ImageRGB::clone( _imp->_sourcePyramidSize, rgbStore );
+    const auto& source = _imp->_sourcePyramidSize;
+    core::imageUtility::downsample< core::Vector3 >( source, rgbStore, source.size() );
 }
 
 void PatchMatch::makeFirstTargetPyramidSize(
-    const core::ImageRGB& targetOriginalSize,
-    const core::ImageBinary& targetMaskPyramidSize,
+    const core::ImageView< core::Vector3 >& targetImagePyramidSize,
+    const core::ImageBinaryView& targetMaskPyramidSize,
     core::ImageRGB& targetPyramidSize)
 {
-    //get our first target image by downsampling from original input target image
-    core::imageUtility::downsample<core::Vector3>(targetOriginalSize,targetPyramidSize,targetMaskPyramidSize.size());
+    //our first target image is just the downsampled input target image
+    core::imageUtility::downsample<core::Vector3>(targetImagePyramidSize,targetPyramidSize,targetMaskPyramidSize.size());
 }
 
 void PatchMatch::setUpNextPyramidLevel()
@@ -469,6 +784,7 @@ void PatchMatch::setUpNextPyramidLevel()
     } else {
         // This is the first (highest-numbered) level of the pyramid operating on initial, small images.
         _imp->_pyramidLevel = _imp->_numPyramidLevels - 1;
+        _imp->reserveLevelBuffers();
     }
 
     core::IntCoord targetSize, sourceSize;
@@ -482,35 +798,30 @@ void PatchMatch::setUpNextPyramidLevel()
         sourceSize );
 
     const auto previousSourceSize = _imp->_sourcePyramidSize.size();
-    core::ImageBinary prevTargetMask;
-    core::ImageBinary::clone( _imp->_targetMaskPyramidSize, prevTargetMask ); 
-
-    core::imageUtility::downsample< core::Vector3 >(
-        _imp->_sourceOriginal,
-        _imp->_sourcePyramidSize,
-        sourceSize);
-    core::imageUtility::downsampleBoolean(
-        _imp->_targetMaskOriginal,
-        _imp->_targetMaskPyramidSize,
-        targetSize,
-        true );
+    // The pyramid keeps the previous level, so it need not be copied.
+    const auto& prevTargetMask = _imp->_prevTargetMask;
+    _imp->_prevTargetMask = _imp->_targetMaskPyramidSize;
+
+    _imp->setUpPyramidSizeImages();
 
     makeTargetWeightsAndSourceMaskAtPyramidLevel(
         _imp->_anchorWeightsPyramidSize,
         _imp->_sourceMaskPyramidSize,
         _imp->_targetMaskPyramidSize,
         sourceSize );
+    _imp->makeAnchorMaps( sourceSize, targetSize );
+    _imp->prepareSourceAndWeights();
 
     const int numTriesPerTargetPixel = std::max( targetSize.x(), targetSize.y() ) * 10;
 
     if( !_imp->_initialized ) {
         makeFirstTargetPyramidSize(
-            _imp->_targetOriginal,
+            _imp->targetPyramid().level( _imp->_pyramidLevel ),
             _imp->_targetMaskPyramidSize,
             _imp->_targetPyramidSize );
+        _imp->prepareTarget();
 
         // Randomly initialize the NNF.
-        _imp->_nnf = std::make_unique< NNF >();
         _imp->_nnf->init( targetSize.x(), targetSize.y() );
         for( int x = _imp->_patchWidth/2; x < targetSize.x() - _imp->_patchWidth / 2; x++ ) {
             for( int y = _imp->_patchWidth / 2; y < targetSize.y() - _imp->_patchWidth / 2; y++ ) {
@@ -531,14 +842,7 @@ void PatchMatch::setUpNextPyramidLevel()
                             + core::mathUtility::randInt( 0, _imp->_sourcePyramidSize.height() - _imp->_patchWidth ) );
                     if( _imp->_sourceMaskPyramidSize.get(sourceCoord) ) {
                         // We have found a source coord that is valid _and_ unmasked. 
-                        const auto costThere = utility::patchCost(
-                            sourceCoord,
-                            targetCoord,
-                            _imp->_patchWidth,
-                            _imp->_sourcePyramidSize,
-                            _imp->_targetPyramidSize,
-                            _imp->_anchorWeightsPyramidSize,
-                            std::numeric_limits<double>::max() );
+                        const auto costThere = _imp->patchCost( sourceCoord, targetCoord );
                         _imp->_nnf->set( targetCoord, sourceCoord, costThere );
                         break;
                     } else {
@@ -553,7 +857,7 @@ void PatchMatch::setUpNextPyramidLevel()
         // we do not set valid patch costs. This is because the new target image does 
         // not exist yet, and can only be constructed from the new NNF we are building 
         // right here.
-        auto nextNNF = std::make_unique< NNF >();
+        auto& nextNNF = _imp->_nnfBuffer;
         nextNNF->init( targetSize.x(), targetSize.y() );
 
         const double oldWidth = static_cast< double >( _imp->_nnf->width() );
@@ -657,14 +961,7 @@ void PatchMatch::setUpNextPyramidLevel()
 
                 //we have found a source coord that is valid _and_ unmasked.  We are done
                 core::IntCoord sourceCoord = _imp->_nnf->getStoredSourceCoord( targetCoord );
-                const auto costThere = utility::patchCost(
-                    sourceCoord,
-                    targetCoord,
-                    _imp->_patchWidth,
-                    _imp->_sourcePyramidSize,
-                    _imp->_targetPyramidSize,
-                    _imp->_anchorWeightsPyramidSize,
-                    std::numeric_limits<double>::max() );
+                const auto costThere = _imp->patchCost( sourceCoord, targetCoord );
                 _imp->_nnf->set( targetCoord, sourceCoord, costThere );
             }
         }
@@ -681,13 +978,36 @@ int PatchMatch::moveToNextPyramidLevel()
 void PatchMatch::search()
 {
     ensureInitialized();
-    _imp->search();
+    _imp->withDistance( [ this ]( const auto& distance ) { _imp->search( distance ); } );
 }
 
 void PatchMatch::blend()
 {
     ensureInitialized();
     _imp->blend( _imp->_targetPyramidSize );
+    _imp->prepareTarget();
+}
+
+PatchMatch::PatchDistance PatchMatch::patchDistance() const
+{
+    return _imp->_distance;
+}
+
+void PatchMatch::setCostPrecision( CostPrecision precision )
+{
+    if( precision == CostPrecision::Integer8 && _imp->_distance != PatchDistance::WeightedSSD ) {
+        THROW_RUNTIME( "Integer8 cost precision needs the WeightedSSD distance." );
+    }
+    _imp->_costPrecision = precision;
+    if( _imp->_initialized ) {
+        _imp->prepareSourceAndWeights();
+        _imp->prepareTarget();
+    }
+}
+
+PatchMatch::CostPrecision PatchMatch::costPrecision() const
+{
+    return _imp->_costPrecision;
 }
 
 int PatchMatch::currentPyramidLevel() const
@@ -2,10 +2,12 @@
 #define IEC_PATCHMATCH_H
 
 #include <Core/image/imagetypes.h>
+#include <Core/image/imageview.h>
 
 #include <memory>
 
 namespace core {
+class BitImage;
 class IntCoord;
 } // core
 
@@ -21,6 +23,33 @@ namespace patchMatch {
 class PatchMatch
 {
 public:
+    /// How two patches are compared (see patchdistance.h).
+    enum class PatchDistance
+    {
+        /// RGB sum of squared differences, each pixel weighted by the anchor weights of the
+        /// subclass. The default.
+        WeightedSSD,
+        /// RGB sum of squared differences, unweighted.
+        SSD,
+        /// RGB sum of absolute differences, unweighted; the cheapest per pixel.
+        SAD,
+        /// Same costs as WeightedSSD, but a candidate patch whose mean color already rules
+        /// it out is rejected without being read.
+        MeanBoundedWeightedSSD
+    };
+
+    /// How patch costs are computed.
+    enum class CostPrecision
+    {
+        /// In double precision from the RGB images (see utility::patchCost()).
+        Double,
+        /// From 8-bit copies of the images, with SIMD integer arithmetic for the channel
+        /// differences, and single-precision weights, within the tolerance documented at
+        /// utility::integerPatchCost(). About a fifth of the data to read per cost; suits 8-bit
+        /// inputs. Not a drop-in for Double: the NNF and the blended images come out different.
+        Integer8
+    };
+
     /// Set up the first, smallest-resolution pyramid level (numbered 'numPyramidLevels'-1) with
     /// a randomized NNF. 'patchWidth' must be greater than 1. 'sourceImage' is the full-size
     /// (pyramid level 0) source image from which patches will be taken for blending the target
@@ -29,15 +58,56 @@ public:
     /// the target image's full resolution (width and height must be >= 'patchWidth'). The target image
     /// encompasses those pixels of 'targetImage' where 'targetMask' is true; other pixels
     /// in 'targetImage' are left out of the process (the NNF does not have entries for them).
-    /// 'numPyramidLevels' must be at least 1.
+    /// 'numPyramidLevels' must be at least 1. 'distance' is fixed for the life of 'this'.
+    ///
+    /// The images are copied, except that passing one image as both 'sourceImage' and
+    /// 'targetImage', as hole filling does, copies it once.
     PatchMatch(
         int patchWidth,
         const core::ImageRGB& sourceImage,
         const core::ImageRGB& targetImage,
         const core::ImageBinary& targetMask,
-        int numPyramidLevels );
+        int numPyramidLevels,
+        PatchDistance distance = PatchDistance::WeightedSSD );
+    /// Same as above, but read the full-size images through views of the caller's memory,
+    /// which may hold 8-bit pixels (see core::ImageRGBView), without copying them. The viewed
+    /// memory must outlive 'this' and stay unchanged.
+    PatchMatch(
+        int patchWidth,
+        const core::ImageRGBView& sourceImage,
+        const core::ImageRGBView& targetImage,
+        const core::ImageBinaryView& targetMask,
+        int numPyramidLevels,
+        PatchDistance distance = PatchDistance::WeightedSSD );
     virtual ~PatchMatch();
 
+    /// Start over on a new problem, as if just constructed with the same patch width and
+    /// distance, but keep every buffer already allocated, so that a problem no larger than an
+    /// earlier one allocates nothing. Copies the images like the copying constructor.
+    void reset(
+        const core::ImageRGB& sourceImage,
+        const core::ImageRGB& targetImage,
+        const core::ImageBinary& targetMask,
+        int numPyramidLevels );
+    /// Same as above, but view the images like the viewing constructor.
+    void reset(
+        const core::ImageRGBView& sourceImage,
+        const core::ImageRGBView& targetImage,
+        const core::ImageBinaryView& targetMask,
+        int numPyramidLevels );
+    /// Start over on the same images with a new 'targetMask' of the same size, also keeping
+    /// the source image's pyramid levels built so far, which do not depend on the mask. The
+    /// first overload copies 'targetMask'; the second views it.
+    void resetTargetMask( const core::ImageBinary& targetMask );
+    void resetTargetMask( const core::ImageBinaryView& targetMask );
+
+    PatchDistance patchDistance() const;
+
+    /// Double by default. May be changed at any time; costs already stored in the NNF are in
+    /// the same units either way. Integer8 needs PatchDistance::WeightedSSD.
+    void setCostPrecision( CostPrecision precision );
+    CostPrecision costPrecision() const;
+
     /// Update the internally stored current-pyramid-size target image as per the current NNF.
     void blend();
 
@@ -61,12 +131,13 @@ public:
 protected:
     virtual void makeTargetWeightsAndSourceMaskAtPyramidLevel(
         core::ImageScalar& weightsDest,
-        core::ImageBinary& sourceMaskDest,
-        const core::ImageBinary& targetMaskPyramidSize,
+        core::BitImage& sourceMaskDest,
+        const core::ImageBinaryView& targetMaskPyramidSize,
         const core::IntCoord& sourcePyramidSize ) = 0;
+    /// 'targetImagePyramidSize' is the target image downsampled to the first level's size.
     virtual void makeFirstTargetPyramidSize(
-        const core::ImageRGB& targetOriginalSize,
-        const core::ImageBinary& targetMaskPyramidSize,
+        const core::ImageView< core::Vector3 >& targetImagePyramidSize,
+        const core::ImageBinaryView& targetMaskPyramidSize,
         core::ImageRGB& targetPyramidSize );
     virtual void initMaskedOutPartsOfTargetPyramidSize(
         core::ImageRGB& targetPyramidSizeRgb)=0;
@@ -5,6 +5,14 @@
 #include <Core/utility/vector3.h>
 #include <Core/utility/twodarray.h>
 #include <Core/image/imageutility.h>
+#include <Core/image/imageview.h>
+
+#include <cmath>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#include <emmintrin.h>
+#define PATCHMATCH_SSE2
+#endif
 
 namespace patchMatch {
 namespace utility {
@@ -100,8 +108,8 @@ void pyramidLevelSizes(
 }
 
 void holeFillingInitialFill(
-    const core::ImageRGB& targetOriginal,
-    const core::ImageBinary& targetMask,
+    const core::ImageView< core::Vector3 >& targetOriginal,
+    const core::ImageBinaryView& targetMask,
     core::ImageRGB& targetInitialFill)
 {
     if ( targetOriginal.width() < 2 || targetOriginal.height() < 2 ) {
@@ -218,7 +226,7 @@ double patchCost(
     const core::IntCoord& sourceAnchor,
     const core::IntCoord& targetAnchor,
     const int patchWidth,
-    const core::ImageRGB& source,
+    const core::ImageView< core::Vector3 >& source,
     const core::ImageRGB& target,
     const core::ImageScalar& anchorWeights,
     const double costNotToExceed )
@@ -255,5 +263,188 @@ double patchCost(
     return sumCost;
 }
 
+void quantizeRGB8( const core::ImageView< core::Vector3 >& image, core::TwoDArray< std::uint32_t >& dest )
+{
+    if( dest.size() != image.size() ) {
+        dest.recreateUninitialized( image.size(), core::RowLayout::AlignedRows );
+    }
+    const auto channel = []( double c ) {
+        return static_cast< std::uint32_t >( std::lround( std::min( std::max( c, 0.0 ), 1.0 ) * 255.0 ) );
+    };
+    dest.fill( [ & ]( int x, int y ) {
+        const core::Vector3 color = image.get( x, y );
+        return channel( color.x() ) | ( channel( color.y() ) << 8 ) | ( channel( color.z() ) << 16 );
+    }, true );
+}
+
+void convertWeights( const core::ImageScalar& weights, core::TwoDArray< float >& dest )
+{
+    if( dest.size() != weights.size() ) {
+        dest.recreateUninitialized( weights.size(), core::RowLayout::AlignedRows );
+    }
+    dest.zip( weights, []( float, double weight ) { return static_cast< float >( weight ); }, true );
+}
+
+namespace {
+
+/// Store in 'dest' the 'combine'd values of the 'patchWidth'-wide window, clipped to the image,
+/// around each pixel of 'image', passed to 'finish' along with the number of pixels combined.
+template< typename T, typename Combine, typename Finish >
+void windowFilter(
+    const core::ImageView< T >& image,
+    int patchWidth,
+    core::TwoDArray< T >& scratch,
+    core::TwoDArray< T >& dest,
+    Combine&& combine,
+    Finish&& finish )
+{
+    const int halfWidth = patchWidth / 2;
+    const int width = image.width();
+    const int height = image.height();
+    if( scratch.size() != image.size() ) {
+        scratch.recreateUninitialized( image.size(), core::RowLayout::AlignedRows );
+    }
+    if( dest.size() != image.size() ) {
+        dest.recreateUninitialized( image.size(), core::RowLayout::AlignedRows );
+    }
+    scratch.fill( [ & ]( int x, int y ) {
+        const T* pixels = image.row( y );
+        const int xEnd = std::min( x + halfWidth, width - 1 );
+        T result = pixels[ std::max( x - halfWidth, 0 ) ];
+        for( int xWindow = std::max( x - halfWidth, 0 ) + 1; xWindow <= xEnd; xWindow++ ) {
+            result = combine( result, pixels[ xWindow ] );
+        }
+        return result;
+    }, true );
+    dest.fill( [ & ]( int x, int y ) {
+        const int yBegin = std::max( y - halfWidth, 0 );
+        const int yEnd = std::min( y + halfWidth, height - 1 );
+        T result = scratch.getRef( x, yBegin );
+        for( int yWindow = yBegin + 1; yWindow <= yEnd; yWindow++ ) {
+            result = combine( result, scratch.getRef( x, yWindow ) );
+        }
+        const int xCount = std::min( x + halfWidth, width - 1 ) - std::max( x - halfWidth, 0 ) + 1;
+        return finish( result, xCount * ( yEnd - yBegin + 1 ) );
+    }, true );
+}
+
+} // unnamed
+
+void patchMeans(
+    const core::ImageView< core::Vector3 >& image,
+    int patchWidth,
+    core::ImageRGB& scratch,
+    core::ImageRGB& dest )
+{
+    windowFilter< core::Vector3 >(
+        image,
+        patchWidth,
+        scratch,
+        dest,
+        []( const core::Vector3& a, const core::Vector3& b ) { return a + b; },
+        []( const core::Vector3& sum, int count ) { return sum / static_cast< double >( count ); } );
+}
+
+void patchMinimums(
+    const core::ImageScalar& image,
+    int patchWidth,
+    core::ImageScalar& scratch,
+    core::ImageScalar& dest )
+{
+    windowFilter< double >(
+        image,
+        patchWidth,
+        scratch,
+        dest,
+        []( double a, double b ) { return std::min( a, b ); },
+        []( double minimum, int ) { return minimum; } );
+}
+
+namespace {
+
+/// The weighted sum of squared channel differences over 'count' pixels of one patch row.
+double integerRowCost(
+    const std::uint32_t* source,
+    const std::uint32_t* target,
+    const float* weights,
+    int count )
+{
+    double sum = 0;
+    int x = 0;
+#ifdef PATCHMATCH_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    __m128d sums = _mm_setzero_pd();
+    for( ; x + 4 <= count; x += 4 ) {
+        const __m128i sourcePixels = _mm_loadu_si128( reinterpret_cast< const __m128i* >( source + x ) );
+        const __m128i targetPixels = _mm_loadu_si128( reinterpret_cast< const __m128i* >( target + x ) );
+        // Channel differences of pixels 0-1 and 2-3 as 16-bit integers; squared and summed in
+        // pairs, giving ( r^2 + g^2, b^2 + a^2 ) per pixel.
+        const __m128i diffLow = _mm_sub_epi16(
+            _mm_unpacklo_epi8( sourcePixels, zero ), _mm_unpacklo_epi8( targetPixels, zero ) );
+        const __m128i diffHigh = _mm_sub_epi16(
+            _mm_unpackhi_epi8( sourcePixels, zero ), _mm_unpackhi_epi8( targetPixels, zero ) );
+        const __m128 squaresLow = _mm_castsi128_ps( _mm_madd_epi16( diffLow, diffLow ) );
+        const __m128 squaresHigh = _mm_castsi128_ps( _mm_madd_epi16( diffHigh, diffHigh ) );
+        const __m128i pixelCosts = _mm_add_epi32(
+            _mm_castps_si128( _mm_shuffle_ps( squaresLow, squaresHigh, _MM_SHUFFLE( 2, 0, 2, 0 ) ) ),
+            _mm_castps_si128( _mm_shuffle_ps( squaresLow, squaresHigh, _MM_SHUFFLE( 3, 1, 3, 1 ) ) ) );
+        // Weighted in double precision, two pixels at a time, so that only the weights' own
+        // rounding to float separates the products from patchCost()'s.
+        const __m128 pixelWeights = _mm_loadu_ps( weights + x );
+        sums = _mm_add_pd( sums, _mm_mul_pd(
+            _mm_cvtepi32_pd( pixelCosts ),
+            _mm_cvtps_pd( pixelWeights ) ) );
+        sums = _mm_add_pd( sums, _mm_mul_pd(
+            _mm_cvtepi32_pd( _mm_shuffle_epi32( pixelCosts, _MM_SHUFFLE( 1, 0, 3, 2 ) ) ),
+            _mm_cvtps_pd( _mm_movehl_ps( pixelWeights, pixelWeights ) ) ) );
+    }
+    alignas( 16 ) double lanes[ 2 ];
+    _mm_store_pd( lanes, sums );
+    sum = lanes[ 0 ] + lanes[ 1 ];
+#endif
+    for( ; x < count; x++ ) {
+        std::uint32_t pixelCost = 0;
+        for( int shift = 0; shift < 24; shift += 8 ) {
+            const int diff = static_cast< int >( ( source[ x ] >> shift ) & 0xff )
+                - static_cast< int >( ( target[ x ] >> shift ) & 0xff );
+            pixelCost += diff * diff;
+        }
+        sum += static_cast< double >( pixelCost ) * weights[ x ];
+    }
+    return sum;
+}
+
+} // unnamed
+
+double integerPatchCost(
+    const core::IntCoord& sourceAnchor,
+    const core::IntCoord& targetAnchor,
+    const int patchWidth,
+    const core::TwoDArray< std::uint32_t >& source,
+    const core::TwoDArray< std::uint32_t >& target,
+    const core::TwoDArray< float >& weights,
+    const double costNotToExceed )
+{
+    const int halfWidth = patchWidth / 2;
+    // A channel difference d is d / 255 in patchCost()'s units.
+    const double scale = 1. / ( 255. * 255. );
+
+    double sumCost = 0;
+    for( int patchY = -halfWidth; patchY <= halfWidth; patchY++ ) {
+        const int sourceX = sourceAnchor.x() - halfWidth;
+        const int targetX = targetAnchor.x() - halfWidth;
+        sumCost += integerRowCost(
+            source.row( sourceAnchor.y() + patchY ) + sourceX,
+            target.row( targetAnchor.y() + patchY ) + targetX,
+            weights.row( targetAnchor.y() + patchY ) + targetX,
+            patchWidth ) * scale;
+        // Checked once per row instead of once per pixel; any sum past the bound will do.
+        if( sumCost > costNotToExceed ) {
+            break;
+        }
+    }
+    return sumCost;
+}
+
 } // utility
 } // patchMatch
\ No newline at end of file
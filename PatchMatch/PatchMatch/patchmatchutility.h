@@ -4,6 +4,7 @@
 #include <Core/image/imagetypes.h>
 
 #include <algorithm>
+#include <cstdint>
 
 namespace core {
 class IntCoord;
@@ -45,20 +46,70 @@ double patchCost(
     const core::IntCoord& sourceAnchor,
     const core::IntCoord& targetAnchor,
     const int patchWidth,
-    const core::ImageRGB& source,
+    const core::ImageView< core::Vector3 >& source,
     const core::ImageRGB& target,
     const core::ImageScalar& anchorWeights,
     const double costNotToExceed=std::numeric_limits<double>::max());
 
+/// Write 'image' into 'dest' as 8-bit RGBA pixels, red in the lowest byte and alpha 0, each
+/// channel rounded to the nearest of c / 255.
+void quantizeRGB8( const core::ImageView< core::Vector3 >& image, core::TwoDArray< std::uint32_t >& dest );
+/// Write 'weights' into 'dest' in single precision. Each weight keeps its own relative
+/// precision, so the small weights deep in a hole are not flattened against the large ones
+/// outside it, as they would be by fixed point relative to the largest weight.
+void convertWeights( const core::ImageScalar& weights, core::TwoDArray< float >& dest );
+
+/// patchCost() from the quantized images (see above) and single-precision weights: each
+/// pixel's squared 8-bit channel differences are summed exactly in integers, then weighted
+/// and accumulated in double precision. Rows of a patch go four pixels at a time with SSE2
+/// where available.
+///
+/// Tolerance: every weight is off by at most 2^-24 of itself, which alone keeps the cost within
+/// about 1e-7 of patchCost(), relative to the cost. Rounding the channels adds more, and the
+/// target's hole pixels are blend results, so they are rounded at every pyramid level (only
+/// level 0 of 8-bit inputs outside the hole is exact). With each channel off by up to 0.5 / 255,
+/// a channel difference d is off by up to 1 / 255 and its square by up to
+/// ( 2 * 255 * |d| + 1 ) / 255^2, so the cost is off by at most
+///
+///     sum over the patch of w * sum over channels of ( 2 * 255 * |d| + 1 ) / 255^2
+///
+/// plus the 1e-7 relative, where w is the pixel's weight. For near-identical patches that is a
+/// large share of the cost, enough to reorder close candidates: expect runs using this cost to
+/// pick different matches than runs using patchCost(), and their images to differ about as
+/// much as two patchCost() runs with different random seeds do.
+double integerPatchCost(
+    const core::IntCoord& sourceAnchor,
+    const core::IntCoord& targetAnchor,
+    const int patchWidth,
+    const core::TwoDArray< std::uint32_t >& source,
+    const core::TwoDArray< std::uint32_t >& target,
+    const core::TwoDArray< float >& weights,
+    const double costNotToExceed=std::numeric_limits<double>::max());
+
 /// Return whether (x,y) is far enough away from the border of the implied image that
 /// a patch of width 'patchWidth' placed there would not extend out of the image.
 bool isPossibleAnchorPosition( int x, int y, int patchWidth, const core::IntCoord& imageSize );
 bool isPossibleAnchorPosition( const core::IntCoord& coord, int patchWidth, const core::IntCoord& imageSize );
 
+/// Store in 'dest' the mean color of the 'patchWidth'-wide patch centered on each pixel of
+/// 'image', patches being clipped at the image's edges. Works separably, rows first, keeping
+/// the row pass in 'scratch'; both are recreated only if their size differs.
+void patchMeans(
+    const core::ImageView< core::Vector3 >& image,
+    int patchWidth,
+    core::ImageRGB& scratch,
+    core::ImageRGB& dest );
+/// Same as above, but the smallest value in each patch.
+void patchMinimums(
+    const core::ImageScalar& image,
+    int patchWidth,
+    core::ImageScalar& scratch,
+    core::ImageScalar& dest );
+
 /// 'targetMask' - true means hole-to-be-filled (an actual part of the "target image").
 void holeFillingInitialFill(
-    const core::ImageRGB& target,
-    const core::ImageBinary& targetMask, 
+    const core::ImageView< core::Vector3 >& target,
+    const core::ImageBinaryView& targetMask, 
     core::ImageRGB& targetInitialFill );
 
 } // utility
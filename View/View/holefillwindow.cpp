@@ -108,10 +108,9 @@ void HoleFillWindow::attemptInitialOpenCLDeviceSetup()
     _availableDevices.clear();
     const auto platforms = openCL::Platform::platforms();
     for (const auto& p : platforms) {
+        // Devices without image support are fine; the OpenCL engine falls back on buffers.
         for (const auto& d : p.devices()) {
-            if (d.supportsImages()) {
-                _availableDevices.push_back(d);
-            }
+            _availableDevices.push_back(d);
         }
     }
 
@@ -120,7 +119,7 @@ void HoleFillWindow::attemptInitialOpenCLDeviceSetup()
         QMessageBox::warning(
             this,
             programName(),
-            "No image-supporting OpenCL device found. You can still perform operations using the non-OpenCL implementation." );
+            "No OpenCL device found. You can still perform operations using the non-OpenCL implementation." );
     } else {
         // Do we remember a device selection from the last time we ran?
         for (const auto& d : _availableDevices) {
@@ -155,6 +154,8 @@ void HoleFillWindow::respondToDeviceSelection( const boost::optional< openCL::De
 
 void HoleFillWindow::loadTargetImage( core::ImageRGB&& toOwn )
 {
+    // The CPU engine views the old image.
+    _patchMatchCPU = nullptr;
     _targetImage = std::move( toOwn );
     _label->clearHole();
     _label->loadLayer(_targetImage, 0);
@@ -264,6 +265,25 @@ void HoleFillWindow::recordHole()
     outFile.close();
 }
 
+void HoleFillWindow::resetPatchMatchCPU()
+{
+    // One engine serves every fill of '_targetImage', viewing it rather than copying it, so
+    // that later fills reuse its buffers and its source pyramid.
+    core::ImageBinary::clone( _label->hole(), _patchMatchHole );
+    const core::ImageBinaryView holeView( _patchMatchHole );
+    if (!_patchMatchCPU) {
+        const core::ImageRGBView targetView( _targetImage );
+        _patchMatchCPU = std::make_unique< patchMatch::HoleFillPatchMatch >(
+            _patchWidth,
+            targetView,
+            targetView,
+            holeView,
+            numPyramidLevels );
+    } else {
+        _patchMatchCPU->resetTargetMask( holeView );
+    }
+}
+
 void HoleFillWindow::displayTimeTaken(double seconds)
 {
     const auto megapixels = ((double)(_targetImage.width() * _targetImage.height())) * 0.000001;
@@ -330,12 +350,7 @@ void HoleFillWindow::automaticFillCPUSlot()
     QElapsedTimer stopwatch;
     stopwatch.start();
 
-    _patchMatchCPU = std::make_unique< patchMatch::HoleFillPatchMatch >(
-        _patchWidth,
-        _targetImage,
-        _targetImage,
-        _label->hole(),
-        numPyramidLevels );
+    resetPatchMatchCPU();
 
     // Do base level.
     for (int i = 0; i < auto_numRounds_baseLevel; i++) {
@@ -386,12 +401,7 @@ void HoleFillWindow::startManualFillSlot()
     core::ImageBinary::clone(_label->hole(), _backupHole);
     recordHole();
 
-    _patchMatchCPU = std::make_unique< patchMatch::HoleFillPatchMatch >(
-        _patchWidth,
-        _targetImage,
-        _targetImage,
-        _label->hole(),
-        numPyramidLevels );
+    resetPatchMatchCPU();
 
     // Show the initial target.
     core::ImageRGB display;
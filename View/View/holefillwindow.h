@@ -44,6 +44,8 @@ private slots:
     void quitManualFillSlot();
 private:
     void displayTimeTaken( double seconds);
+    /// Point '_patchMatchCPU' at the current image and hole, creating it if need be.
+    void resetPatchMatchCPU();
     QString programName() { return "PatchMatch"; }
     QString companyName() { return "Greg Philbrick"; }
     /// Return whether the input image was successfully replaced with the indicated image file.
@@ -68,6 +70,9 @@ private:
     int _patchWidth;
     HoleFillLabel* _label;
     core::ImageRGB _targetImage;
+    /// The hole '_patchMatchCPU' views: a copy, since the label's can be edited while the engine
+    /// is in use.
+    core::ImageBinary _patchMatchHole;
 
     std::unique_ptr< patchMatch::HoleFillPatchMatch > _patchMatchCPU;
     std::unique_ptr< patchMatch::HoleFillPatchMatchOpenCL > _patchMatchOpenCL;